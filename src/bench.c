@@ -0,0 +1,1089 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libzmbv/zmbv.h"
+#include "libzmbv/zmbv_avi.h"
+#include "libzmbv/zmbv_avi_reader.h"
+#include "libzmbv/zmbv_file.h"
+#include "libzmbv/zmbv_trace.h"
+#include "libzmbvu/zmbvu.h"
+
+
+/* synthetic content benchmark: encodes generated frames, decodes them back with libzmbv */
+/* (when it has the decoder) and libzmbvu, and writes them to an AVI */
+/* with --corpus it replays a recorded capture through a matrix of encoder settings instead */
+/* run "bench --help" for options */
+
+
+////////////////////////////////////////////////////////////////////////////////
+enum {
+  CONTENT_STATIC,  /* one picture, never changes */
+  CONTENT_SCROLL,  /* picture scrolls up by one line per frame */
+  CONTENT_NOISE,   /* random pixels every frame */
+  CONTENT_PALETTE, /* one picture, palette rotates every frame */
+  CONTENT_MOTION,  /* every pixel moves every frame */
+  CONTENT_MAX
+};
+
+static const char *content_names[CONTENT_MAX] = {"static", "scroll", "noise", "palette", "motion"};
+
+typedef struct {
+  int width, height;
+} bench_size_t;
+
+static const bench_size_t default_sizes[] = {
+  {320, 200}, {640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160},
+};
+
+static const int default_bpps[] = {8, 15, 16, 32};
+
+
+typedef struct {
+  int content, width, height, bpp, frames;
+  uint64_t raw_bytes; /* source pixels */
+  uint64_t packed_bytes; /* encoded frames */
+  double enc_secs, dec_secs, decu_secs, avi_secs; /* <0: not run */
+  int dec_ok, decu_ok; /* last decoded frame matches the source */
+  zmbv_encode_counters_t enc;
+#ifdef ZMBV_INCLUDE_DECODER
+  zmbv_decode_counters_t dec;
+#endif
+  zmbvu_decode_counters_t decu;
+} bench_result_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+/* options */
+static bench_size_t sizes[64];
+static int size_count = 0;
+static int bpps[8];
+static int bpp_count = 0;
+static int contents[CONTENT_MAX];
+static int content_count = 0;
+static int frame_limit = 0; /* 0: from pixel budget */
+static int complevel = ZMBV_DEFAULT_COMPRESSION;
+static int keyint = 300;
+static const char *avi_name = "bench.avi";
+static const char *json_name = NULL;
+static const char *trace_name = NULL;
+static int quiet = 0;
+
+
+////////////////////////////////////////////////////////////////////////////////
+static double bench_secs (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+
+/* deterministic, so every run sees the same frames */
+static uint32_t rnd_state;
+
+static uint32_t rnd (void) {
+  rnd_state = rnd_state*1103515245u+12345u;
+  return rnd_state>>8;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/* content is generated as 8-bit color indices and converted to the frame format */
+/* through the palette, so palette cycling works for every format */
+typedef struct {
+  int width, height, bpp, pixelsize;
+  uint8_t *index; /* width*height */
+  uint8_t *pixels; /* width*height*pixelsize */
+  uint8_t basepal[768];
+  uint8_t pal[768];
+  uint8_t sintab[256];
+} gen_t;
+
+
+static uint8_t gen_pattern (int x, int y) {
+  /* tiles with gradients and a bit of detail, like a game screen */
+  int tile = ((x>>4)^(y>>4))&7;
+  return (uint8_t)(tile*32+((x+y)&15)+((x*y)&(tile < 2 ? 0 : 7)));
+}
+
+
+static int gen_init (gen_t *g, int width, int height, int bpp) {
+  memset(g, 0, sizeof(*g));
+  g->width = width;
+  g->height = height;
+  g->bpp = bpp;
+  g->pixelsize = (bpp == 8 ? 1 : bpp == 32 ? 4 : 2);
+  g->index = malloc((size_t)width*height);
+  g->pixels = malloc((size_t)width*height*g->pixelsize);
+  if (g->index == NULL || g->pixels == NULL) return -1;
+  for (int f = 0; f < 256; ++f) {
+    g->basepal[f*3+0] = (uint8_t)(f*7);
+    g->basepal[f*3+1] = (uint8_t)(f*3+(f>>2));
+    g->basepal[f*3+2] = (uint8_t)(255-f);
+    /* 0..254 sine */
+    g->sintab[f] = (uint8_t)(127+(int)(127*sin(f*3.14159265358979/128)));
+  }
+  memcpy(g->pal, g->basepal, 768);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) g->index[y*width+x] = gen_pattern(x, y);
+  }
+  rnd_state = 0x29a;
+  return 0;
+}
+
+
+static void gen_free (gen_t *g) {
+  free(g->index);
+  free(g->pixels);
+  g->index = g->pixels = NULL;
+}
+
+
+static void gen_convert (gen_t *g) {
+  int count = g->width*g->height;
+  const uint8_t *src = g->index;
+  switch (g->bpp) {
+    case 8:
+      memcpy(g->pixels, src, count);
+      break;
+    case 15: case 16: {
+      uint16_t lut[256], *dest = (uint16_t *)g->pixels;
+      for (int f = 0; f < 256; ++f) {
+        int r = g->pal[f*3+0], gr = g->pal[f*3+1], b = g->pal[f*3+2];
+        lut[f] = (g->bpp == 15 ? ((r>>3)<<10)|((gr>>3)<<5)|(b>>3) : ((r>>3)<<11)|((gr>>2)<<5)|(b>>3));
+      }
+      for (int f = 0; f < count; ++f) dest[f] = lut[src[f]];
+      break; }
+    default: {
+      uint32_t lut[256], *dest = (uint32_t *)g->pixels;
+      for (int f = 0; f < 256; ++f) lut[f] = ((uint32_t)g->pal[f*3+0]<<16)|((uint32_t)g->pal[f*3+1]<<8)|g->pal[f*3+2];
+      for (int f = 0; f < count; ++f) dest[f] = lut[src[f]];
+      break; }
+  }
+}
+
+
+/* make frame `idx` */
+static void gen_frame (gen_t *g, int content, int idx) {
+  int w = g->width, h = g->height;
+  switch (content) {
+    case CONTENT_STATIC:
+      break;
+    case CONTENT_SCROLL:
+      if (idx > 0) {
+        memmove(g->index, g->index+w, (size_t)w*(h-1));
+        for (int x = 0; x < w; ++x) g->index[(h-1)*w+x] = gen_pattern(x, h-1+idx);
+      }
+      break;
+    case CONTENT_NOISE:
+      for (int f = 0; f < w*h; ++f) g->index[f] = (uint8_t)rnd();
+      break;
+    case CONTENT_PALETTE:
+      for (int f = 0; f < 256; ++f) memcpy(g->pal+f*3, g->basepal+((f+idx)&255)*3, 3);
+      break;
+    case CONTENT_MOTION:
+      for (int y = 0; y < h; ++y) {
+        uint8_t *dest = g->index+y*w;
+        uint8_t sy = g->sintab[(y*2+idx)&255];
+        for (int x = 0; x < w; ++x) dest[x] = (uint8_t)(g->sintab[(x+idx*3)&255]+sy+g->sintab[(x+y+idx*5)&255]);
+      }
+      break;
+  }
+  gen_convert(g);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/* encoded frames of one run */
+static uint8_t *store = NULL;
+static size_t store_size = 0, store_used = 0;
+static int *store_ofs = NULL, *store_len = NULL;
+static int store_frames = 0;
+
+
+static int store_add (const void *data, int size) {
+  if (store_used+size > store_size) {
+    size_t nsz = (store_size ? store_size*2 : 1024*1024);
+    while (nsz < store_used+size) nsz *= 2;
+    uint8_t *nb = realloc(store, nsz);
+    if (nb == NULL) return -1;
+    store = nb;
+    store_size = nsz;
+  }
+  memcpy(store+store_used, data, size);
+  store_ofs[store_frames] = (int)store_used;
+  store_len[store_frames] = size;
+  store_used += size;
+  ++store_frames;
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+static int frame_matches (const gen_t *g, const void *(*getline)(void *zc, int y), void *zc) {
+  int linesize = g->width*g->pixelsize;
+  for (int y = 0; y < g->height; ++y) {
+    const void *line = getline(zc, y);
+    if (line == NULL || memcmp(line, g->pixels+y*linesize, linesize) != 0) return 0;
+  }
+  return 1;
+}
+
+#ifdef ZMBV_INCLUDE_DECODER
+static const void *zmbv_line (void *zc, int y) { return zmbv_get_decoded_line((zmbv_codec_t)zc, y); }
+#endif
+static const void *zmbvu_line (void *zc, int y) { return zmbvu_get_decoded_line((zmbvu_unpacker_t)zc, y); }
+
+
+/* `*umem` gets the unpacker memory for ZMBVU_STATIC builds, sized for `blockwidth`x`blockheight` */
+/* blocks (0: 16); free it after the unpacker */
+/* returns NULL on error */
+static zmbvu_unpacker_t unpacker_new (int width, int height, int blockwidth, int blockheight, void **umem) {
+  zmbvu_unpacker_t zu;
+  *umem = NULL;
+#ifdef ZMBVU_STATIC
+  {
+    size_t memsize = zmbvu_memory_size(width, height, ZMBVU_FORMAT_NONE, blockwidth, blockheight);
+    if ((*umem = malloc(memsize)) == NULL || (zu = zmbvu_unpacker_init(*umem, memsize)) == NULL) return NULL;
+  }
+#else
+  (void)blockwidth;
+  (void)blockheight;
+  if ((zu = zmbvu_unpacker_new(NULL)) == NULL) return NULL;
+#endif
+  if (zmbvu_decode_setup(zu, width, height) < 0) { zmbvu_unpacker_free(zu); return NULL; }
+  return zu;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int bench_run (bench_result_t *res, int content, int width, int height, int bpp) {
+  gen_t g;
+  zmbv_format_t fmt = zmbv_bpp_to_format(bpp);
+  int bufsize = zmbv_work_buffer_size(width, height, fmt);
+  uint8_t *buf = malloc(bufsize);
+  const void **lines = malloc(sizeof(void *)*height);
+  zmbv_codec_t zc = NULL;
+  zmbvu_unpacker_t zu = NULL;
+  void *umem = NULL; /* ZMBVU_STATIC unpacker memory */
+  int frames = frame_limit, rc = -1;
+  double stime;
+
+  memset(&g, 0, sizeof(g));
+  memset(res, 0, sizeof(*res));
+  res->content = content;
+  res->width = width;
+  res->height = height;
+  res->bpp = bpp;
+  res->dec_secs = res->decu_secs = res->avi_secs = -1;
+  if (frames <= 0) {
+    /* about 64M pixels per run, but not less than 8 or more than 300 frames */
+    frames = (int)(64.0*1024*1024/((double)width*height));
+    if (frames < 8) frames = 8;
+    if (frames > 300) frames = 300;
+  }
+  if (buf == NULL || lines == NULL || gen_init(&g, width, height, bpp) < 0) { fprintf(stderr, "FATAL: out of memory\n"); goto quit; }
+  free(store_ofs);
+  free(store_len);
+  store_ofs = malloc(sizeof(int)*frames);
+  store_len = malloc(sizeof(int)*frames);
+  if (store_ofs == NULL || store_len == NULL) { fprintf(stderr, "FATAL: out of memory\n"); goto quit; }
+  store_used = 0;
+  store_frames = 0;
+  for (int y = 0; y < height; ++y) lines[y] = g.pixels+(size_t)y*width*g.pixelsize;
+
+  /* encode */
+  if ((zc = zmbv_codec_new(ZMBV_INIT_FLAG_NONE, complevel, NULL)) == NULL) goto quit;
+  if (zmbv_encode_setup(zc, width, height) < 0) goto quit;
+  for (int f = 0; f < frames; ++f) {
+    int size;
+    gen_frame(&g, content, f);
+    stime = bench_secs();
+    if (zmbv_encode_prepare_frame(zc, (f%keyint == 0 ? ZMBV_PREP_FLAG_KEYFRAME : ZMBV_PREP_FLAG_NONE), fmt, g.pal, buf, bufsize) < 0) goto quit;
+    if (zmbv_encode_lines(zc, height, lines) < 0) goto quit;
+    if ((size = zmvb_encode_finish_frame(zc)) < 0) goto quit;
+    res->enc_secs += bench_secs()-stime;
+    if (store_add(buf, size) < 0) { fprintf(stderr, "FATAL: out of memory\n"); goto quit; }
+  }
+  {
+    zmbv_encode_stats_t st;
+    if (zmbv_encode_get_stats(zc, &st) == 0) res->enc = st.total;
+  }
+  res->frames = frames;
+  res->raw_bytes = (uint64_t)frames*width*height*g.pixelsize;
+  res->packed_bytes = store_used;
+
+#ifdef ZMBV_INCLUDE_DECODER
+  /* decode with libzmbv */
+  zmbv_codec_free(zc);
+  if ((zc = zmbv_codec_new(ZMBV_INIT_FLAG_NONE, complevel, NULL)) == NULL || zmbv_decode_setup(zc, width, height) < 0) goto quit;
+  stime = bench_secs();
+  for (int f = 0; f < store_frames; ++f) {
+    if (zmbv_decode_frame(zc, store+store_ofs[f], store_len[f]) < 0) { fprintf(stderr, "FATAL: can't decode frame #%d\n", f); goto quit; }
+  }
+  res->dec_secs = bench_secs()-stime;
+  {
+    zmbv_decode_stats_t st;
+    if (zmbv_decode_get_stats(zc, &st) == 0) res->dec = st.total;
+  }
+  res->dec_ok = frame_matches(&g, zmbv_line, zc);
+#endif
+
+  /* decode with libzmbvu */
+  if ((zu = unpacker_new(width, height, 0, 0, &umem)) == NULL) goto quit;
+  stime = bench_secs();
+  for (int f = 0; f < store_frames; ++f) {
+    if (zmbvu_decode_frame(zu, store+store_ofs[f], store_len[f]) < 0) { fprintf(stderr, "FATAL: can't decode frame #%d\n", f); goto quit; }
+  }
+  res->decu_secs = bench_secs()-stime;
+  {
+    zmbvu_decode_stats_t st;
+    if (zmbvu_decode_get_stats(zu, &st) == 0) res->decu = st.total;
+  }
+  res->decu_ok = frame_matches(&g, zmbvu_line, zu);
+
+  /* write AVI */
+  if (avi_name != NULL && avi_name[0]) {
+    zmbv_avi_t zavi;
+    stime = bench_secs();
+    if ((zavi = zmbv_avi_start(avi_name, width, height, 60, 0, NULL)) == NULL) { fprintf(stderr, "FATAL: can't create '%s'\n", avi_name); goto quit; }
+    for (int f = 0; f < store_frames; ++f) {
+      if (zmbv_avi_write_chunk_video(zavi, store+store_ofs[f], store_len[f]) < 0) { zmbv_avi_stop(zavi); goto quit; }
+    }
+    if (zmbv_avi_stop(zavi) != 0) goto quit;
+    res->avi_secs = bench_secs()-stime;
+    unlink(avi_name);
+  }
+  rc = 0;
+quit:
+  zmbvu_unpacker_free(zu);
+  free(umem);
+  zmbv_codec_free(zc);
+  gen_free(&g);
+  free(lines);
+  free(buf);
+  return rc;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+static double mbps (uint64_t bytes, double secs) { return (secs > 0 ? bytes/secs/1e6 : 0); }
+static double fps (int frames, double secs) { return (secs > 0 ? frames/secs : 0); }
+static double msecs (uint64_t ns) { return ns/1e6; }
+
+
+static void print_header (void) {
+  printf("%-8s %-10s %3s %5s %7s | %8s %8s %5s %5s %5s | %8s %8s %3s | %8s %8s %3s | %8s\n",
+    "content", "size", "bpp", "frms", "ratio",
+    "enc fps", "enc MB/s", "copy", "srch", "defl",
+    "dec fps", "dec MB/s", "ok",
+    "decu fps", "decu MB/s", "ok",
+    "avi MB/s");
+}
+
+
+static void print_result (const bench_result_t *r) {
+  char size[32];
+  double ratio = (r->packed_bytes ? (double)r->raw_bytes/r->packed_bytes : 0);
+  double enc_ns = (double)(r->enc.copy_ns+r->enc.search_ns+r->enc.deflate_ns);
+  snprintf(size, sizeof(size), "%dx%d", r->width, r->height);
+  printf("%-8s %-10s %3d %5d %7.2f | %8.1f %8.1f %4.0f%% %4.0f%% %4.0f%% |",
+    content_names[r->content], size, r->bpp, r->frames, ratio,
+    fps(r->frames, r->enc_secs), mbps(r->raw_bytes, r->enc_secs),
+    (enc_ns > 0 ? 100*r->enc.copy_ns/enc_ns : 0), (enc_ns > 0 ? 100*r->enc.search_ns/enc_ns : 0), (enc_ns > 0 ? 100*r->enc.deflate_ns/enc_ns : 0));
+  if (r->dec_secs >= 0) {
+    printf(" %8.1f %8.1f %3s |", fps(r->frames, r->dec_secs), mbps(r->raw_bytes, r->dec_secs), (r->dec_ok ? "yes" : "NO"));
+  } else {
+    printf(" %8s %8s %3s |", "-", "-", "-");
+  }
+  printf(" %8.1f %8.1f %3s |", fps(r->frames, r->decu_secs), mbps(r->raw_bytes, r->decu_secs), (r->decu_ok ? "yes" : "NO"));
+  if (r->avi_secs >= 0) printf(" %8.1f\n", mbps(r->packed_bytes, r->avi_secs)); else printf(" %8s\n", "-");
+}
+
+
+static void json_result (FILE *fo, const bench_result_t *r, int first) {
+  fprintf(fo, "%s  {\"content\": \"%s\", \"width\": %d, \"height\": %d, \"bpp\": %d, \"frames\": %d,\n",
+    (first ? "" : ",\n"), content_names[r->content], r->width, r->height, r->bpp, r->frames);
+  fprintf(fo, "   \"raw_bytes\": %llu, \"packed_bytes\": %llu, \"ratio\": %.4f,\n",
+    (unsigned long long)r->raw_bytes, (unsigned long long)r->packed_bytes, (r->packed_bytes ? (double)r->raw_bytes/r->packed_bytes : 0));
+  fprintf(fo, "   \"encode\": {\"secs\": %.6f, \"fps\": %.3f, \"mbps\": %.3f, \"copy_ms\": %.3f, \"search_ms\": %.3f, \"deflate_ms\": %.3f,"
+    " \"blocks_same\": %llu, \"blocks_moved\": %llu, \"blocks_xor\": %llu, \"compares\": %llu, \"probes\": %llu},\n",
+    r->enc_secs, fps(r->frames, r->enc_secs), mbps(r->raw_bytes, r->enc_secs),
+    msecs(r->enc.copy_ns), msecs(r->enc.search_ns), msecs(r->enc.deflate_ns),
+    (unsigned long long)r->enc.blocks_same, (unsigned long long)r->enc.blocks_moved, (unsigned long long)r->enc.blocks_xor,
+    (unsigned long long)r->enc.compares, (unsigned long long)r->enc.probes);
+#ifdef ZMBV_INCLUDE_DECODER
+  if (r->dec_secs >= 0) {
+    fprintf(fo, "   \"decode\": {\"secs\": %.6f, \"fps\": %.3f, \"mbps\": %.3f, \"inflate_ms\": %.3f, \"rebuild_ms\": %.3f, \"ok\": %s},\n",
+      r->dec_secs, fps(r->frames, r->dec_secs), mbps(r->raw_bytes, r->dec_secs),
+      msecs(r->dec.inflate_ns), msecs(r->dec.rebuild_ns), (r->dec_ok ? "true" : "false"));
+  }
+#endif
+  fprintf(fo, "   \"decode_u\": {\"secs\": %.6f, \"fps\": %.3f, \"mbps\": %.3f, \"inflate_ms\": %.3f, \"rebuild_ms\": %.3f, \"ok\": %s}",
+    r->decu_secs, fps(r->frames, r->decu_secs), mbps(r->raw_bytes, r->decu_secs),
+    msecs(r->decu.inflate_ns), msecs(r->decu.rebuild_ns), (r->decu_ok ? "true" : "false"));
+  if (r->avi_secs >= 0) {
+    fprintf(fo, ",\n   \"avi\": {\"secs\": %.6f, \"mbps\": %.3f}", r->avi_secs, mbps(r->packed_bytes, r->avi_secs));
+  }
+  fprintf(fo, "}");
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/* corpus mode: a recorded capture (AVI or .zmbv) is decoded once, and its frames are */
+/* encoded again and decoded back with libzmbvu for every combination of settings */
+#define CORPUS_BUDGET  ((size_t)1024*1024*1024) /* decoded frames kept in memory */
+
+typedef struct {
+  int width, height, bpp, pixelsize;
+  int frames, maxframes;
+  uint8_t *pixels; /* maxframes*width*height*pixelsize */
+  uint8_t *pals; /* maxframes*768 */
+  uint64_t source_bytes; /* packed frames in the capture */
+} corpus_t;
+
+typedef struct {
+  const char *name;
+  int range, candidates; /* zmbv_encode_set_search() args */
+} search_preset_t;
+
+static const search_preset_t search_presets[] = {
+  {"off", 0, 1},
+  {"fast", 3, 16},
+  {"default", -1, 0},
+  {"full", ZMBV_VECTOR_RANGE, ZMBV_VECTOR_SPAN*ZMBV_VECTOR_SPAN},
+};
+#define SEARCH_PRESET_COUNT  ((int)(sizeof(search_presets)/sizeof(search_presets[0])))
+
+typedef struct {
+  int level, blockwidth, blockheight, search, threads;
+  uint64_t raw_bytes;
+  uint64_t packed_bytes;
+  double enc_secs, dec_secs;
+  int dec_ok; /* every decoded frame matches the corpus */
+  zmbv_encode_counters_t enc;
+  zmbvu_decode_counters_t dec;
+} corpus_result_t;
+
+#ifdef ZMBV_USE_MINIZ
+# define ENCODER_BACKEND  "miniz"
+#else
+# define ENCODER_BACKEND  "zlib"
+#endif
+#if defined(ZMBVU_USE_TINFL) || defined(ZMBVU_STATIC)
+# define DECODER_BACKEND  "tinfl"
+#elif defined(ZMBVU_USE_MINIZ)
+# define DECODER_BACKEND  "miniz"
+#else
+# define DECODER_BACKEND  "zlib"
+#endif
+
+static const char *corpus_name = NULL;
+static bench_size_t corpus_size = {320, 240}; /* .zmbv files don't have it */
+static int levels[10];
+static int level_count = 0;
+static bench_size_t blocks[16];
+static int block_count = 0;
+static int searches[SEARCH_PRESET_COUNT];
+static int search_count = 0;
+static int threads[16];
+static int thread_count = 0;
+
+
+static int format_bpp (int fmt) {
+  switch (fmt) {
+    case ZMBV_FORMAT_8BPP: return 8;
+    case ZMBV_FORMAT_15BPP: return 15;
+    case ZMBV_FORMAT_16BPP: return 16;
+    case ZMBV_FORMAT_32BPP: return 32;
+  }
+  return 0;
+}
+
+
+/* return <0 on error; 0 on ok; 1 if the frame can't be added (format change or no more room) */
+static int corpus_add (corpus_t *cp, int fmt, const uint8_t *pal, const void *(*getline)(void *zc, int y), void *zc) {
+  int bpp = format_bpp(fmt);
+  size_t linesize, framesize;
+  uint8_t *dest;
+  if (bpp == 0) return -1;
+  if (cp->frames == 0) {
+    cp->bpp = bpp;
+    cp->pixelsize = (bpp == 8 ? 1 : bpp == 32 ? 4 : 2);
+    framesize = (size_t)cp->width*cp->height*cp->pixelsize;
+    if ((size_t)cp->maxframes > CORPUS_BUDGET/framesize) cp->maxframes = (int)(CORPUS_BUDGET/framesize);
+    if (cp->maxframes < 1) cp->maxframes = 1;
+    cp->pixels = malloc(framesize*cp->maxframes);
+    cp->pals = malloc((size_t)768*cp->maxframes);
+    if (cp->pixels == NULL || cp->pals == NULL) return -1;
+  }
+  if (bpp != cp->bpp) {
+    fprintf(stderr, "NOTE: format changes at frame #%d; corpus ends there\n", cp->frames);
+    return 1;
+  }
+  if (cp->frames >= cp->maxframes) return 1;
+  linesize = (size_t)cp->width*cp->pixelsize;
+  dest = cp->pixels+linesize*cp->height*cp->frames;
+  for (int y = 0; y < cp->height; ++y) {
+    const void *line = getline(zc, y);
+    if (line == NULL) return -1;
+    memcpy(dest+linesize*y, line, linesize);
+  }
+  if (pal != NULL) memcpy(cp->pals+768*cp->frames, pal, 768); else memset(cp->pals+768*cp->frames, 0, 768);
+  ++cp->frames;
+  return 0;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int corpus_load_avi (corpus_t *cp, const char *fname) {
+  zmbv_avi_reader_t zr;
+  zmbv_avi_info_t info;
+  zmbvu_unpacker_t zu = NULL;
+  void *umem = NULL;
+  int count, blockwidth = 0, blockheight = 0, rc = -1;
+
+  if ((zr = zmbv_avi_reader_open(fname)) == NULL) { fprintf(stderr, "FATAL: can't open '%s'\n", fname); return -1; }
+  if (zmbv_avi_reader_get_info(zr, &info) < 0 || (count = zmbv_avi_reader_chunk_count(zr, ZMBV_AVI_VIDEO)) < 0) goto quit;
+  if (strcmp(info.codec, "ZMBV") != 0) { fprintf(stderr, "FATAL: '%s' is not a ZMBV video\n", fname); goto quit; }
+  cp->width = info.width;
+  cp->height = info.height;
+  if (cp->maxframes <= 0 || cp->maxframes > count) cp->maxframes = count;
+  /* unpacker memory is sized for the block size of the first keyframe */
+  for (int f = 0; f < count; ++f) {
+    zmbv_avi_chunk_t chunk;
+    if (zmbv_avi_reader_get_chunk(zr, ZMBV_AVI_VIDEO, f, &chunk) < 0) goto quit;
+    if (chunk.size >= 7 && (((const uint8_t *)chunk.data)[0]&0x01)) {
+      blockwidth = ((const uint8_t *)chunk.data)[5];
+      blockheight = ((const uint8_t *)chunk.data)[6];
+      break;
+    }
+  }
+  if ((zu = unpacker_new(cp->width, cp->height, blockwidth, blockheight, &umem)) == NULL) goto quit;
+  for (int f = 0; f < count; ++f) {
+    zmbv_avi_chunk_t chunk;
+    int res;
+    if (zmbv_avi_reader_get_chunk(zr, ZMBV_AVI_VIDEO, f, &chunk) < 0) goto quit;
+    if (chunk.size == 0) continue; /* dropped frame */
+    if (zmbvu_decode_frame(zu, chunk.data, (int)chunk.size) < 0) { fprintf(stderr, "FATAL: can't decode frame #%d\n", f); goto quit; }
+    if ((res = corpus_add(cp, zmbvu_get_decoded_format(zu), zmbvu_get_palette(zu), zmbvu_line, zu)) < 0) goto quit;
+    if (res > 0) break;
+    cp->source_bytes += chunk.size;
+  }
+  rc = 0;
+quit:
+  zmbvu_unpacker_free(zu);
+  free(umem);
+  zmbv_avi_reader_close(zr);
+  return rc;
+}
+
+
+#ifdef ZMBV_INCLUDE_DECODER
+/* return <0 on error; 0 on ok */
+static int corpus_load_zmbv (corpus_t *cp, const char *fname) {
+  zmbv_file_t zf;
+  int count, res, rc = -1;
+
+  if ((zf = zmbv_file_open(fname, corpus_size.width, corpus_size.height, ZMBV_FILE_FLAG_NONE)) == NULL) { fprintf(stderr, "FATAL: can't open '%s'\n", fname); return -1; }
+  if ((count = zmbv_file_frame_count(zf)) < 0) goto quit;
+  cp->width = corpus_size.width;
+  cp->height = corpus_size.height;
+  if (cp->maxframes <= 0 || cp->maxframes > count) cp->maxframes = count;
+  while ((res = zmbv_file_next_frame(zf)) == 0) {
+    zmbv_codec_t zc = zmbv_file_get_codec(zf);
+    if ((res = corpus_add(cp, zmbv_get_decoded_format(zc), zmbv_get_palette(zc), zmbv_line, zc)) < 0) goto quit;
+    if (res > 0) break;
+  }
+  if (res < 0) { fprintf(stderr, "FATAL: can't decode frame #%d\n", cp->frames); goto quit; }
+  {
+    /* .zmbv file is the packed frames with a bit of framing */
+    FILE *fl = fopen(fname, "rb");
+    if (fl != NULL) {
+      if (fseek(fl, 0, SEEK_END) == 0 && ftell(fl) > 0) cp->source_bytes = (uint64_t)ftell(fl);
+      fclose(fl);
+    }
+  }
+  rc = 0;
+quit:
+  zmbv_file_close(zf);
+  return rc;
+}
+#endif
+
+
+/* return <0 on error; 0 on ok */
+static int corpus_load (corpus_t *cp, const char *fname) {
+  size_t len = strlen(fname);
+  memset(cp, 0, sizeof(*cp));
+  cp->maxframes = frame_limit;
+  if (len > 5 && strcmp(fname+len-5, ".zmbv") == 0) {
+#ifdef ZMBV_INCLUDE_DECODER
+    if (corpus_load_zmbv(cp, fname) < 0) return -1;
+#else
+    fprintf(stderr, "FATAL: .zmbv files need libzmbv with ZMBV_INCLUDE_DECODER\n");
+    return -1;
+#endif
+  } else {
+    if (corpus_load_avi(cp, fname) < 0) return -1;
+  }
+  if (cp->frames == 0) { fprintf(stderr, "FATAL: no video frames in '%s'\n", fname); return -1; }
+  return 0;
+}
+
+
+static void corpus_free (corpus_t *cp) {
+  free(cp->pixels);
+  free(cp->pals);
+  cp->pixels = cp->pals = NULL;
+}
+
+
+/* return <0 on error; 0 on ok; 1 if the thread count is not supported by this build */
+static int corpus_run (corpus_result_t *res, const corpus_t *cp, int level, const bench_size_t *block, int search, int thrcount) {
+  zmbv_format_t fmt = zmbv_bpp_to_format(cp->bpp);
+  int bufsize = zmbv_work_buffer_size(cp->width, cp->height, fmt);
+  size_t linesize = (size_t)cp->width*cp->pixelsize, framesize = linesize*cp->height;
+  uint8_t *buf = malloc(bufsize);
+  const void **lines = malloc(sizeof(void *)*cp->height);
+  zmbv_codec_t zc = NULL;
+  zmbvu_unpacker_t zu = NULL;
+  void *umem = NULL;
+  int rc = -1;
+  double stime;
+
+  memset(res, 0, sizeof(*res));
+  res->level = level;
+  res->blockwidth = block->width;
+  res->blockheight = block->height;
+  res->search = search;
+  res->threads = thrcount;
+  res->raw_bytes = (uint64_t)cp->frames*framesize;
+  if (buf == NULL || lines == NULL) { fprintf(stderr, "FATAL: out of memory\n"); goto quit; }
+  free(store_ofs);
+  free(store_len);
+  store_ofs = malloc(sizeof(int)*cp->frames);
+  store_len = malloc(sizeof(int)*cp->frames);
+  if (store_ofs == NULL || store_len == NULL) { fprintf(stderr, "FATAL: out of memory\n"); goto quit; }
+  store_used = 0;
+  store_frames = 0;
+
+  /* encode */
+  if ((zc = zmbv_codec_new(ZMBV_INIT_FLAG_NONE, level, NULL)) == NULL) goto quit;
+  if (zmbv_encode_setup(zc, cp->width, cp->height) < 0) goto quit;
+  if (zmbv_encode_set_block_size(zc, block->width, block->height) < 0) { fprintf(stderr, "FATAL: invalid block size %dx%d\n", block->width, block->height); goto quit; }
+  if (zmbv_encode_set_search(zc, search_presets[search].range, search_presets[search].candidates) < 0) goto quit;
+  for (int f = 0; f < cp->frames; ++f) {
+    const uint8_t *src = cp->pixels+framesize*f;
+    int size;
+    for (int y = 0; y < cp->height; ++y) lines[y] = src+linesize*y;
+    stime = bench_secs();
+    if (zmbv_encode_prepare_frame(zc, (f%keyint == 0 ? ZMBV_PREP_FLAG_KEYFRAME : ZMBV_PREP_FLAG_NONE), fmt, (cp->bpp == 8 ? cp->pals+768*f : NULL), buf, bufsize) < 0) goto quit;
+    if (zmbv_encode_lines(zc, cp->height, lines) < 0) goto quit;
+    if ((size = zmvb_encode_finish_frame(zc)) < 0) goto quit;
+    res->enc_secs += bench_secs()-stime;
+    if (store_add(buf, size) < 0) { fprintf(stderr, "FATAL: out of memory\n"); goto quit; }
+  }
+  {
+    zmbv_encode_stats_t st;
+    if (zmbv_encode_get_stats(zc, &st) == 0) res->enc = st.total;
+  }
+  res->packed_bytes = store_used;
+
+  /* decode with libzmbvu, checking every frame outside of the timed part */
+  if ((zu = unpacker_new(cp->width, cp->height, block->width, block->height, &umem)) == NULL) goto quit;
+  if (zmbvu_decode_set_threads(zu, thrcount) < 0) { rc = 1; goto quit; }
+  res->dec_ok = 1;
+  for (int f = 0; f < store_frames; ++f) {
+    const uint8_t *src = cp->pixels+framesize*f;
+    stime = bench_secs();
+    if (zmbvu_decode_frame(zu, store+store_ofs[f], store_len[f]) < 0) { fprintf(stderr, "FATAL: can't decode frame #%d\n", f); goto quit; }
+    res->dec_secs += bench_secs()-stime;
+    for (int y = 0; y < cp->height && res->dec_ok; ++y) {
+      const void *line = zmbvu_get_decoded_line(zu, y);
+      if (line == NULL || memcmp(line, src+linesize*y, linesize) != 0) res->dec_ok = 0;
+    }
+  }
+  {
+    zmbvu_decode_stats_t st;
+    if (zmbvu_decode_get_stats(zu, &st) == 0) res->dec = st.total;
+  }
+  rc = 0;
+quit:
+  zmbvu_unpacker_free(zu);
+  free(umem);
+  zmbv_codec_free(zc);
+  free(lines);
+  free(buf);
+  return rc;
+}
+
+
+static void corpus_print_header (const corpus_t *cp) {
+  printf("corpus: %s, %dx%d %dbpp, %d frames, %llu packed bytes; encoder: %s, decoder: %s\n",
+    corpus_name, cp->width, cp->height, cp->bpp, cp->frames, (unsigned long long)cp->source_bytes,
+    ENCODER_BACKEND, DECODER_BACKEND);
+  printf("%5s %-7s %-7s %3s | %8s %8s %5s %5s | %11s %7s | %8s %8s %3s\n",
+    "level", "block", "search", "thr",
+    "enc fps", "enc MB/s", "srch", "defl",
+    "packed", "ratio",
+    "dec fps", "dec MB/s", "ok");
+}
+
+
+static void corpus_print_result (const corpus_result_t *r, int frames) {
+  char block[32];
+  double enc_ns = (double)(r->enc.copy_ns+r->enc.search_ns+r->enc.deflate_ns);
+  snprintf(block, sizeof(block), "%dx%d", r->blockwidth, r->blockheight);
+  printf("%5d %-7s %-7s %3d | %8.1f %8.1f %4.0f%% %4.0f%% | %11llu %7.2f | %8.1f %8.1f %3s\n",
+    r->level, block, search_presets[r->search].name, r->threads,
+    fps(frames, r->enc_secs), mbps(r->raw_bytes, r->enc_secs),
+    (enc_ns > 0 ? 100*r->enc.search_ns/enc_ns : 0), (enc_ns > 0 ? 100*r->enc.deflate_ns/enc_ns : 0),
+    (unsigned long long)r->packed_bytes, (r->packed_bytes ? (double)r->raw_bytes/r->packed_bytes : 0),
+    fps(frames, r->dec_secs), mbps(r->raw_bytes, r->dec_secs), (r->dec_ok ? "yes" : "NO"));
+}
+
+
+static void json_string (FILE *fo, const char *s) {
+  fputc('"', fo);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') fprintf(fo, "\\%c", *s);
+    else if ((unsigned char)*s < 32) fprintf(fo, "\\u%04x", (unsigned char)*s);
+    else fputc(*s, fo);
+  }
+  fputc('"', fo);
+}
+
+
+static void corpus_json_result (FILE *fo, const corpus_result_t *r, int frames, int first) {
+  fprintf(fo, "%s  {\"level\": %d, \"block_width\": %d, \"block_height\": %d, \"search\": \"%s\", \"threads\": %d,\n",
+    (first ? "" : ",\n"), r->level, r->blockwidth, r->blockheight, search_presets[r->search].name, r->threads);
+  fprintf(fo, "   \"raw_bytes\": %llu, \"packed_bytes\": %llu, \"ratio\": %.4f,\n",
+    (unsigned long long)r->raw_bytes, (unsigned long long)r->packed_bytes, (r->packed_bytes ? (double)r->raw_bytes/r->packed_bytes : 0));
+  fprintf(fo, "   \"encode\": {\"secs\": %.6f, \"fps\": %.3f, \"mbps\": %.3f, \"copy_ms\": %.3f, \"search_ms\": %.3f, \"deflate_ms\": %.3f,"
+    " \"blocks_same\": %llu, \"blocks_moved\": %llu, \"blocks_xor\": %llu, \"compares\": %llu, \"probes\": %llu},\n",
+    r->enc_secs, fps(frames, r->enc_secs), mbps(r->raw_bytes, r->enc_secs),
+    msecs(r->enc.copy_ns), msecs(r->enc.search_ns), msecs(r->enc.deflate_ns),
+    (unsigned long long)r->enc.blocks_same, (unsigned long long)r->enc.blocks_moved, (unsigned long long)r->enc.blocks_xor,
+    (unsigned long long)r->enc.compares, (unsigned long long)r->enc.probes);
+  fprintf(fo, "   \"decode\": {\"secs\": %.6f, \"fps\": %.3f, \"mbps\": %.3f, \"inflate_ms\": %.3f, \"rebuild_ms\": %.3f, \"ok\": %s}}",
+    r->dec_secs, fps(frames, r->dec_secs), mbps(r->raw_bytes, r->dec_secs),
+    msecs(r->dec.inflate_ns), msecs(r->dec.rebuild_ns), (r->dec_ok ? "true" : "false"));
+}
+
+
+/* return number of failed runs, or <0 on error */
+static int corpus_bench (FILE *fo) {
+  corpus_t cp;
+  int runs = 0, failed = 0;
+
+  if (corpus_load(&cp, corpus_name) < 0) { corpus_free(&cp); return -1; }
+  if (fo != NULL) {
+    fprintf(fo, "{\"corpus\": ");
+    json_string(fo, corpus_name);
+    fprintf(fo, ", \"width\": %d, \"height\": %d, \"bpp\": %d, \"frames\": %d, \"source_bytes\": %llu,\n",
+      cp.width, cp.height, cp.bpp, cp.frames, (unsigned long long)cp.source_bytes);
+    fprintf(fo, " \"keyint\": %d, \"encoder_backend\": \"%s\", \"decoder_backend\": \"%s\", \"results\": [\n",
+      keyint, ENCODER_BACKEND, DECODER_BACKEND);
+  }
+  if (!quiet) corpus_print_header(&cp);
+  for (int t = 0; t < thread_count; ++t) {
+    for (int l = 0; l < level_count; ++l) {
+      for (int b = 0; b < block_count; ++b) {
+        for (int s = 0; s < search_count; ++s) {
+          corpus_result_t res;
+          int rc = corpus_run(&res, &cp, levels[l], &blocks[b], searches[s], threads[t]);
+          if (rc > 0) {
+            fprintf(stderr, "NOTE: %d decoding threads need libzmbvu built with ZMBVU_USE_THREADS; skipped\n", threads[t]);
+            goto next_thread;
+          }
+          if (rc < 0) {
+            fprintf(stderr, "FATAL: level %d, block %dx%d, search %s, %d threads failed\n",
+              levels[l], blocks[b].width, blocks[b].height, search_presets[searches[s]].name, threads[t]);
+            ++failed;
+            continue;
+          }
+          if (!quiet) { corpus_print_result(&res, cp.frames); fflush(stdout); }
+          if (fo != NULL) corpus_json_result(fo, &res, cp.frames, runs == 0);
+          if (!res.dec_ok) ++failed;
+          ++runs;
+        }
+      }
+    }
+  next_thread: ;
+  }
+  if (fo != NULL) fprintf(fo, "\n]}\n");
+  corpus_free(&cp);
+  return failed;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+/* --trace: libzmbv and libzmbvu trace points on one timeline */
+#define TRACE_EVENTS  (1024*1024)
+
+#if defined(ZMBV_USE_TRACE) && defined(ZMBVU_USE_TRACE)
+static void trace_zmbvu (zmbvu_trace_phase_t phase, int frame, uint64_t start_ns, uint64_t end_ns, void *udata) {
+  (void)udata;
+  switch (phase) {
+    case ZMBVU_TRACE_INFLATE: zmbv_trace_add(ZMBV_TRACE_INFLATE, frame, start_ns, end_ns); break;
+    case ZMBVU_TRACE_REBUILD: zmbv_trace_add(ZMBV_TRACE_REBUILD, frame, start_ns, end_ns); break;
+    case ZMBVU_TRACE_BAND: zmbv_trace_add(ZMBV_TRACE_BAND, frame, start_ns, end_ns); break;
+  }
+}
+#endif
+
+
+/* return <0 on error; 0 on ok */
+static int trace_begin (void) {
+  if (trace_name == NULL) return 0;
+#ifdef ZMBV_USE_TRACE
+  if (zmbv_trace_start(TRACE_EVENTS) < 0) { fprintf(stderr, "FATAL: out of memory\n"); return -1; }
+# ifdef ZMBVU_USE_TRACE
+  zmbvu_set_trace_callback(trace_zmbvu, NULL);
+# else
+  fprintf(stderr, "NOTE: libzmbvu is built without ZMBVU_USE_TRACE; its decoding is not traced\n");
+# endif
+  return 0;
+#else
+  fprintf(stderr, "FATAL: --trace needs libzmbv built with ZMBV_USE_TRACE\n");
+  return -1;
+#endif
+}
+
+
+/* return <0 on error; 0 on ok */
+static int trace_finish (void) {
+  int rc = 0;
+  if (trace_name == NULL) return 0;
+#ifdef ZMBV_USE_TRACE
+# ifdef ZMBVU_USE_TRACE
+  zmbvu_set_trace_callback(NULL, NULL);
+# endif
+  zmbv_trace_stop();
+  if (zmbv_trace_write_chrome(trace_name) < 0) { fprintf(stderr, "FATAL: can't write '%s'\n", trace_name); rc = -1; }
+  zmbv_trace_free();
+#endif
+  return rc;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+static void usage (FILE *fo) {
+  fprintf(fo,
+    "usage: bench [options]\n"
+    "  --sizes WxH,...      frame sizes (default: 320x200,640x480,1280x720,1920x1080,3840x2160)\n"
+    "  --bpp N,...          8, 15, 16 or 32 (default: all)\n"
+    "  --content NAME,...   static, scroll, noise, palette, motion (default: all)\n"
+    "  --frames N           frames per run (default: about 64M pixels, 8..300 frames)\n"
+    "  --level N            compression level (default: library default)\n"
+    "  --keyint N           keyframe interval (default: 300)\n"
+    "  --avi FILE           scratch AVI for the writer test; \"\" to skip (default: bench.avi)\n"
+    "  --json FILE          write results as JSON; \"-\" for stdout\n"
+    "  --trace FILE         write trace points as Chrome trace JSON (needs ZMBV_USE_TRACE;\n"
+    "                       ZMBVU_USE_TRACE adds libzmbvu decoding); keeps the last 1M events\n"
+    "  --quiet              no table\n"
+    "corpus mode:\n"
+    "  --corpus FILE        re-encode the frames of a ZMBV AVI or .zmbv file (up to --frames,\n"
+    "                       or 1GB of decoded frames) with every combination of the settings below\n"
+    "  --size WxH           frame size of a .zmbv file (default: 320x240)\n"
+    "  --levels N,...       compression levels (default: 1,4,9)\n"
+    "  --blocks WxH,...     block sizes, 8..255 each way (default: 16x16)\n"
+    "  --search NAME,...    off, fast, default, full (default: default)\n"
+    "  --threads N,...      libzmbvu decoding threads (default: 1)\n");
+}
+
+
+/* return <0 on error; 0 on ok */
+static int parse_list (const char *s, int (*item)(const char *s, int len)) {
+  while (*s) {
+    const char *e = strchr(s, ',');
+    int len = (e != NULL ? (int)(e-s) : (int)strlen(s));
+    if (len > 0 && item(s, len) < 0) return -1;
+    s += len;
+    if (*s == ',') ++s;
+  }
+  return 0;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int parse_wxh (const char *s, int len, bench_size_t *sz) {
+  char tmp[32];
+  if (len >= (int)sizeof(tmp)) return -1;
+  memcpy(tmp, s, len);
+  tmp[len] = 0;
+  if (sscanf(tmp, "%dx%d", &sz->width, &sz->height) != 2 || sz->width < 1 || sz->height < 1 || sz->width > 16384 || sz->height > 16384) return -1;
+  return 0;
+}
+
+
+static int parse_size (const char *s, int len) {
+  if (size_count >= (int)(sizeof(sizes)/sizeof(sizes[0]))) return -1;
+  if (parse_wxh(s, len, &sizes[size_count]) < 0) return -1;
+  ++size_count;
+  return 0;
+}
+
+
+static int parse_bpp (const char *s, int len) {
+  int bpp = atoi(s);
+  (void)len;
+  if (zmbv_bpp_to_format(bpp) == ZMBV_FORMAT_NONE || bpp_count >= (int)(sizeof(bpps)/sizeof(bpps[0]))) return -1;
+  bpps[bpp_count++] = bpp;
+  return 0;
+}
+
+
+static int parse_content (const char *s, int len) {
+  for (int f = 0; f < CONTENT_MAX; ++f) {
+    if ((int)strlen(content_names[f]) == len && memcmp(content_names[f], s, len) == 0) {
+      if (content_count < CONTENT_MAX) contents[content_count++] = f;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+static int parse_level (const char *s, int len) {
+  int level = atoi(s);
+  (void)len;
+  if (level < 0 || level > 9 || level_count >= (int)(sizeof(levels)/sizeof(levels[0]))) return -1;
+  levels[level_count++] = level;
+  return 0;
+}
+
+
+static int parse_block (const char *s, int len) {
+  if (block_count >= (int)(sizeof(blocks)/sizeof(blocks[0]))) return -1;
+  if (parse_wxh(s, len, &blocks[block_count]) < 0) return -1;
+  if (blocks[block_count].width < 8 || blocks[block_count].height < 8 || blocks[block_count].width > 255 || blocks[block_count].height > 255) return -1;
+  ++block_count;
+  return 0;
+}
+
+
+static int parse_search (const char *s, int len) {
+  for (int f = 0; f < SEARCH_PRESET_COUNT; ++f) {
+    if ((int)strlen(search_presets[f].name) == len && memcmp(search_presets[f].name, s, len) == 0) {
+      if (search_count < SEARCH_PRESET_COUNT) searches[search_count++] = f;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+static int parse_threads (const char *s, int len) {
+  int count = atoi(s);
+  (void)len;
+  if (count < 1 || count > 64 || thread_count >= (int)(sizeof(threads)/sizeof(threads[0]))) return -1;
+  threads[thread_count++] = count;
+  return 0;
+}
+
+
+int main (int argc, char *argv[]) {
+  FILE *fo = NULL;
+  int runs = 0, failed = 0;
+
+  for (int f = 1; f < argc; ++f) {
+    const char *arg = argv[f];
+    const char *val = (f+1 < argc ? argv[f+1] : NULL);
+    if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) { usage(stdout); return 0; }
+    if (strcmp(arg, "--quiet") == 0) { quiet = 1; continue; }
+    if (val == NULL) { usage(stderr); return 1; }
+    ++f;
+    if (strcmp(arg, "--sizes") == 0) { if (parse_list(val, parse_size) < 0) { fprintf(stderr, "invalid size list: %s\n", val); return 1; } }
+    else if (strcmp(arg, "--bpp") == 0) { if (parse_list(val, parse_bpp) < 0) { fprintf(stderr, "invalid bpp list: %s\n", val); return 1; } }
+    else if (strcmp(arg, "--content") == 0) { if (parse_list(val, parse_content) < 0) { fprintf(stderr, "invalid content list: %s\n", val); return 1; } }
+    else if (strcmp(arg, "--frames") == 0) frame_limit = atoi(val);
+    else if (strcmp(arg, "--level") == 0) complevel = atoi(val);
+    else if (strcmp(arg, "--keyint") == 0) keyint = (atoi(val) > 0 ? atoi(val) : 1);
+    else if (strcmp(arg, "--avi") == 0) avi_name = val;
+    else if (strcmp(arg, "--json") == 0) json_name = val;
+    else if (strcmp(arg, "--trace") == 0) trace_name = val;
+    else if (strcmp(arg, "--corpus") == 0) corpus_name = val;
+    else if (strcmp(arg, "--size") == 0) { if (parse_wxh(val, (int)strlen(val), &corpus_size) < 0) { fprintf(stderr, "invalid size: %s\n", val); return 1; } }
+    else if (strcmp(arg, "--levels") == 0) { if (parse_list(val, parse_level) < 0) { fprintf(stderr, "invalid level list: %s\n", val); return 1; } }
+    else if (strcmp(arg, "--blocks") == 0) { if (parse_list(val, parse_block) < 0) { fprintf(stderr, "invalid block size list: %s\n", val); return 1; } }
+    else if (strcmp(arg, "--search") == 0) { if (parse_list(val, parse_search) < 0) { fprintf(stderr, "invalid search list: %s\n", val); return 1; } }
+    else if (strcmp(arg, "--threads") == 0) { if (parse_list(val, parse_threads) < 0) { fprintf(stderr, "invalid thread list: %s\n", val); return 1; } }
+    else { usage(stderr); return 1; }
+  }
+
+  if (trace_begin() < 0) return 1;
+  if (corpus_name != NULL) {
+    if (level_count == 0) {
+      levels[level_count++] = 1;
+      levels[level_count++] = 4;
+      levels[level_count++] = 9;
+    }
+    if (block_count == 0) {
+      blocks[0].width = blocks[0].height = 16;
+      block_count = 1;
+    }
+    if (search_count == 0) parse_search("default", 7);
+    if (thread_count == 0) threads[thread_count++] = 1;
+    if (json_name != NULL) {
+      fo = (strcmp(json_name, "-") == 0 ? stdout : fopen(json_name, "w"));
+      if (fo == NULL) { fprintf(stderr, "FATAL: can't create '%s'\n", json_name); return 1; }
+      if (fo == stdout) quiet = 1;
+    }
+    failed = corpus_bench(fo);
+    if (fo != NULL && fo != stdout) fclose(fo);
+    if (trace_finish() < 0 && failed == 0) failed = 1;
+    free(store);
+    free(store_ofs);
+    free(store_len);
+    return (failed ? 1 : 0);
+  }
+
+  if (size_count == 0) {
+    for (size_t f = 0; f < sizeof(default_sizes)/sizeof(default_sizes[0]); ++f) sizes[size_count++] = default_sizes[f];
+  }
+  if (bpp_count == 0) {
+    for (size_t f = 0; f < sizeof(default_bpps)/sizeof(default_bpps[0]); ++f) bpps[bpp_count++] = default_bpps[f];
+  }
+  if (content_count == 0) {
+    for (int f = 0; f < CONTENT_MAX; ++f) contents[content_count++] = f;
+  }
+
+  if (json_name != NULL) {
+    fo = (strcmp(json_name, "-") == 0 ? stdout : fopen(json_name, "w"));
+    if (fo == NULL) { fprintf(stderr, "FATAL: can't create '%s'\n", json_name); return 1; }
+    if (fo == stdout) quiet = 1;
+    fprintf(fo, "{\"level\": %d, \"keyint\": %d, \"results\": [\n", complevel, keyint);
+  }
+  if (!quiet) print_header();
+  for (int c = 0; c < content_count; ++c) {
+    for (int s = 0; s < size_count; ++s) {
+      for (int b = 0; b < bpp_count; ++b) {
+        bench_result_t res;
+        if (bench_run(&res, contents[c], sizes[s].width, sizes[s].height, bpps[b]) < 0) {
+          fprintf(stderr, "FATAL: %s %dx%d %dbpp failed\n", content_names[contents[c]], sizes[s].width, sizes[s].height, bpps[b]);
+          ++failed;
+          continue;
+        }
+        if (!quiet) { print_result(&res); fflush(stdout); }
+        if (fo != NULL) json_result(fo, &res, runs == 0);
+        if ((res.dec_secs >= 0 && !res.dec_ok) || !res.decu_ok) ++failed;
+        ++runs;
+      }
+    }
+  }
+  if (fo != NULL) {
+    fprintf(fo, "\n]}\n");
+    if (fo != stdout) fclose(fo);
+  }
+  if (trace_finish() < 0) ++failed;
+  free(store);
+  free(store_ofs);
+  free(store_len);
+  return (failed ? 1 : 0);
+}
@@ -12,6 +12,12 @@
 // Define MINIZ_NO_ZLIB_APIS to remove all ZLIB-style compression/decompression API's.
 //#define MINIZ_NO_ZLIB_APIS
 
+// Define MINIZ_NO_DEFLATE_APIS to remove the low-level compression API's (needs MINIZ_NO_ZLIB_APIS).
+//#define MINIZ_NO_DEFLATE_APIS
+
+// Define MINIZ_NO_ZLIB_INFLATE_APIS to remove only the ZLIB-style decompression API's (tinfl stays).
+//#define MINIZ_NO_ZLIB_INFLATE_APIS
+
 // Define MINIZ_NO_MALLOC to disable all calls to malloc, free, and realloc.
 // Note if MINIZ_NO_MALLOC is defined then the user must always provide custom user alloc/free/realloc
 // callbacks to the zlib
@@ -47,8 +53,10 @@ extern "C" {
 typedef unsigned long mz_ulong;
 
 #define MZ_ADLER32_INIT (1)
+#ifndef MINIZ_NO_DEFLATE_APIS
 // mz_adler32() returns the initial adler-32 value to use when called with ptr==NULL.
 static mz_ulong mz_adler32(mz_ulong adler, const unsigned char *ptr, size_t buf_len);
+#endif
 
 // Compression strategies.
 enum { MZ_DEFAULT_STRATEGY = 0, MZ_FILTERED = 1, MZ_HUFFMAN_ONLY = 2, MZ_RLE = 3, MZ_FIXED = 4 };
@@ -151,6 +159,7 @@ static int mz_deflate(mz_streamp pStream, int flush);
 //  MZ_STREAM_ERROR if the stream is bogus.
 static int mz_deflateEnd(mz_streamp pStream);
 
+#ifndef MINIZ_NO_ZLIB_INFLATE_APIS
 // Initializes a decompressor.
 static int mz_inflateInit(mz_streamp pStream);
 
@@ -176,6 +185,7 @@ static int mz_inflate(mz_streamp pStream, int flush);
 
 // Deinitializes a decompressor.
 static int mz_inflateEnd(mz_streamp pStream);
+#endif // MINIZ_NO_ZLIB_INFLATE_APIS
 
 #endif // MINIZ_NO_ZLIB_APIS
 
@@ -274,6 +284,8 @@ struct tinfl_decompressor_tag
   mz_uint8 m_raw_header[4], m_len_codes[TINFL_MAX_HUFF_SYMBOLS_0 + TINFL_MAX_HUFF_SYMBOLS_1 + 137];
 };
 
+#ifndef MINIZ_NO_DEFLATE_APIS
+
 // ------------------- Low-level Compression API Definitions
 
 // Set TDEFL_LESS_MEMORY to 1 to use less memory (compression will be slightly slower, and raw/dynamic blocks will be output more frequently).
@@ -386,6 +398,8 @@ static mz_uint32 tdefl_get_adler32(tdefl_compressor *d);
 static mz_uint tdefl_create_comp_flags_from_zip_params(int level, int window_bits, int strategy);
 #endif // #ifndef MINIZ_NO_ZLIB_APIS
 
+#endif // MINIZ_NO_DEFLATE_APIS
+
 #ifdef __cplusplus
 }
 #endif
@@ -441,6 +455,7 @@ typedef unsigned char mz_validate_uint64[sizeof(mz_uint64)==8 ? 1 : -1];
 
 // ------------------- zlib-style API's
 
+#ifndef MINIZ_NO_DEFLATE_APIS
 static mz_ulong mz_adler32(mz_ulong adler, const unsigned char *ptr, size_t buf_len)
 {
   mz_uint32 i, s1 = (mz_uint32)(adler & 0xffff), s2 = (mz_uint32)(adler >> 16); size_t block_len = buf_len % 5552;
@@ -455,6 +470,7 @@ static mz_ulong mz_adler32(mz_ulong adler, const unsigned char *ptr, size_t buf_
   }
   return (s2 << 16) + s1;
 }
+#endif // MINIZ_NO_DEFLATE_APIS
 
 #ifndef MINIZ_NO_ZLIB_APIS
 
@@ -566,6 +582,7 @@ static int mz_deflateEnd(mz_streamp pStream)
   return MZ_OK;
 }
 
+#ifndef MINIZ_NO_ZLIB_INFLATE_APIS
 typedef struct
 {
   tinfl_decompressor m_decomp;
@@ -712,6 +729,7 @@ static int mz_inflateEnd(mz_streamp pStream)
   }
   return MZ_OK;
 }
+#endif // MINIZ_NO_ZLIB_INFLATE_APIS
 
 #endif //MINIZ_NO_ZLIB_APIS
 
@@ -1060,6 +1078,8 @@ common_exit:
   return status;
 }
 
+#ifndef MINIZ_NO_DEFLATE_APIS
+
 // ------------------- Low-level Compression (independent from all decompression API's)
 
 // Purposely making these tables static for faster init and thread safety.
@@ -2060,6 +2080,8 @@ static mz_uint tdefl_create_comp_flags_from_zip_params(int level, int window_bit
 }
 #endif //MINIZ_NO_ZLIB_APIS
 
+#endif // MINIZ_NO_DEFLATE_APIS
+
 
 #ifdef __cplusplus
 }
@@ -17,11 +17,32 @@
  * C translation by Ketmar // Invisible Vector
  */
 #include "zmbv.h"
+#include "zmbv_trace.h"
 
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+#ifdef __linux__
+# include <sys/mman.h>
+#endif
+
+#ifdef ZMBV_USE_THREADS
+# include <pthread.h>
+#endif
+
+#if defined(ZMBV_USE_TINFL) && !defined(ZMBV_USE_MINIZ)
+/* only the low-level inflater is needed from miniz */
+# define MINIZ_NO_ZLIB_APIS
+# define MINIZ_NO_DEFLATE_APIS
+# include "miniz.c"
+#endif
 
 #ifndef ZMBV_USE_MINIZ
 # include <zlib.h>
@@ -31,10 +52,12 @@
 # define mz_inflateEnd    inflateEnd
 # define mz_deflateReset  deflateReset
 # define mz_inflateReset  inflateReset
+# define mz_inflateCopy   inflateCopy
 # define mz_deflate       deflate
 # define mz_inflate       inflate
 # define mz_stream        z_stream
 # define MZ_OK            Z_OK
+# define MZ_BUF_ERROR     Z_BUF_ERROR
 # define MZ_SYNC_FLUSH    Z_SYNC_FLUSH
 #else
 # ifdef MINIZ_NO_MALLOC
@@ -43,6 +66,10 @@
 # ifdef MINIZ_NO_ZLIB_APIS
 #  undef MINIZ_NO_ZLIB_APIS
 # endif
+# ifdef ZMBV_USE_TINFL
+/* tinfl decodes, only the encoder needs the zlib-style API */
+#  define MINIZ_NO_ZLIB_INFLATE_APIS
+# endif
 # include "miniz.c"
 # define mz_inflateReset(_strm)  ({ int res = mz_inflateEnd(_strm); if (res == MZ_OK) res = mz_inflateInit(_strm); res; })
 #endif
@@ -67,11 +94,38 @@
 
 #define MAX_VECTOR  (16)
 
+/* frame rows and the first pixel of the active area are aligned to this */
+#define FRAME_ALIGN  (64)
+/* frame buffers this big are mapped separately and asked for huge pages (Linux) */
+#define FRAME_HUGE_PAGE  (2*1024*1024)
+
+#ifdef ZMBV_USE_TINFL
+/* tinfl inflates the whole frame in one call right after the last 32KB of the */
+/* previous frames, so decoder work buffer has room for this history in front */
+# define WORK_HISTORY  (TINFL_LZ_DICT_SIZE)
+#else
+# define WORK_HISTORY  (0)
+#endif
+
+/* max number of band threads for interframe reconstruction */
+#define ZMBV_MAX_THREADS  (64)
+/* don't bother spawning a thread for less blocks than this */
+#define ZMBV_MIN_BAND_BLOCKS  (256)
+
 enum {
   FRAME_MASK_KEYFRAME = 0x01,
   FRAME_MASK_DELTA_PALETTE = 0x02
 };
 
+/* what pipelined decoder expects next */
+enum {
+  ZMBV_PIPE_PALETTE,
+  ZMBV_PIPE_ROWS,
+  ZMBV_PIPE_VECTORS,
+  ZMBV_PIPE_BLOCKS,
+  ZMBV_PIPE_DONE
+};
+
 
 /******************************************************************************/
 zmbv_format_t zmbv_bpp_to_format (int bpp) {
@@ -154,12 +208,30 @@ struct zmbv_codec_s {
 
   zmbv_codec_vector_t vector_table[512];
   int vector_count;
+  /* encoder settings: block size for the next keyframe; vectors to try and how many of */
+  /* them get a full compare for each block */
+  int enc_blockwidth, enc_blockheight;
+  int search_vectors, search_candidates;
 
   uint8_t *oldframe, *newframe;
   uint8_t *buf1, *buf2, *work;
   int bufsize;
+  int buflead; /* buf1 is this far into the arena */
+  size_t bufslot; /* buf2 is this far after buf1 */
+  /* frame buffers, block table, vectors and work buffer are carved from one arena, */
+  /* which only grows, so format and resolution changes don't reallocate */
+  uint8_t *arena; /* FRAME_ALIGN aligned */
+  size_t arenasize;
+  void *arenamem; /* what was allocated: a mapping of arenasize bytes; or malloc()ed with alignment slack */
+  int arenamapped;
+  size_t arenadirty; /* bytes at the start of the arena that were written since it was allocated */
+  int laywidth, layheight, laypixelsize; /* frame layout the arena is carved for now; 0: none */
+  int worksize;
+  int workroom; /* bytes in front of work buffer */
 
   int blockcount;
+  int blockwidth, blockheight;
+  int xblocks, yblocks;
   zmbv_frame_block_t *blocks;
 
   int workUsed, workPos;
@@ -172,7 +244,30 @@ struct zmbv_codec_s {
   zmbv_format_t format;
   int pixelsize;
 
+  int threads; /* decoder band threads; <2: rebuild frames in the caller thread */
+
+  /* pipelined decoding: inflate pipe_chunk bytes at a time and rebuild what is complete */
+  int pipe_chunk; /* 0: inflate the whole frame first */
+  int pipe_state, pipe_pos, pipe_ofs;
+  int8_t *vectors; /* block info of the current frame */
+
+  zmbv_allocator_t alloc; /* all NULL: stdlib */
+
+  zmbv_encode_counters_t ecur; /* frame being encoded */
+  zmbv_encode_stats_t estats;
+#ifdef ZMBV_INCLUDE_DECODER
+  zmbv_decode_counters_t dcur; /* frame being decoded */
+  zmbv_decode_stats_t dstats;
+  zmbv_decode_stats_cb stats_cb;
+  void *stats_udata;
+#endif
+
   mz_stream zstream;
+#ifdef ZMBV_USE_TINFL
+  tinfl_decompressor tinfl;
+  int tinfl_flags;
+  int histlen; /* bytes of inflate history right before work buffer */
+#endif
   int zstream_inited; // <0: deflate; >0: inflate; 0: not inited
 };
 
@@ -231,22 +326,28 @@ static inline void zmbv_add_xor_block_##_pxsize (zmbv_codec_t zc, int vx, int vy
 
 #define ZMBV_ADD_XOR_FRAME_TPL(_pxtype,_pxsize) \
 static inline void zmbv_add_xor_frame_##_pxsize (zmbv_codec_t zc) { \
+  zmbv_encode_counters_t *st = &zc->ecur; \
   int8_t *vectors = (int8_t *)&zc->work[zc->workUsed]; \
+  int xorstart; \
   /* align the following xor data on 4 byte boundary */ \
   zc->workUsed = (zc->workUsed+zc->blockcount*2+3)&~3; \
+  xorstart = zc->workUsed; \
   for (int b = 0; b < zc->blockcount; ++b) { \
     zmbv_frame_block_t *block = &zc->blocks[b]; \
     int bestvx = 0; \
     int bestvy = 0; \
     int bestchange = zmbv_compare_block_##_pxsize(zc, 0, 0, block); \
-    int possibles = 64; \
-    for (int v = 0; v < zc->vector_count && possibles; ++v) { \
+    int possibles = zc->search_candidates; \
+    ++st->compares; \
+    for (int v = 0; v < zc->search_vectors && possibles; ++v) { \
       if (bestchange < 4) break; \
       int vx = zc->vector_table[v].x; \
       int vy = zc->vector_table[v].y; \
+      ++st->probes; \
       if (zmbv_possible_block_##_pxsize(zc, vx, vy, block) < 4) { \
         --possibles; \
         if (possibles < 0) abort(); \
+        ++st->compares; \
         int testchange = zmbv_compare_block_##_pxsize(zc, vx, vy, block); \
         if (testchange < bestchange) { \
           bestchange = testchange; \
@@ -257,11 +358,18 @@ static inline void zmbv_add_xor_frame_##_pxsize (zmbv_codec_t zc) { \
     } \
     vectors[b*2+0] = (bestvx << 1); \
     vectors[b*2+1] = (bestvy << 1); \
+    ++st->vectors[(bestvy+ZMBV_VECTOR_RANGE)*ZMBV_VECTOR_SPAN+bestvx+ZMBV_VECTOR_RANGE]; \
     if (bestchange) { \
       vectors[b*2+0] |= 1; \
       zmbv_add_xor_block_##_pxsize(zc, bestvx, bestvy, block); \
+      ++st->blocks_xor; \
+    } else if (bestvx|bestvy) { \
+      ++st->blocks_moved; \
+    } else { \
+      ++st->blocks_same; \
     } \
   } \
+  st->xor_bytes += zc->workUsed-xorstart; \
 }
 
 /* generate functions */
@@ -286,13 +394,13 @@ ZMBV_ADD_XOR_FRAME_TPL(uint32_t,32)
 #ifdef ZMBV_INCLUDE_DECODER
 
 #define ZMBV_UNXOR_BLOCK_TPL(_pxtype,_pxsize) \
-static inline void zmbv_unxor_block_##_pxsize (zmbv_codec_t zc, int vx, int vy, zmbv_frame_block_t *block) { \
+static inline void zmbv_unxor_block_##_pxsize (zmbv_codec_t zc, int vx, int vy, const zmbv_frame_block_t *block, const uint8_t *xordata) { \
   _pxtype *pold = ((_pxtype *)zc->oldframe)+block->start+(vy*zc->pitch)+vx; \
   _pxtype *pnew = ((_pxtype *)zc->newframe)+block->start; \
   for (int y = 0; y < block->dy; ++y) { \
     for (int x = 0; x < block->dx; ++x) { \
-      pnew[x] = pold[x]^*((_pxtype *)&zc->work[zc->workPos]); \
-      zc->workPos += sizeof(_pxtype); \
+      pnew[x] = pold[x]^*((const _pxtype *)xordata); \
+      xordata += sizeof(_pxtype); \
     } \
     pold += zc->pitch; \
     pnew += zc->pitch; \
@@ -301,7 +409,7 @@ static inline void zmbv_unxor_block_##_pxsize (zmbv_codec_t zc, int vx, int vy,
 
 
 #define ZMBV_COPY_BLOCK_TPL(_pxtype,_pxsize) \
-static inline void zmbv_copy_block_##_pxsize (zmbv_codec_t zc, int vx, int vy, zmbv_frame_block_t *block) { \
+static inline void zmbv_copy_block_##_pxsize (zmbv_codec_t zc, int vx, int vy, const zmbv_frame_block_t *block) { \
   _pxtype *pold = ((_pxtype *)zc->oldframe)+block->start+(vy*zc->pitch)+vx; \
   _pxtype *pnew = ((_pxtype *)zc->newframe)+block->start; \
   for (int y = 0; y < block->dy; ++y) { \
@@ -314,17 +422,23 @@ static inline void zmbv_copy_block_##_pxsize (zmbv_codec_t zc, int vx, int vy, z
 }
 
 
-#define ZMBV_UNXOR_FRAME_TPL(_pxtype,_pxsize) \
-static inline void zmbv_unxor_frame_##_pxsize (zmbv_codec_t zc) { \
-  int8_t *vectors = (int8_t *)&zc->work[zc->workPos]; \
-  zc->workPos = (zc->workPos+zc->blockcount*2+3)&~3; \
-  for (int b = 0; b < zc->blockcount; ++b) { \
-    zmbv_frame_block_t *block = &zc->blocks[b]; \
+/* reconstruct blocks [bfirst..bend); xor data for the first block starts at xordata */
+/* returns pointer right after the xor data of the last block */
+#define ZMBV_UNXOR_BLOCKS_TPL(_pxtype,_pxsize) \
+static const uint8_t *zmbv_unxor_blocks_##_pxsize (zmbv_codec_t zc, const int8_t *vectors, int bfirst, int bend, const uint8_t *xordata) { \
+  for (int b = bfirst; b < bend; ++b) { \
+    const zmbv_frame_block_t *block = &zc->blocks[b]; \
     int delta = vectors[b*2+0]&1; \
     int vx = vectors[b*2+0]>>1; \
     int vy = vectors[b*2+1]>>1; \
-    if (delta) zmbv_unxor_block_##_pxsize(zc, vx, vy, block); else zmbv_copy_block_##_pxsize(zc, vx, vy, block); \
+    if (delta) { \
+      zmbv_unxor_block_##_pxsize(zc, vx, vy, block, xordata); \
+      xordata += block->dx*block->dy*sizeof(_pxtype); \
+    } else { \
+      zmbv_copy_block_##_pxsize(zc, vx, vy, block); \
+    } \
   } \
+  return xordata; \
 }
 
 /* generate functions */
@@ -336,9 +450,77 @@ ZMBV_COPY_BLOCK_TPL(uint8_t,  8)
 ZMBV_COPY_BLOCK_TPL(uint16_t,16)
 ZMBV_COPY_BLOCK_TPL(uint32_t,32)
 
-ZMBV_UNXOR_FRAME_TPL(uint8_t,  8)
-ZMBV_UNXOR_FRAME_TPL(uint16_t,16)
-ZMBV_UNXOR_FRAME_TPL(uint32_t,32)
+ZMBV_UNXOR_BLOCKS_TPL(uint8_t,  8)
+ZMBV_UNXOR_BLOCKS_TPL(uint16_t,16)
+ZMBV_UNXOR_BLOCKS_TPL(uint32_t,32)
+
+
+typedef const uint8_t *(*zmbv_unxor_blocks_fn) (zmbv_codec_t zc, const int8_t *vectors, int bfirst, int bend, const uint8_t *xordata);
+
+#ifdef ZMBV_USE_THREADS
+typedef struct {
+  zmbv_codec_t zc;
+  zmbv_unxor_blocks_fn unxor;
+  const int8_t *vectors;
+  int bfirst, bend;
+  int workpos;
+  int started;
+  pthread_t tid;
+} zmbv_band_t;
+
+
+static void *zmbv_band_thread (void *arg) {
+  zmbv_band_t *band = (zmbv_band_t *)arg;
+  ZMBV_TRACE_BEGIN(ttime);
+  band->unxor(band->zc, band->vectors, band->bfirst, band->bend, &band->zc->work[band->workpos]);
+  ZMBV_TRACE_END(ZMBV_TRACE_BAND, (int)band->zc->dstats.total.frames, ttime);
+  return NULL;
+}
+#endif
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_unxor_frame (zmbv_codec_t zc, zmbv_unxor_blocks_fn unxor) {
+  const int8_t *vectors = (const int8_t *)&zc->work[zc->workPos];
+  int workpos = (zc->workPos+zc->blockcount*2+3)&~3;
+  if (workpos > zc->workUsed) return -1; /* no room for block info */
+#ifdef ZMBV_USE_THREADS
+  int bands = zc->threads;
+  if (bands > zc->yblocks) bands = zc->yblocks;
+  if (bands > zc->blockcount/ZMBV_MIN_BAND_BLOCKS) bands = zc->blockcount/ZMBV_MIN_BAND_BLOCKS;
+  if (bands > 1) {
+    zmbv_band_t band[ZMBV_MAX_THREADS];
+    int b = 0;
+    /* blocks only read the old frame, so the bands are independent once we know where */
+    /* the xor data of each band starts; it's a prefix sum over the block flags */
+    for (int t = 0; t < bands; ++t) {
+      band[t].zc = zc;
+      band[t].unxor = unxor;
+      band[t].vectors = vectors;
+      band[t].bfirst = b;
+      band[t].bend = (zc->yblocks*(t+1)/bands)*zc->xblocks;
+      band[t].workpos = workpos;
+      band[t].started = 0;
+      for (; b < band[t].bend; ++b) {
+        if (vectors[b*2+0]&1) workpos += zc->blocks[b].dx*zc->blocks[b].dy*zc->pixelsize;
+      }
+    }
+    if (workpos > zc->workUsed) return -1; /* not enough xor data */
+    for (int t = 1; t < bands; ++t) {
+      band[t].started = (pthread_create(&band[t].tid, NULL, zmbv_band_thread, &band[t]) == 0);
+    }
+    zmbv_band_thread(&band[0]);
+    for (int t = 1; t < bands; ++t) {
+      /* rebuild it here if we were unable to start a thread */
+      if (band[t].started) pthread_join(band[t].tid, NULL); else zmbv_band_thread(&band[t]);
+    }
+    zc->workPos = workpos;
+    return 0;
+  }
+#endif
+  zc->workPos = (int)(unxor(zc, vectors, 0, zc->blockcount, &zc->work[workpos])-zc->work);
+  return 0;
+}
 
 #endif  /* ZMBV_INCLUDE_DECODER */
 
@@ -347,7 +529,7 @@ static void zmbv_create_vector_table (zmbv_codec_t zc) {
   if (zc != NULL) {
     zc->vector_table[0].x = zc->vector_table[0].y = 0;
     zc->vector_count = 1;
-    for (int s = 1; s <= 10; ++s) {
+    for (int s = 1; s <= ZMBV_VECTOR_RANGE; ++s) {
       for (int y = 0-s; y <= 0+s; ++y) {
         for (int x = 0-s; x <= 0+s; ++x) {
           if (abs(x) == s || abs(y) == s) {
@@ -362,8 +544,40 @@ static void zmbv_create_vector_table (zmbv_codec_t zc) {
 }
 
 
-zmbv_codec_t zmbv_codec_new (zmvb_init_flags_t flags, int complevel) {
-  zmbv_codec_t zc = malloc(sizeof(*zc));
+/******************************************************************************/
+static void *zmbv_mem_alloc (const zmbv_allocator_t *al, size_t size) {
+  return (al->alloc != NULL ? al->alloc(al->udata, size) : malloc(size));
+}
+
+
+static void zmbv_mem_free (const zmbv_allocator_t *al, void *ptr) {
+  if (al->free != NULL) al->free(al->udata, ptr); else free(ptr);
+}
+
+
+/* zlib/miniz allocation hooks; opaque is the allocator */
+#ifdef ZMBV_USE_MINIZ
+static void *zmbv_zalloc (void *opaque, size_t items, size_t size) {
+#else
+static voidpf zmbv_zalloc (voidpf opaque, uInt items, uInt size) {
+#endif
+  return zmbv_mem_alloc((const zmbv_allocator_t *)opaque, (size_t)items*size);
+}
+
+
+#ifdef ZMBV_USE_MINIZ
+static void zmbv_zfree (void *opaque, void *ptr) {
+#else
+static void zmbv_zfree (voidpf opaque, voidpf ptr) {
+#endif
+  zmbv_mem_free((const zmbv_allocator_t *)opaque, ptr);
+}
+
+
+zmbv_codec_t zmbv_codec_new (zmvb_init_flags_t flags, int complevel, const zmbv_allocator_t *alloc) {
+  zmbv_codec_t zc;
+  if (alloc != NULL && (alloc->alloc == NULL || alloc->realloc == NULL || alloc->free == NULL)) return NULL;
+  zc = (alloc != NULL ? alloc->alloc(alloc->udata, sizeof(*zc)) : malloc(sizeof(*zc)));
   if (zc != NULL) {
     /*
     zc->blocks = NULL;
@@ -374,27 +588,95 @@ zmbv_codec_t zmbv_codec_new (zmvb_init_flags_t flags, int complevel) {
     zc->zstream_inited = 0;
     */
     memset(zc, 0, sizeof(*zc));
+    if (alloc != NULL) zc->alloc = *alloc;
+    zc->zstream.zalloc = zmbv_zalloc;
+    zc->zstream.zfree = zmbv_zfree;
+    zc->zstream.opaque = &zc->alloc;
     zc->init_flags = flags;
     if (complevel < 0) complevel = 4;
     else if (complevel > 9) complevel = 9;
     zc->complevel = complevel;
     zmbv_create_vector_table(zc);
+    zmbv_encode_set_block_size(zc, 0, 0);
+    zmbv_encode_set_search(zc, -1, 0);
     zc->mode = ZMBV_MODE_UNKNOWN;
   }
   return zc;
 }
 
 
+static void zmbv_free_arena (zmbv_codec_t zc) {
+  if (zc->arenamem != NULL) {
+#ifdef __linux__
+    if (zc->arenamapped) munmap(zc->arenamem, zc->arenasize); else
+#endif
+    zmbv_mem_free(&zc->alloc, zc->arenamem);
+  }
+  zc->arenamem = NULL;
+  zc->arena = NULL;
+  zc->arenasize = 0;
+  zc->arenadirty = 0;
+  zc->laywidth = zc->layheight = zc->laypixelsize = 0;
+}
+
+
+/* make the arena at least `size` bytes; when it has to grow, the first `keep` bytes are copied */
+/* new arena is zeroed; big ones are mapped to get huge pages */
+/* return <0 on error; 0 on ok */
+static int zmbv_reserve_arena (zmbv_codec_t zc, size_t size, size_t keep) {
+  void *mem = NULL;
+  uint8_t *arena = NULL;
+  int mapped = 0;
+  if (size <= zc->arenasize) return 0;
+#ifdef __linux__
+  if (size >= FRAME_HUGE_PAGE && zc->alloc.alloc == NULL) {
+    size = (size+FRAME_HUGE_PAGE-1)&~(size_t)(FRAME_HUGE_PAGE-1);
+# ifdef ZMBV_USE_HUGETLB
+    mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (mem == MAP_FAILED)
+# endif
+    mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+# ifdef MADV_HUGEPAGE
+      madvise(mem, size, MADV_HUGEPAGE);
+# endif
+      arena = mem;
+      mapped = 1;
+    } else {
+      mem = NULL;
+    }
+  }
+#endif
+  if (mem == NULL) {
+    if (zc->alloc.alloc != NULL) {
+      if ((mem = zc->alloc.alloc(zc->alloc.udata, size+FRAME_ALIGN)) == NULL) return -1;
+      arena = (uint8_t *)(((uintptr_t)mem+FRAME_ALIGN-1)&~(uintptr_t)(FRAME_ALIGN-1));
+      memset(arena, 0, size);
+    } else {
+      /* calloc() gets big blocks zeroed from the system without touching them */
+      if ((mem = calloc(1, size+FRAME_ALIGN)) == NULL) return -1;
+      arena = (uint8_t *)(((uintptr_t)mem+FRAME_ALIGN-1)&~(uintptr_t)(FRAME_ALIGN-1));
+    }
+  }
+  if (keep > 0) memcpy(arena, zc->arena, keep);
+  zmbv_free_arena(zc);
+  zc->arenamem = mem;
+  zc->arena = arena;
+  zc->arenasize = size;
+  zc->arenamapped = mapped;
+  zc->arenadirty = keep;
+  return 0;
+}
+
+
 static void zmbv_free_buffers (zmbv_codec_t zc) {
   if (zc != NULL) {
-    if (zc->blocks != NULL) free(zc->blocks);
-    if (zc->buf1 != NULL) free(zc->buf1);
-    if (zc->buf2 != NULL) free(zc->buf2);
-    if (zc->work != NULL) free(zc->work);
+    zmbv_free_arena(zc);
     zc->blocks = NULL;
     zc->buf1 = NULL;
     zc->buf2 = NULL;
     zc->work = NULL;
+    zc->vectors = NULL;
   }
 }
 
@@ -403,7 +685,9 @@ static void zmbv_zlib_deinit (zmbv_codec_t zc) {
   if (zc != NULL) {
     switch (zc->zstream_inited) {
       case -1: mz_deflateEnd(&zc->zstream); break;
+#ifndef ZMBV_USE_TINFL
       case 1: mz_inflateEnd(&zc->zstream); break;
+#endif
     }
     zc->zstream_inited = 0;
   }
@@ -414,7 +698,7 @@ void zmbv_codec_free (zmbv_codec_t zc) {
   if (zc != NULL) {
     zmbv_zlib_deinit(zc);
     zmbv_free_buffers(zc);
-    free(zc);
+    zmbv_mem_free(&zc->alloc, zc);
   }
 }
 
@@ -430,26 +714,75 @@ int zmbv_get_height (zmbv_codec_t zc) {
 }
 
 
+zmbv_format_t zmbv_get_frame_format (zmbv_codec_t zc) {
+  return (zc != NULL ? zc->format : ZMBV_FORMAT_NONE);
+}
+
+
 /******************************************************************************/
+/* carve block table, vectors and work buffer after the frame buffers, growing the arena if needed */
+/* frame buffers and block geometry should be set up already; `keep` copies frame buffers and */
+/* block table on growth, otherwise whatever older layouts left in frame buffers is cleared */
+/* return <0 on error; 0 on ok */
+static int zmbv_setup_work (zmbv_codec_t zc, int keep) {
+  size_t frames = 2*zc->bufslot;
+  size_t tabpos = (frames+FRAME_ALIGN-1)&~(size_t)(FRAME_ALIGN-1);
+  size_t vecpos = tabpos+sizeof(zmbv_frame_block_t)*zc->blockcount;
+  size_t workpos, need;
+  int swapped = (zc->oldframe != NULL && zc->oldframe == zc->buf2);
+  /* whole frame of xor data and the block info in front of it */
+  zc->worksize = zc->bufsize+((zc->blockcount*2+3)&~3);
+  if (zc->mode == ZMBV_MODE_DECODER && zc->pipe_chunk > 0) {
+    /* room for one chunk plus the biggest piece that must be contiguous */
+    int unit = zc->blockwidth*zc->blockheight*zc->pixelsize;
+    if (unit < zc->palsize*3) unit = zc->palsize*3;
+    if (unit < ((zc->blockcount*2+3)&~3)) unit = (zc->blockcount*2+3)&~3;
+    zc->worksize = zc->pipe_chunk+unit;
+  }
+  zc->workroom = (zc->mode == ZMBV_MODE_DECODER ? WORK_HISTORY : 0);
+  workpos = (vecpos+zc->blockcount*2+zc->workroom+FRAME_ALIGN-1)&~(size_t)(FRAME_ALIGN-1);
+  need = workpos+zc->worksize;
+  if (zmbv_reserve_arena(zc, need, (keep ? vecpos : 0)) < 0) return -1;
+  if (!keep) {
+    /* fresh arena is all zeroes already */
+    size_t clear = (zc->arenadirty < frames ? zc->arenadirty : frames);
+    if (clear > 0) memset(zc->arena, 0, clear);
+  }
+  if (zc->arenadirty < need) zc->arenadirty = need;
+  zc->buf1 = zc->arena+zc->buflead;
+  zc->buf2 = zc->arena+zc->bufslot+zc->buflead;
+  zc->oldframe = (swapped ? zc->buf2 : zc->buf1);
+  zc->newframe = (swapped ? zc->buf1 : zc->buf2);
+  zc->blocks = (zmbv_frame_block_t *)(zc->arena+tabpos);
+  zc->vectors = (int8_t *)(zc->arena+vecpos);
+  zc->work = zc->arena+workpos;
+  return 0;
+}
+
+
 static int zmbv_setup_buffers (zmbv_codec_t zc, zmbv_format_t format, int blockwidth, int blockheight) {
   if (zc != NULL) {
-    int xblocks, xleft, yblocks, yleft, i;
+    int xblocks, xleft, yblocks, yleft, i, samelayout;
 
-    zmbv_free_buffers(zc);
     zc->palsize = 0;
     switch (format) {
       case ZMBV_FORMAT_8BPP: zc->pixelsize = 1; zc->palsize = 256; break;
       case ZMBV_FORMAT_15BPP: case ZMBV_FORMAT_16BPP: zc->pixelsize = 2; break;
       case ZMBV_FORMAT_32BPP: zc->pixelsize = 4; break;
-      default: return -1;
+      default: zmbv_free_buffers(zc); return -1;
     };
-    zc->bufsize = (zc->height+2*MAX_VECTOR)*zc->pitch*zc->pixelsize+2048;
-
-    zc->buf1 = malloc(zc->bufsize);
-    zc->buf2 = malloc(zc->bufsize);
-    zc->work = malloc(zc->bufsize);
-
-    if (zc->buf1 == NULL || zc->buf2 == NULL || zc->work == NULL) { zmbv_free_buffers(zc); return -1; }
+    {
+      /* rows are padded to FRAME_ALIGN bytes; pitch that is a multiple of 4KB would make */
+      /* rows alias in L1, so it gets one more FRAME_ALIGN */
+      int pitchbytes = ((zc->width+2*MAX_VECTOR)*zc->pixelsize+FRAME_ALIGN-1)&~(FRAME_ALIGN-1);
+      if ((pitchbytes&4095) == 0) pitchbytes += FRAME_ALIGN;
+      zc->pitch = pitchbytes/zc->pixelsize;
+      zc->bufsize = (zc->height+2*MAX_VECTOR)*pitchbytes+2048;
+      /* buf1 starts this far into the arena, so first active pixel is aligned */
+      zc->buflead = (FRAME_ALIGN-(MAX_VECTOR*zc->pixelsize)%FRAME_ALIGN)%FRAME_ALIGN;
+      /* buf2 is not a multiple of 4KB away from buf1 either */
+      zc->bufslot = (((size_t)zc->buflead+zc->bufsize+4095)&~(size_t)4095)+1024;
+    }
 
     xblocks = (zc->width/blockwidth);
     xleft = zc->width%blockwidth;
@@ -459,8 +792,20 @@ static int zmbv_setup_buffers (zmbv_codec_t zc, zmbv_format_t format, int blockw
     if (yleft) ++yblocks;
 
     zc->blockcount = yblocks*xblocks;
-    zc->blocks = malloc(sizeof(zmbv_frame_block_t)*zc->blockcount);
-    if (zc->blocks == NULL) { zmbv_free_buffers(zc); return -1; }
+    zc->blockwidth = blockwidth;
+    zc->blockheight = blockheight;
+    zc->xblocks = xblocks;
+    zc->yblocks = yblocks;
+
+    /* frames only ever write their active area, so the borders of a layout we already */
+    /* have are still clear, and the old picture is as good as a cleared one: new layout */
+    /* is set up with a keyframe */
+    samelayout = (zc->laywidth == zc->width && zc->layheight == zc->height && zc->laypixelsize == zc->pixelsize);
+    zc->oldframe = zc->buf1;
+    if (zmbv_setup_work(zc, samelayout) < 0) { zmbv_free_buffers(zc); return -1; }
+    zc->laywidth = zc->width;
+    zc->layheight = zc->height;
+    zc->laypixelsize = zc->pixelsize;
 
     i = 0;
     for (int y = 0; y < yblocks; ++y) {
@@ -472,11 +817,6 @@ static int zmbv_setup_buffers (zmbv_codec_t zc, zmbv_format_t format, int blockw
       }
     }
 
-    memset(zc->buf1, 0, zc->bufsize);
-    memset(zc->buf2, 0, zc->bufsize);
-    memset(zc->work, 0, zc->bufsize);
-    zc->oldframe = zc->buf1;
-    zc->newframe = zc->buf2;
     zc->format = format;
     return 0;
   }
@@ -485,17 +825,57 @@ static int zmbv_setup_buffers (zmbv_codec_t zc, zmbv_format_t format, int blockw
 
 
 /******************************************************************************/
+/* monotonic clock for the statistics */
+static uint64_t zmbv_nsecs (void) {
+#ifdef _WIN32
+  LARGE_INTEGER cnt, freq;
+  QueryPerformanceCounter(&cnt);
+  QueryPerformanceFrequency(&freq);
+  return (uint64_t)(cnt.QuadPart/freq.QuadPart)*1000000000ull+(uint64_t)(cnt.QuadPart%freq.QuadPart)*1000000000ull/freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+#endif
+}
+
+
+static void zmbv_add_encode_counters (zmbv_encode_counters_t *dst, const zmbv_encode_counters_t *src) {
+  dst->frames += src->frames;
+  dst->keyframes += src->keyframes;
+  dst->blocks_same += src->blocks_same;
+  dst->blocks_moved += src->blocks_moved;
+  dst->blocks_xor += src->blocks_xor;
+  dst->compares += src->compares;
+  dst->probes += src->probes;
+  dst->raw_bytes += src->raw_bytes;
+  dst->xor_bytes += src->xor_bytes;
+  dst->packed_bytes += src->packed_bytes;
+  dst->copy_ns += src->copy_ns;
+  dst->search_ns += src->search_ns;
+  dst->deflate_ns += src->deflate_ns;
+  for (int f = 0; f < ZMBV_VECTOR_SPAN*ZMBV_VECTOR_SPAN; ++f) dst->vectors[f] += src->vectors[f];
+}
+
+
 int zmbv_encode_setup (zmbv_codec_t zc, int width, int height) {
   if (zc != NULL && width > 0 && height > 0 && width <= 16384 && height <= 16384) {
     zc->width = width;
     zc->height = height;
     zc->pitch = width+2*MAX_VECTOR;
     zc->format = ZMBV_FORMAT_NONE;
-    zmbv_zlib_deinit(zc);
-    if ((zc->init_flags&ZMBV_INIT_FLAG_NOZLIB) == 0) {
-      if (mz_deflateInit(&zc->zstream, zc->complevel) != MZ_OK) return -1;
-      zc->zstream_inited = -1;
+    if (zc->zstream_inited < 0) {
+      /* reuse the deflater: reset is much cheaper than end and init */
+      if (mz_deflateReset(&zc->zstream) != MZ_OK) return -1;
+    } else {
+      zmbv_zlib_deinit(zc);
+      if ((zc->init_flags&ZMBV_INIT_FLAG_NOZLIB) == 0) {
+        if (mz_deflateInit(&zc->zstream, zc->complevel) != MZ_OK) return -1;
+        zc->zstream_inited = -1;
+      }
     }
+    memset(&zc->ecur, 0, sizeof(zc->ecur));
+    memset(&zc->estats, 0, sizeof(zc->estats));
     zc->mode = ZMBV_MODE_ENCODER;
     return 0;
   }
@@ -503,6 +883,39 @@ int zmbv_encode_setup (zmbv_codec_t zc, int width, int height) {
 }
 
 
+int zmbv_codec_reserve (zmbv_codec_t zc, zmbv_format_t fmt) {
+  if (zc != NULL && zc->mode != ZMBV_MODE_UNKNOWN && zc->format == ZMBV_FORMAT_NONE) {
+    if (zmbv_setup_buffers(zc, fmt, zc->enc_blockwidth, zc->enc_blockheight) < 0) return -1;
+    /* first frame sees a format change: that forces a keyframe, and the buffers are only re-carved */
+    zc->format = ZMBV_FORMAT_NONE;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_encode_set_block_size (zmbv_codec_t zc, int width, int height) {
+  if (zc == NULL) return -1;
+  if (width == 0) width = 16;
+  if (height == 0) height = 16;
+  if (width < 8 || height < 8 || width > 255 || height > 255) return -1;
+  zc->enc_blockwidth = width;
+  zc->enc_blockheight = height;
+  return 0;
+}
+
+
+int zmbv_encode_set_search (zmbv_codec_t zc, int range, int candidates) {
+  if (zc == NULL || range > ZMBV_VECTOR_RANGE) return -1;
+  if (range < 0) range = ZMBV_VECTOR_RANGE;
+  if (candidates <= 0) candidates = 64;
+  /* vector table goes ring by ring */
+  zc->search_vectors = (2*range+1)*(2*range+1);
+  zc->search_candidates = candidates;
+  return 0;
+}
+
+
 /******************************************************************************/
 int zmbv_encode_prepare_frame (zmbv_codec_t zc, zmvb_prepare_flags_t flags, zmbv_format_t fmt, const void *pal, void *outbuf, int outbuf_size) {
   uint8_t *firstByte;
@@ -521,8 +934,9 @@ int zmbv_encode_prepare_frame (zmbv_codec_t zc, zmvb_prepare_flags_t flags, zmbv
     default: return -1;
   }
 
-  if (fmt != zc->format) {
-    if (zmbv_setup_buffers(zc, fmt, 16, 16) < 0) return -1;
+  ZMBV_TRACE_BEGIN(ttime);
+  if (fmt != zc->format || zc->blockwidth != zc->enc_blockwidth || zc->blockheight != zc->enc_blockheight) {
+    if (zmbv_setup_buffers(zc, fmt, zc->enc_blockwidth, zc->enc_blockheight) < 0) return -1;
     flags |= ZMBV_PREP_FLAG_KEYFRAME; /* force a keyframe */
   }
 
@@ -533,6 +947,7 @@ int zmbv_encode_prepare_frame (zmbv_codec_t zc, zmvb_prepare_flags_t flags, zmbv
     zc->oldframe = copyFrame;
   }
 
+  memset(&zc->ecur, 0, sizeof(zc->ecur));
   zc->compress.lines_done = 0;
   zc->compress.outbuf_size = outbuf_size;
   zc->compress.write_done = 1;
@@ -551,8 +966,8 @@ int zmbv_encode_prepare_frame (zmbv_codec_t zc, zmvb_prepare_flags_t flags, zmbv
     header->low_version = DBZV_VERSION_LOW;
     header->compression = ((zc->init_flags&ZMBV_INIT_FLAG_NOZLIB) == 0 ? COMPRESSION_ZLIB : COMPRESSION_NONE);
     header->format = zc->format;
-    header->blockwidth = 16;
-    header->blockheight = 16;
+    header->blockwidth = zc->blockwidth;
+    header->blockheight = zc->blockheight;
     zc->compress.write_done += sizeof(zmbv_keyframe_header_t);
     /* copy the new frame directly over */
     if (zc->palsize) {
@@ -583,6 +998,7 @@ int zmbv_encode_prepare_frame (zmbv_codec_t zc, zmvb_prepare_flags_t flags, zmbv
       memcpy(&zc->palette, plt, zc->palsize*3);
     }
   }
+  ZMBV_TRACE_END(ZMBV_TRACE_PREPARE, (int)zc->estats.total.frames, ttime);
   return 0;
 }
 
@@ -594,6 +1010,7 @@ int zmbv_encode_lines (zmbv_codec_t zc, int line_count, const void *const line_p
     int line_width = zc->width*zc->pixelsize;
     uint8_t *destStart = zc->newframe+zc->pixelsize*(MAX_VECTOR+(zc->compress.lines_done+MAX_VECTOR)*zc->pitch);
     int i = 0;
+    uint64_t stime = zmbv_nsecs();
     if (line_count > 0 && line_ptrs == NULL) return -1;
     while (i < line_count && zc->compress.lines_done < zc->height) {
       if (line_ptrs[i] == NULL) return -1;
@@ -602,6 +1019,7 @@ int zmbv_encode_lines (zmbv_codec_t zc, int line_count, const void *const line_p
       ++i;
       ++zc->compress.lines_done;
     }
+    zc->ecur.copy_ns += zmbv_nsecs()-stime;
     return 0;
   }
   return -1;
@@ -612,6 +1030,8 @@ int zmbv_encode_lines (zmbv_codec_t zc, int line_count, const void *const line_p
 int zmvb_encode_finish_frame (zmbv_codec_t zc) {
   if (zc != NULL && zc->mode == ZMBV_MODE_ENCODER) {
     uint8_t firstByte = *zc->compress.outbuf;
+    uint64_t stime = zmbv_nsecs(), etime;
+    int packed;
     if (firstByte&FRAME_MASK_KEYFRAME) {
       int i;
       /* add the full frame data */
@@ -621,15 +1041,23 @@ int zmvb_encode_finish_frame (zmbv_codec_t zc) {
         readFrame += zc->pitch*zc->pixelsize;
         zc->workUsed += zc->width*zc->pixelsize;
       }
+      ++zc->ecur.keyframes;
+      etime = zmbv_nsecs();
+      zc->ecur.copy_ns += etime-stime;
     } else {
       /* add the delta frame data */
+      ZMBV_TRACE_BEGIN(ttime);
       switch (zc->format) {
         case ZMBV_FORMAT_8BPP: zmbv_add_xor_frame_8(zc); break;
         case ZMBV_FORMAT_15BPP: case ZMBV_FORMAT_16BPP: zmbv_add_xor_frame_16(zc); break;
         case ZMBV_FORMAT_32BPP: zmbv_add_xor_frame_32(zc); break;
         default: return -1; /* the thing that should not be */
       }
+      ZMBV_TRACE_END(ZMBV_TRACE_SEARCH, (int)zc->estats.total.frames, ttime);
+      etime = zmbv_nsecs();
+      zc->ecur.search_ns += etime-stime;
     }
+    ZMBV_TRACE_BEGIN(ttime);
     if ((zc->init_flags&ZMBV_INIT_FLAG_NOZLIB) == 0) {
       /* create the actual frame with compression */
       zc->zstream.next_in = (void *)zc->work;
@@ -639,17 +1067,126 @@ int zmvb_encode_finish_frame (zmbv_codec_t zc) {
       zc->zstream.avail_out = zc->compress.outbuf_size-zc->compress.write_done;
       zc->zstream.total_out = 0;
       if (mz_deflate(&zc->zstream, MZ_SYNC_FLUSH) != MZ_OK) return -1; /* the thing that should not be */
-      return (int)(zc->compress.write_done+zc->zstream.total_out);
+      packed = (int)zc->zstream.total_out;
     } else {
       memcpy(zc->compress.outbuf+zc->compress.write_done, zc->work, zc->workUsed);
-      return zc->workUsed+zc->compress.write_done;
+      packed = zc->workUsed;
     }
+    ZMBV_TRACE_END(ZMBV_TRACE_DEFLATE, (int)zc->estats.total.frames, ttime);
+    zc->ecur.deflate_ns += zmbv_nsecs()-etime;
+    zc->ecur.frames = 1;
+    zc->ecur.raw_bytes = zc->workUsed;
+    zc->ecur.packed_bytes = packed;
+    zmbv_add_encode_counters(&zc->estats.total, &zc->ecur);
+    zc->estats.last = zc->ecur;
+    return packed+zc->compress.write_done;
   }
   return -1;
 }
 
 
+int zmbv_encode_get_stats (zmbv_codec_t zc, zmbv_encode_stats_t *stats) {
+  if (zc == NULL || stats == NULL || zc->mode != ZMBV_MODE_ENCODER) return -1;
+  *stats = zc->estats;
+  return 0;
+}
+
+
 #ifdef ZMBV_INCLUDE_DECODER
+/******************************************************************************/
+/* inflate backend */
+/* return <0 on error; 0 on ok */
+static int zmbv_inflate_init (zmbv_codec_t zc) {
+#ifdef ZMBV_USE_TINFL
+  tinfl_init(&zc->tinfl);
+  zc->tinfl_flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+  zc->histlen = 0;
+#else
+  if (mz_inflateInit(&zc->zstream) != MZ_OK) return -1;
+#endif
+  zc->zstream_inited = 1;
+  return 0;
+}
+
+
+/* restart the stream on keyframe */
+/* return <0 on error; 0 on ok */
+static int zmbv_inflate_reset (zmbv_codec_t zc) {
+#ifdef ZMBV_USE_TINFL
+  tinfl_init(&zc->tinfl);
+  zc->tinfl_flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+  zc->histlen = 0;
+  return 0;
+#else
+  return (mz_inflateReset(&zc->zstream) == MZ_OK ? 0 : -1);
+#endif
+}
+
+
+/* inflate the whole frame into work buffer */
+/* return # of bytes inflated or <0 on error */
+static int zmbv_inflate_frame (zmbv_codec_t zc, const uint8_t *data, int size) {
+#ifdef ZMBV_USE_TINFL
+  size_t insize = size, outsize = zc->worksize;
+  int total, keep;
+  /* the stream is never finished, every frame ends with a sync flush */
+  tinfl_status status = tinfl_decompress(&zc->tinfl, data, &insize, zc->work-zc->histlen, zc->work, &outsize,
+    zc->tinfl_flags|TINFL_FLAG_HAS_MORE_INPUT|TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+  zc->tinfl_flags = 0;
+  if (status < TINFL_STATUS_DONE || status == TINFL_STATUS_HAS_MORE_OUTPUT) return -1;
+  /* keep the last 32KB in front of work buffer; frame data itself stays where it is */
+  total = zc->histlen+(int)outsize;
+  keep = (total < TINFL_LZ_DICT_SIZE ? total : TINFL_LZ_DICT_SIZE);
+  memmove(zc->work-keep, zc->work+outsize-keep, keep);
+  zc->histlen = keep;
+  return (int)outsize;
+#else
+  zc->zstream.next_in = (void *)data;
+  zc->zstream.avail_in = size;
+  zc->zstream.total_in = 0;
+  zc->zstream.next_out = (void *)zc->work;
+  zc->zstream.avail_out = zc->worksize;
+  zc->zstream.total_out = 0;
+  if (mz_inflate(&zc->zstream, MZ_SYNC_FLUSH/*MZ_NO_FLUSH*/) != MZ_OK) return -1; /* the thing that should not be */
+  return (int)zc->zstream.total_out;
+#endif
+}
+
+
+/******************************************************************************/
+/* decoder statistics */
+static void zmbv_count_blocks (zmbv_codec_t zc, const int8_t *vectors) {
+  int xored = 0;
+  for (int b = 0; b < zc->blockcount; ++b) xored += vectors[b*2+0]&1;
+  zc->dcur.blocks_xor = xored;
+  zc->dcur.blocks_copy = zc->blockcount-xored;
+}
+
+
+/* frame is decoded: publish its counters; `stime` is when its data started to be processed */
+/* returns 0 */
+static int zmbv_decode_done (zmbv_codec_t zc, uint8_t tag, uint64_t stime) {
+  zmbv_decode_counters_t *st = &zc->dcur, *tot = &zc->dstats.total;
+  st->frames = 1;
+  st->keyframes = ((tag&FRAME_MASK_KEYFRAME) != 0);
+  st->palette_updates = (zc->palsize && (tag&(FRAME_MASK_KEYFRAME|FRAME_MASK_DELTA_PALETTE)) != 0);
+  st->raw_bytes = zc->workUsed;
+  st->rebuild_ns = zmbv_nsecs()-stime-st->inflate_ns;
+  tot->frames += st->frames;
+  tot->keyframes += st->keyframes;
+  tot->palette_updates += st->palette_updates;
+  tot->blocks_copy += st->blocks_copy;
+  tot->blocks_xor += st->blocks_xor;
+  tot->packed_bytes += st->packed_bytes;
+  tot->raw_bytes += st->raw_bytes;
+  tot->inflate_ns += st->inflate_ns;
+  tot->rebuild_ns += st->rebuild_ns;
+  zc->dstats.last = *st;
+  if (zc->stats_cb != NULL) zc->stats_cb(zc, st, zc->stats_udata);
+  return 0;
+}
+
+
 /******************************************************************************/
 int zmbv_decode_setup (zmbv_codec_t zc, int width, int height) {
   if (zc != NULL && width > 0 && height > 0 && width <= 16384 && height <= 16384) {
@@ -657,9 +1194,13 @@ int zmbv_decode_setup (zmbv_codec_t zc, int width, int height) {
     zc->height = height;
     zc->pitch = width+2*MAX_VECTOR;
     zc->format = ZMBV_FORMAT_NONE;
-    zmbv_zlib_deinit(zc);
-    if (mz_inflateInit(&zc->zstream) != MZ_OK) return -1;
-    zc->zstream_inited = 1;
+    if (zc->zstream_inited > 0) {
+      if (zmbv_inflate_reset(zc) < 0) return -1;
+    } else {
+      zmbv_zlib_deinit(zc);
+      if (zmbv_inflate_init(zc) < 0) return -1;
+    }
+    memset(&zc->dstats, 0, sizeof(zc->dstats));
     zc->mode = ZMBV_MODE_DECODER;
     zc->unpack_compression = 0;
     return 0;
@@ -668,6 +1209,58 @@ int zmbv_decode_setup (zmbv_codec_t zc, int width, int height) {
 }
 
 
+int zmbv_decode_set_stats_callback (zmbv_codec_t zc, zmbv_decode_stats_cb cb, void *udata) {
+  if (zc != NULL) {
+    zc->stats_cb = cb;
+    zc->stats_udata = udata;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_decode_get_stats (zmbv_codec_t zc, zmbv_decode_stats_t *stats) {
+  if (zc == NULL || stats == NULL || zc->mode != ZMBV_MODE_DECODER) return -1;
+  *stats = zc->dstats;
+  return 0;
+}
+
+
+int zmbv_decode_set_threads (zmbv_codec_t zc, int count) {
+  if (zc != NULL && count >= 0) {
+#ifdef ZMBV_USE_THREADS
+    if (count > ZMBV_MAX_THREADS) count = ZMBV_MAX_THREADS;
+#else
+    if (count > 1) return -1;
+#endif
+    zc->threads = count;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_decode_set_pipelined (zmbv_codec_t zc, int chunksize) {
+  if (zc != NULL && zc->mode == ZMBV_MODE_DECODER && chunksize >= 0) {
+#ifdef ZMBV_USE_TINFL
+    if (chunksize > 0) return -1; /* tinfl needs the whole frame in one buffer */
+#endif
+    if (chunksize > 0 && chunksize < 4096) chunksize = 4096;
+    if (chunksize != zc->pipe_chunk) {
+      zc->pipe_chunk = chunksize;
+      /* resize work buffer if we already know the frame format */
+      if (zc->format != ZMBV_FORMAT_NONE && zmbv_setup_work(zc, 1) < 0) {
+        zmbv_free_buffers(zc);
+        zc->format = ZMBV_FORMAT_NONE;
+        return -1;
+      }
+    }
+    return 0;
+  }
+  return -1;
+}
+
+
 /******************************************************************************/
 const uint8_t *zmbv_get_palette (zmbv_codec_t zc) {
   return (zc != NULL ? zc->palette : NULL);
@@ -690,11 +1283,266 @@ int zmbv_decode_palette_changed (zmbv_codec_t zc, const void *framedata, int siz
   return (zc != NULL && framedata != NULL && size > 0 ? (((const uint8_t *)framedata)[0]&FRAME_MASK_DELTA_PALETTE) != 0 : 0);
 }
 
+/******************************************************************************/
+#if defined(ZMBV_USE_MINIZ) && !defined(ZMBV_USE_TINFL)
+/* miniz keeps the whole inflater in one flat struct */
+static int mz_inflateCopy (mz_streamp dest, mz_streamp source) {
+  inflate_state *st;
+  memcpy(dest, source, sizeof(*dest));
+  st = (inflate_state *)dest->zalloc(dest->opaque, 1, sizeof(inflate_state));
+  if (st == NULL) return MZ_MEM_ERROR;
+  memcpy(st, source->state, sizeof(inflate_state));
+  dest->state = (struct mz_internal_state *)st;
+  return MZ_OK;
+}
+#endif
+
+
+struct zmbv_decode_state_s {
+  int width, height;
+  zmbv_format_t format;
+  int blockwidth, blockheight;
+  int unpack_compression;
+  uint8_t palette[256*3];
+#ifdef ZMBV_USE_TINFL
+  tinfl_decompressor tinfl;
+  int tinfl_flags;
+  int histlen;
+  uint8_t history[TINFL_LZ_DICT_SIZE];
+#else
+  mz_stream zstream;
+#endif
+  int memsize;
+  zmbv_allocator_t alloc;
+  uint8_t *frame; /* width*height pixels */
+};
+
+
+zmbv_decode_state_t zmbv_decode_state_save (zmbv_codec_t zc) {
+  if (zc != NULL && zc->mode == ZMBV_MODE_DECODER && zc->format != ZMBV_FORMAT_NONE) {
+    int linesize = zc->width*zc->pixelsize;
+    zmbv_decode_state_t st = zmbv_mem_alloc(&zc->alloc, sizeof(*st));
+    if (st == NULL) return NULL;
+    memset(st, 0, sizeof(*st));
+    st->alloc = zc->alloc;
+    st->frame = zmbv_mem_alloc(&st->alloc, linesize*zc->height);
+    if (st->frame == NULL) { zmbv_mem_free(&st->alloc, st); return NULL; }
+#ifdef ZMBV_USE_TINFL
+    memcpy(&st->tinfl, &zc->tinfl, sizeof(st->tinfl));
+    st->tinfl_flags = zc->tinfl_flags;
+    st->histlen = zc->histlen;
+    memcpy(st->history, zc->work-zc->histlen, zc->histlen);
+#else
+    if (mz_inflateCopy(&st->zstream, &zc->zstream) != MZ_OK) { zmbv_mem_free(&st->alloc, st->frame); zmbv_mem_free(&st->alloc, st); return NULL; }
+    st->zstream.opaque = &st->alloc; /* snapshot can outlive the codec */
+#endif
+    st->width = zc->width;
+    st->height = zc->height;
+    st->format = zc->format;
+    st->blockwidth = zc->blockwidth;
+    st->blockheight = zc->blockheight;
+    st->unpack_compression = zc->unpack_compression;
+    memcpy(st->palette, zc->palette, sizeof(st->palette));
+    for (int y = 0; y < zc->height; ++y) memcpy(st->frame+y*linesize, zmbv_get_decoded_line(zc, y), linesize);
+    st->memsize = (int)sizeof(*st)+linesize*zc->height;
+#ifndef ZMBV_USE_TINFL
+    st->memsize += 48*1024; /* inflater state and window, roughly */
+#endif
+    return st;
+  }
+  return NULL;
+}
+
+
+int zmbv_decode_state_restore (zmbv_codec_t zc, zmbv_decode_state_t st) {
+  if (zc != NULL && st != NULL && zc->mode == ZMBV_MODE_DECODER) {
+    int linesize;
+    if (zc->width != st->width || zc->height != st->height) return -1;
+    if (zc->format != st->format || zc->blockwidth != st->blockwidth || zc->blockheight != st->blockheight) {
+      if (zmbv_setup_buffers(zc, st->format, st->blockwidth, st->blockheight) < 0) return -1;
+    }
+    linesize = zc->width*zc->pixelsize;
+#ifdef ZMBV_USE_TINFL
+    memcpy(&zc->tinfl, &st->tinfl, sizeof(zc->tinfl));
+    zc->tinfl_flags = st->tinfl_flags;
+    zc->histlen = st->histlen;
+    memcpy(zc->work-zc->histlen, st->history, zc->histlen);
+#else
+    {
+      /* zlib state points back to its stream, so copy right into place */
+      mz_stream old, fresh;
+      memcpy(&old, &zc->zstream, sizeof(old));
+      if (mz_inflateCopy(&zc->zstream, &st->zstream) != MZ_OK) {
+        memcpy(&zc->zstream, &old, sizeof(old));
+        return -1;
+      }
+      memcpy(&fresh, &zc->zstream, sizeof(fresh));
+      memcpy(&zc->zstream, &old, sizeof(old));
+      zmbv_zlib_deinit(zc);
+      memcpy(&zc->zstream, &fresh, sizeof(fresh));
+      zc->zstream.opaque = &zc->alloc;
+      zc->zstream_inited = 1;
+    }
+#endif
+    zc->unpack_compression = st->unpack_compression;
+    memcpy(zc->palette, st->palette, sizeof(zc->palette));
+    for (int y = 0; y < zc->height; ++y) memcpy((void *)zmbv_get_decoded_line(zc, y), st->frame+y*linesize, linesize);
+    return 0;
+  }
+  return -1;
+}
+
+
+void zmbv_decode_state_free (zmbv_decode_state_t st) {
+  if (st != NULL) {
+#ifndef ZMBV_USE_TINFL
+    mz_inflateEnd(&st->zstream);
+#endif
+    zmbv_mem_free(&st->alloc, st->frame);
+    zmbv_mem_free(&st->alloc, st);
+  }
+}
+
+
+int zmbv_decode_state_memory (zmbv_decode_state_t st) {
+  return (st != NULL ? st->memsize : -1);
+}
+
+#ifndef ZMBV_USE_TINFL
+/******************************************************************************/
+/* feed pipelined decoder with `avail` bytes of frame data */
+/* returns number of bytes used; the rest should be fed again with more data appended */
+static int zmbv_pipe_consume (zmbv_codec_t zc, zmbv_unxor_blocks_fn unxor, uint8_t tag, const uint8_t *src, int avail) {
+  int used = 0;
+  for (;;) {
+    switch (zc->pipe_state) {
+      case ZMBV_PIPE_PALETTE:
+        if (avail-used < zc->palsize*3) return used;
+        for (int i = 0; i < zc->palsize*3; ++i) {
+          if (tag&FRAME_MASK_KEYFRAME) zc->palette[i] = src[used+i]; else zc->palette[i] ^= src[used+i];
+        }
+        used += zc->palsize*3;
+        zc->pipe_state = (tag&FRAME_MASK_KEYFRAME ? ZMBV_PIPE_ROWS : ZMBV_PIPE_VECTORS);
+        break;
+      case ZMBV_PIPE_ROWS: {
+        /* keyframe rows can be copied piecewise */
+        int linesize = zc->width*zc->pixelsize;
+        while (zc->pipe_pos < zc->height && used < avail) {
+          uint8_t *dest = zc->newframe+zc->pixelsize*(MAX_VECTOR+(zc->pipe_pos+MAX_VECTOR)*zc->pitch)+zc->pipe_ofs;
+          int n = linesize-zc->pipe_ofs;
+          if (n > avail-used) n = avail-used;
+          memcpy(dest, src+used, n);
+          used += n;
+          zc->pipe_ofs += n;
+          if (zc->pipe_ofs == linesize) { zc->pipe_ofs = 0; ++zc->pipe_pos; }
+        }
+        if (zc->pipe_pos < zc->height) return used;
+        zc->pipe_state = ZMBV_PIPE_DONE;
+        break; }
+      case ZMBV_PIPE_VECTORS:
+        /* block info is padded to 4 bytes */
+        if (avail-used < ((zc->blockcount*2+3)&~3)) return used;
+        memcpy(zc->vectors, src+used, zc->blockcount*2);
+        used += (zc->blockcount*2+3)&~3;
+        zc->pipe_pos = 0;
+        zc->pipe_state = ZMBV_PIPE_BLOCKS;
+        break;
+      case ZMBV_PIPE_BLOCKS: {
+        /* rebuild the longest run of blocks which xor data is here */
+        int bend = zc->pipe_pos, need = 0;
+        while (bend < zc->blockcount) {
+          int bsize = (zc->vectors[bend*2+0]&1 ? zc->blocks[bend].dx*zc->blocks[bend].dy*zc->pixelsize : 0);
+          if (avail-used-need < bsize) break;
+          need += bsize;
+          ++bend;
+        }
+        if (bend > zc->pipe_pos) {
+          unxor(zc, zc->vectors, zc->pipe_pos, bend, src+used);
+          used += need;
+          zc->pipe_pos = bend;
+        }
+        if (zc->pipe_pos < zc->blockcount) return used;
+        zc->pipe_state = ZMBV_PIPE_DONE;
+        break; }
+      default:
+        return used;
+    }
+  }
+}
+
+
+/* inflate frame in chunks, rebuilding it while the data arrives */
+/* return <0 on error; 0 on ok */
+static int zmbv_decode_frame_pipelined (zmbv_codec_t zc, uint8_t tag, const uint8_t *data, int size) {
+  zmbv_unxor_blocks_fn unxor;
+  uint64_t stime;
+  switch (zc->format) {
+    case ZMBV_FORMAT_8BPP: unxor = zmbv_unxor_blocks_8; break;
+    case ZMBV_FORMAT_15BPP: case ZMBV_FORMAT_16BPP: unxor = zmbv_unxor_blocks_16; break;
+    case ZMBV_FORMAT_32BPP: unxor = zmbv_unxor_blocks_32; break;
+    default: return -1; /* the thing that should not be */
+  }
+  if (tag&FRAME_MASK_KEYFRAME) {
+    zc->newframe = zc->buf1;
+    zc->oldframe = zc->buf2;
+    zc->pipe_state = (zc->palsize ? ZMBV_PIPE_PALETTE : ZMBV_PIPE_ROWS);
+  } else {
+    uint8_t *tmp = zc->oldframe;
+    zc->oldframe = zc->newframe;
+    zc->newframe = tmp;
+    zc->pipe_state = (tag&FRAME_MASK_DELTA_PALETTE ? ZMBV_PIPE_PALETTE : ZMBV_PIPE_VECTORS);
+  }
+  zc->pipe_pos = zc->pipe_ofs = 0;
+  zc->workUsed = 0;
+  if (zc->unpack_compression == COMPRESSION_ZLIB) {
+    int have = 0;
+    zc->zstream.next_in = (void *)data;
+    zc->zstream.avail_in = size;
+    zc->zstream.total_in = 0;
+    for (;;) {
+      int res, got, used;
+      zc->zstream.next_out = (void *)(zc->work+have);
+      zc->zstream.avail_out = zc->worksize-have;
+      zc->zstream.total_out = 0;
+      ZMBV_TRACE_BEGIN(ttime);
+      stime = zmbv_nsecs();
+      res = mz_inflate(&zc->zstream, MZ_SYNC_FLUSH);
+      zc->dcur.inflate_ns += zmbv_nsecs()-stime;
+      ZMBV_TRACE_END(ZMBV_TRACE_INFLATE, (int)zc->dstats.total.frames, ttime);
+      if (res != MZ_OK && res != MZ_BUF_ERROR) return -1;
+      got = (int)zc->zstream.total_out;
+      have += got;
+      zc->workUsed += got;
+      ZMBV_TRACE_BEGIN(rtime);
+      used = zmbv_pipe_consume(zc, unxor, tag, zc->work, have);
+      ZMBV_TRACE_END(ZMBV_TRACE_REBUILD, (int)zc->dstats.total.frames, rtime);
+      if (used > 0 && used < have) memmove(zc->work, zc->work+used, have-used);
+      have -= used;
+      /* all input eaten and all output flushed? */
+      if (zc->zstream.avail_in == 0 && zc->zstream.avail_out != 0) break;
+      if (got == 0 && used == 0) return -1; /* no progress */
+    }
+  } else {
+    /* no need to copy uncompressed data anywhere */
+    ZMBV_TRACE_BEGIN(rtime);
+    zmbv_pipe_consume(zc, unxor, tag, data, size);
+    ZMBV_TRACE_END(ZMBV_TRACE_REBUILD, (int)zc->dstats.total.frames, rtime);
+    zc->workUsed = size;
+  }
+  if (zc->pipe_state != ZMBV_PIPE_DONE) return -1;
+  if ((tag&FRAME_MASK_KEYFRAME) == 0) zmbv_count_blocks(zc, zc->vectors);
+  return 0;
+}
+#endif
+
+
 /******************************************************************************/
 int zmbv_decode_frame (zmbv_codec_t zc, const void *framedata, int size) {
   if (zc != NULL && framedata != NULL && size > 1 && zc->mode == ZMBV_MODE_DECODER) {
     uint8_t tag;
     const uint8_t *data = (const uint8_t *)framedata;
+    uint64_t stime;
+    memset(&zc->dcur, 0, sizeof(zc->dcur));
     tag = *data++;
     if (tag > 2) return -1; /* for now we can have only 0, 1 or 2 in tag byte */
     if (--size <= 0) return -1;
@@ -705,26 +1553,35 @@ int zmbv_decode_frame (zmbv_codec_t zc, const void *framedata, int size) {
       if (size <= 0) return -1;
       if (header->low_version != DBZV_VERSION_LOW || header->high_version != DBZV_VERSION_HIGH) return -1;
       if (header->compression > COMPRESSION_ZLIB) return -1; /* invalid compression mode */
-      if (zc->format != (zmbv_format_t)header->format && zmbv_setup_buffers(zc, (zmbv_format_t)header->format, header->blockwidth, header->blockheight) < 0) return -1;
+      if (header->blockwidth == 0 || header->blockheight == 0) return -1;
+      if (zc->format != (zmbv_format_t)header->format || zc->blockwidth != header->blockwidth || zc->blockheight != header->blockheight) {
+        if (zmbv_setup_buffers(zc, (zmbv_format_t)header->format, header->blockwidth, header->blockheight) < 0) return -1;
+      }
       zc->unpack_compression = header->compression;
       if (zc->unpack_compression == COMPRESSION_ZLIB) {
-        if (mz_inflateReset(&zc->zstream) != MZ_OK) return -1;
+        if (zmbv_inflate_reset(zc) < 0) return -1;
       }
     }
     if (size > zc->bufsize) return -1; /* frame too big */
+    zc->dcur.packed_bytes = size;
+    stime = zmbv_nsecs();
+#ifndef ZMBV_USE_TINFL
+    if (zc->pipe_chunk > 0) {
+      if (zmbv_decode_frame_pipelined(zc, tag, data, size) < 0) return -1;
+      return zmbv_decode_done(zc, tag, stime);
+    }
+#endif
+    ZMBV_TRACE_BEGIN(ttime);
     if (zc->unpack_compression == COMPRESSION_ZLIB) {
-      zc->zstream.next_in = (void *)data;
-      zc->zstream.avail_in = size;
-      zc->zstream.total_in = 0;
-      zc->zstream.next_out = (void *)zc->work;
-      zc->zstream.avail_out = zc->bufsize;
-      zc->zstream.total_out = 0;
-      if (mz_inflate(&zc->zstream, MZ_SYNC_FLUSH/*MZ_NO_FLUSH*/) != MZ_OK) return -1; /* the thing that should not be */
-      zc->workUsed = zc->zstream.total_out;
+      zc->workUsed = zmbv_inflate_frame(zc, data, size);
+      if (zc->workUsed < 0) return -1;
     } else {
       if (size > 0) memcpy(zc->work, data, size);
       zc->workUsed = size;
     }
+    ZMBV_TRACE_END(ZMBV_TRACE_INFLATE, (int)zc->dstats.total.frames, ttime);
+    zc->dcur.inflate_ns = zmbv_nsecs()-stime;
+    ZMBV_TRACE_BEGIN(rtime);
     zc->workPos = 0;
     if (tag&FRAME_MASK_KEYFRAME) {
       if (zc->palsize) {
@@ -753,14 +1610,19 @@ int zmbv_decode_frame (zmbv_codec_t zc, const void *framedata, int size) {
           zc->palette[i*3+2] ^= zc->work[zc->workPos++];
         }
       }
+      zmbv_unxor_blocks_fn unxor;
       switch (zc->format) {
-        case ZMBV_FORMAT_8BPP: zmbv_unxor_frame_8(zc); break;
-        case ZMBV_FORMAT_15BPP: case ZMBV_FORMAT_16BPP: zmbv_unxor_frame_16(zc); break;
-        case ZMBV_FORMAT_32BPP: zmbv_unxor_frame_32(zc); break;
+        case ZMBV_FORMAT_8BPP: unxor = zmbv_unxor_blocks_8; break;
+        case ZMBV_FORMAT_15BPP: case ZMBV_FORMAT_16BPP: unxor = zmbv_unxor_blocks_16; break;
+        case ZMBV_FORMAT_32BPP: unxor = zmbv_unxor_blocks_32; break;
         default: return -1; /* the thing that should not be */
       }
+      const int8_t *vectors = (const int8_t *)&zc->work[zc->workPos];
+      if (zmbv_unxor_frame(zc, unxor) < 0) return -1;
+      zmbv_count_blocks(zc, vectors);
     }
-    return 0;
+    ZMBV_TRACE_END(ZMBV_TRACE_REBUILD, (int)zc->dstats.total.frames, rtime);
+    return zmbv_decode_done(zc, tag, stime);
   }
   return -1;
 }
@@ -25,6 +25,8 @@ extern "C" {
 
 #include <stdint.h>
 
+#include "zmbv_alloc.h"
+
 typedef enum {
   ZMBV_FORMAT_NONE  = 0x00,
   /*ZMBV_FORMAT_1BPP  = 0x01,*/
@@ -62,8 +64,15 @@ enum {
   ZMBV_DEFAULT_COMPRESSION = -1 /* level 4 */
 };
 
-extern zmbv_codec_t zmbv_codec_new (zmvb_init_flags_t flags, int complevel);
+/* `alloc` is used for the codec, its buffers, zlib streams and decoder state snapshots; NULL: stdlib */
+/* returns NULL on error */
+extern zmbv_codec_t zmbv_codec_new (zmvb_init_flags_t flags, int complevel, const zmbv_allocator_t *alloc);
 extern void zmbv_codec_free (zmbv_codec_t zc);
+/* allocate buffers for `fmt` frames right after zmbv_encode_setup() or zmbv_decode_setup(), */
+/* so the first frame doesn't have to; that frame still sets the format up and is a keyframe */
+/* setting up a codec again keeps its buffers and resets zlib instead of recreating it */
+/* return <0 on error; 0 on ok */
+extern int zmbv_codec_reserve (zmbv_codec_t zc, zmbv_format_t fmt);
 
 
 typedef enum {
@@ -83,27 +92,123 @@ static inline int zmbv_encode_line (zmbv_codec_t zc, const void *line_data) { re
 /* return # of bytes written in outbuf or <0 on error; NEVER returns 0 */
 extern int zmvb_encode_finish_frame (zmbv_codec_t zc);
 
+/* motion vectors go from -ZMBV_VECTOR_RANGE to ZMBV_VECTOR_RANGE on both axes */
+#define ZMBV_VECTOR_RANGE  (10)
+#define ZMBV_VECTOR_SPAN   (2*ZMBV_VECTOR_RANGE+1)
+
+/* block size, 8..255 pixels each way; 0: 16 (the default, what DOSBox writes) */
+/* a change starts with the next frame, which is made a keyframe */
+/* zmbv_work_buffer_size() is big enough for any block size */
+/* return <0 on error; 0 on ok */
+extern int zmbv_encode_set_block_size (zmbv_codec_t zc, int width, int height);
+/* motion search effort: try vectors up to `range` pixels away (0..ZMBV_VECTOR_RANGE; */
+/* 0: only check if the block has changed), doing a full compare for at most `candidates` */
+/* of them that look promising; <0 range and <=0 candidates: defaults (ZMBV_VECTOR_RANGE, 64) */
+/* return <0 on error; 0 on ok */
+extern int zmbv_encode_set_search (zmbv_codec_t zc, int range, int candidates);
+
+typedef struct {
+  uint64_t frames;
+  uint64_t keyframes;
+  /* interframe blocks: vector 0,0 and no change; moved with no change; xor-coded */
+  uint64_t blocks_same;
+  uint64_t blocks_moved;
+  uint64_t blocks_xor;
+  uint64_t compares; /* full block compares done by the motion search */
+  uint64_t probes; /* sampled (every 4th pixel of every 4th row) compares */
+  uint64_t raw_bytes; /* bytes handed to deflate: palette, block info, xor data or keyframe pixels */
+  uint64_t xor_bytes; /* xor data part of raw_bytes */
+  uint64_t packed_bytes; /* deflate output (raw_bytes with ZMBV_INIT_FLAG_NOZLIB) */
+  /* time spent copying lines in, searching vectors and building xor data, and deflating */
+  uint64_t copy_ns;
+  uint64_t search_ns;
+  uint64_t deflate_ns;
+  /* chosen vectors of interframe blocks; [(vy+ZMBV_VECTOR_RANGE)*ZMBV_VECTOR_SPAN+vx+ZMBV_VECTOR_RANGE] */
+  uint64_t vectors[ZMBV_VECTOR_SPAN*ZMBV_VECTOR_SPAN];
+} zmbv_encode_counters_t;
+
+typedef struct {
+  zmbv_encode_counters_t last; /* last finished frame */
+  zmbv_encode_counters_t total; /* all frames since zmbv_encode_setup() */
+} zmbv_encode_stats_t;
+
+/* return <0 on error; 0 on ok */
+extern int zmbv_encode_get_stats (zmbv_codec_t zc, zmbv_encode_stats_t *stats);
+
 
 #ifdef ZMBV_INCLUDE_DECODER
 /* return <0 on error; 0 on ok */
 extern int zmbv_decode_setup (zmbv_codec_t zc, int width, int height);
+/* rebuild interframes with up to `count` threads working on separate row bands */
+/* 0 or 1: no threads; counts >1 need the library to be built with ZMBV_USE_THREADS */
+/* return <0 on error; 0 on ok */
+extern int zmbv_decode_set_threads (zmbv_codec_t zc, int count);
+/* inflate frames `chunksize` bytes at a time and rebuild every piece as soon as its data is */
+/* there; the work buffer shrinks to about one chunk; 0 turns it off (the default) */
+/* call this after zmbv_decode_setup(); band threads are not used in this mode */
+/* return <0 on error; 0 on ok */
+extern int zmbv_decode_set_pipelined (zmbv_codec_t zc, int chunksize);
 /* return <0 on error; 0 on ok */
 extern int zmbv_decode_frame (zmbv_codec_t zc, const void *framedata, int size);
 /* return !0 if palette was be changed on this frame */
 extern int zmbv_decode_is_palette_changed (zmbv_codec_t zc, const void *framedata, int size);
 
+typedef struct {
+  uint64_t frames;
+  uint64_t keyframes;
+  uint64_t palette_updates; /* frames that brought a palette or palette changes */
+  /* interframe blocks: just copied from the old frame; xored with frame data */
+  uint64_t blocks_copy;
+  uint64_t blocks_xor;
+  uint64_t packed_bytes; /* frame data after the frame header */
+  uint64_t raw_bytes; /* frame data after inflate */
+  /* time spent inflating, and rebuilding the frame from inflated data */
+  uint64_t inflate_ns;
+  uint64_t rebuild_ns;
+} zmbv_decode_counters_t;
+
+typedef struct {
+  zmbv_decode_counters_t last; /* last decoded frame */
+  zmbv_decode_counters_t total; /* all frames since zmbv_decode_setup() */
+} zmbv_decode_stats_t;
+
+/* return <0 on error; 0 on ok */
+extern int zmbv_decode_get_stats (zmbv_codec_t zc, zmbv_decode_stats_t *stats);
+/* called at the end of every successful zmbv_decode_frame() with the counters of that frame */
+typedef void (*zmbv_decode_stats_cb) (zmbv_codec_t zc, const zmbv_decode_counters_t *frame, void *udata);
+/* `cb` NULL: no callback (the default) */
+/* return <0 on error; 0 on ok */
+extern int zmbv_decode_set_stats_callback (zmbv_codec_t zc, zmbv_decode_stats_cb cb, void *udata);
+
 /* this can be called after zmbv_decode_frame() */
 extern const uint8_t *zmbv_get_palette (zmbv_codec_t zc);
 /* this can be called after zmbv_decode_frame() */
+/* lines start at 64-byte aligned addresses, and so does every row of the internal frame buffers */
 extern const void *zmbv_get_decoded_line (zmbv_codec_t zc, int idx) ;
 /* this can be called after zmbv_decode_frame() */
 extern zmbv_format_t zmbv_get_decoded_format (zmbv_codec_t zc);
+
+/* decoder state snapshot: current frame, palette and inflater state */
+/* restoring it lets decoding continue right after the frame it was taken at */
+typedef struct zmbv_decode_state_s *zmbv_decode_state_t;
+
+/* this can be called after zmbv_decode_frame(); returns NULL on error */
+extern zmbv_decode_state_t zmbv_decode_state_save (zmbv_codec_t zc);
+/* codec should be set up for decoding with the same width and height; */
+/* a snapshot of another frame size is refused */
+/* return <0 on error; 0 on ok */
+extern int zmbv_decode_state_restore (zmbv_codec_t zc, zmbv_decode_state_t st);
+extern void zmbv_decode_state_free (zmbv_decode_state_t st);
+/* approximate number of bytes the snapshot occupies; <0 on error */
+extern int zmbv_decode_state_memory (zmbv_decode_state_t st);
 #endif
 
 
 /* <0: error; 0: never */
 extern int zmbv_get_width (zmbv_codec_t zc);
 extern int zmbv_get_height (zmbv_codec_t zc);
+/* format of the last encoded or decoded frame; ZMBV_FORMAT_NONE right after setup */
+extern zmbv_format_t zmbv_get_frame_format (zmbv_codec_t zc);
 
 
 #ifdef __cplusplus
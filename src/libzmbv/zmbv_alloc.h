@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#ifndef ZMBVC_ALLOC_H
+#define ZMBVC_ALLOC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+
+/* memory callbacks for codec, its deflate/inflate streams and AVI writer; */
+/* passing NULL instead of a pointer to this uses malloc()/realloc()/free() */
+/* the struct is copied, `udata` is passed to every call; all three functions must be set */
+/* zlib/miniz streams call them from the thread that runs the codec */
+typedef struct {
+  void *(*alloc) (void *udata, size_t size);
+  void *(*realloc) (void *udata, void *ptr, size_t size);
+  void (*free) (void *udata, void *ptr);
+  void *udata;
+} zmbv_allocator_t;
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
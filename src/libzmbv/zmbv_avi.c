@@ -16,8 +16,14 @@
  *
  * C translation by Ketmar // Invisible Vector
  */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* for fallocate() */
+#define _GNU_SOURCE
+#endif
 #include "zmbv_avi.h"
+#include "zmbv_trace.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -25,8 +31,23 @@
 #include <string.h>
 #ifndef _MSC_VER
 #include <unistd.h>
+#include <sys/uio.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <time.h>
 #endif
 #include <math.h>
+#ifdef ZMBV_USE_THREADS
+#include <pthread.h>
+#endif
+#ifdef ZMBV_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -39,7 +60,47 @@
 #define O_BINARY 0
 #endif
 
-#define AVI_HEADER_SIZE  (500)
+
+/* OpenDML: streams with standard indexes, super index entries per stream */
+#define AVI_STREAMS      (2)
+#define AVI_INDX_ENTRIES (256)
+/* more room for checkpoint writers, and entries kept for closing RIFFs */
+#define AVI_INDX_ENTRIES_CKPT (4096)
+#define AVI_INDX_RESERVE (64)
+#define AVI_INDX_SIZE(n) (24+16*(n))
+/* fixed header part is 600 bytes, rounded up to 1KB */
+#define AVI_HEADER_SIZE(n) ((600+2*(8+AVI_INDX_SIZE(n))+1023)&~1023)
+/* RIFF segment size limit; the first one stays readable by AVI 1.0 players */
+#define AVI_RIFF_LIMIT   (1024*1024*1024)
+#define AVI_MAX_CHUNK    (256*1024*1024)
+
+#ifdef _MSC_VER
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#endif
+
+/* max async queue depth */
+#define AVI_MAX_QUEUE    (1024)
+
+/* max io_uring write buffers */
+#define AVI_MAX_URING    (64)
+/* io_uring user_data for writes not from a write buffer */
+#define AVI_URING_NOSLOT (0xffffffffu)
+
+/* idx1 entries are collected in blocks of this size */
+#define AVI_IDX_BLOCK    (16*4096)
+
+/* page cache is dropped this far behind the write position */
+#define AVI_DROP_WINDOW  (8*1024*1024)
+
+/* preallocation step is rounded up to this */
+#define AVI_PREALLOC_MIN (1024*1024)
+
+/* default flush policy */
+#define AVI_WBUF_SIZE    (256*1024)
+#define AVI_WBUF_MSECS   (0)
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 # define HTOBE32(x) __builtin_bswap32(x)
@@ -65,197 +126,1397 @@
 #define CODEC_4CC "ZMBV"
 
 
+#ifdef ZMBV_USE_THREADS
+typedef struct {
+  uint8_t *data;
+  uint32_t size, alloted;
+} zmbv_avi_qitem_t;
+#endif
+
+
+/* standard index (ix##) entry */
+typedef struct {
+  uint32_t offset;
+  uint32_t size;
+} zmbv_avi_ixentry_t;
+
+/* super index (indx) entry */
+typedef struct {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t duration;
+} zmbv_avi_superentry_t;
+
+typedef struct {
+  char tag[4];
+  zmbv_avi_ixentry_t *ix; /* entries of the current RIFF */
+  uint32_t ixused, ixsize;
+  uint32_t ixdone; /* entries already written in ix## chunks by checkpoints */
+  uint32_t ixduration; /* frames or samples of entries not written yet */
+  uint32_t segduration; /* frames or samples of all entries of the current RIFF */
+  zmbv_avi_superentry_t *super;
+  int superused;
+  int segsuper; /* first super index entry of the current RIFF */
+} zmbv_avi_stream_t;
+
+/* idx1 arena block; blocks are linked and never moved */
+typedef struct zmbv_avi_idxblock_s {
+  struct zmbv_avi_idxblock_s *next;
+  uint32_t used;
+  uint8_t data[AVI_IDX_BLOCK];
+} zmbv_avi_idxblock_t;
+
+typedef struct {
+  uint64_t offset; /* of RIFF header */
+  uint32_t riffsize;
+  uint32_t movisize;
+} zmbv_avi_segment_t;
+
+
 typedef struct zmbv_avi_s *zmbv_avi_t;
 
 struct zmbv_avi_s {
   int fd;
-  uint8_t *index;
-  uint32_t indexsize, indexused;
+  zmbv_allocator_t alloc; /* all NULL: stdlib */
+  /* idx1 entries; with a spill file only the last block stays in memory */
+  zmbv_avi_idxblock_t *idxhead, *idxtail;
+  uint32_t indexbytes; /* all idx1 entries, spilled ones included */
+  int spillfd; /* <0: no spill file */
+  char *spillname;
   uint32_t width, height;
   double fps;
   uint32_t frames;
-  uint32_t written;
-  //uint32_t audioused; // always 0 for now
-  uint32_t audiowritten;
+  uint32_t firstframes; /* in the first RIFF */
+  uint32_t written; /* in movi list of the current RIFF */
+  uint64_t filepos; /* where the next byte goes */
+  uint64_t segstart; /* current RIFF offset */
+  zmbv_avi_segment_t *segs;
+  int segcount, segsize;
+  uint32_t hdrsize; /* reserved for header */
+  int indxentries; /* super index room per stream */
+  int ckpt_frames; /* checkpoint every this many frames; 0: off */
+  int ckpt_sync; /* fsync every this many checkpoints; 0: never */
+  uint32_t ckpt_next; /* frame number for the next checkpoint */
+  int ckpt_count;
+  zmbv_avi_stream_t streams[AVI_STREAMS];
+  uint64_t audiowritten; /* bytes */
   uint32_t audiorate; // 44100?
+  int audiochannels, audiobits, audioalign; /* align: bytes per sample frame */
+  /* audio is collected here and written as one chunk every `audiointerleave` video frames */
+  uint8_t *audiobuf;
+  uint32_t audiobufsize, audioused;
+  int audiointerleave; /* 0: write right away */
+  uint32_t audioframe; /* video frame count at the last audio chunk */
   int was_file_error;
+  /* chunks are collected here and written out with one syscall */
+  uint8_t *wbuf;
+  uint32_t wbufsize, wbufused;
+  int flush_msecs; /* 0: no time limit */
+  uint64_t wbuftime; /* when the first byte got into the buffer */
+  /* extent and page cache policy */
+  uint64_t prealloc; /* preallocation step; 0: off */
+  uint64_t allocated; /* file space reserved up to here */
+  int dropcache;
+  uint64_t advised; /* writeback was started up to here */
+  uint64_t dropped; /* page cache was dropped up to here */
+#ifdef ZMBV_USE_THREADS
+  /* async mode: output goes through a ring of buffers to the writer thread */
+  int async;
+  pthread_t iothread;
+  pthread_mutex_t qlock;
+  pthread_cond_t qnotempty, qnotfull;
+  zmbv_avi_qitem_t *queue;
+  int qsize, qhead, qcount; /* writer thread owns queue[qhead] while it is counted */
+  int qstop, qerror;
+  int qmaxcount;
+  uint64_t qbytes; /* bytes in queue */
+  uint64_t qwaits; /* times producer had to wait for a free slot */
+#endif
+#ifdef ZMBV_USE_IO_URING
+  /* io_uring mode: write buffers are registered with the ring and written at explicit offsets */
+  int uring; /* ring fd; <0: not in io_uring mode */
+  int uring_error;
+  uint8_t **slots; /* registered write buffers; wbuf is one of them */
+  uint8_t *slotbusy;
+  int nslots, curslot, inflight;
+  off_t outpos; /* file offset for the next write */
+  void *sqring, *cqring;
+  size_t sqringsize, cqringsize;
+  struct io_uring_sqe *sqes;
+  size_t sqessize;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe *cqes;
+#endif
 };
 
 
-zmbv_avi_t zmbv_avi_start (const char *fname, int width, int height, double fps, int audiorate) {
+/******************************************************************************/
+static void *zmbv_avi_malloc (zmbv_avi_t zavi, size_t size) {
+  return (zavi->alloc.alloc != NULL ? zavi->alloc.alloc(zavi->alloc.udata, size) : malloc(size));
+}
+
+
+static void *zmbv_avi_calloc (zmbv_avi_t zavi, size_t count, size_t size) {
+  void *res;
+  if (zavi->alloc.alloc == NULL) return calloc(count, size);
+  if (size != 0 && count > (size_t)-1/size) return NULL;
+  if ((res = zavi->alloc.alloc(zavi->alloc.udata, count*size)) != NULL) memset(res, 0, count*size);
+  return res;
+}
+
+
+static void *zmbv_avi_realloc (zmbv_avi_t zavi, void *ptr, size_t size) {
+  return (zavi->alloc.realloc != NULL ? zavi->alloc.realloc(zavi->alloc.udata, ptr, size) : realloc(ptr, size));
+}
+
+
+static void zmbv_avi_free (zmbv_avi_t zavi, void *ptr) {
+  if (zavi->alloc.free != NULL) zavi->alloc.free(zavi->alloc.udata, ptr); else free(ptr);
+}
+
+
+static char *zmbv_avi_strdup (zmbv_avi_t zavi, const char *str) {
+  size_t len = strlen(str)+1;
+  char *res = zmbv_avi_malloc(zavi, len);
+  if (res != NULL) memcpy(res, str, len);
+  return res;
+}
+
+
+/******************************************************************************/
+static uint64_t zmbv_avi_msecs (void) {
+#ifdef _WIN32
+  return GetTickCount64();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+#endif
+}
+
+
+/* writes everything, retrying on partial writes */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_writev (int fd, struct iovec *iov, int iovcnt) {
+  ZMBV_TRACE_BEGIN(ttime);
+  while (iovcnt > 0) {
+#ifndef _MSC_VER
+    ssize_t wr = writev(fd, iov, iovcnt);
+#else
+    ssize_t wr = write(fd, iov[0].iov_base, iov[0].iov_len);
+#endif
+    if (wr < 0) return -1;
+    while (iovcnt > 0 && (size_t)wr >= iov->iov_len) {
+      wr -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base+wr;
+      iov->iov_len -= wr;
+    }
+  }
+  ZMBV_TRACE_END(ZMBV_TRACE_AVI_WRITE, -1, ttime);
+  return 0;
+}
+
+
+/******************************************************************************/
+#ifdef ZMBV_USE_THREADS
+static void *zmbv_avi_io_thread (void *arg) {
+  zmbv_avi_t zavi = (zmbv_avi_t)arg;
+  pthread_mutex_lock(&zavi->qlock);
+  for (;;) {
+    zmbv_avi_qitem_t *it;
+    int failed;
+    while (zavi->qcount == 0 && !zavi->qstop) pthread_cond_wait(&zavi->qnotempty, &zavi->qlock);
+    if (zavi->qcount == 0) break;
+    it = &zavi->queue[zavi->qhead];
+    failed = zavi->qerror;
+    pthread_mutex_unlock(&zavi->qlock);
+    if (!failed) {
+      struct iovec iov;
+      iov.iov_base = it->data;
+      iov.iov_len = it->size;
+      failed = (zmbv_avi_writev(zavi->fd, &iov, 1) < 0);
+    }
+    pthread_mutex_lock(&zavi->qlock);
+    if (failed) zavi->qerror = 1;
+    zavi->qbytes -= it->size;
+    zavi->qhead = (zavi->qhead+1)%zavi->qsize;
+    --zavi->qcount;
+    pthread_cond_signal(&zavi->qnotfull);
+  }
+  pthread_mutex_unlock(&zavi->qlock);
+  return NULL;
+}
+
+
+/* waits for a free slot; returns NULL if the writer thread failed */
+static zmbv_avi_qitem_t *zmbv_avi_queue_reserve (zmbv_avi_t zavi) {
+  zmbv_avi_qitem_t *it = NULL;
+  pthread_mutex_lock(&zavi->qlock);
+  if (zavi->qcount == zavi->qsize && !zavi->qerror) {
+    ZMBV_TRACE_BEGIN(ttime);
+    ++zavi->qwaits;
+    while (zavi->qcount == zavi->qsize && !zavi->qerror) pthread_cond_wait(&zavi->qnotfull, &zavi->qlock);
+    ZMBV_TRACE_END(ZMBV_TRACE_QUEUE_WAIT, (int)zavi->frames, ttime);
+  }
+  if (!zavi->qerror) it = &zavi->queue[(zavi->qhead+zavi->qcount)%zavi->qsize];
+  pthread_mutex_unlock(&zavi->qlock);
+  return it;
+}
+
+
+static void zmbv_avi_queue_commit (zmbv_avi_t zavi, zmbv_avi_qitem_t *it) {
+  pthread_mutex_lock(&zavi->qlock);
+  zavi->qbytes += it->size;
+  if (++zavi->qcount > zavi->qmaxcount) zavi->qmaxcount = zavi->qcount;
+  pthread_cond_signal(&zavi->qnotempty);
+  pthread_mutex_unlock(&zavi->qlock);
+}
+
+
+/* copy data into the next queue slot */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_queue_put (zmbv_avi_t zavi, const struct iovec *iov, int iovcnt) {
+  zmbv_avi_qitem_t *it = zmbv_avi_queue_reserve(zavi);
+  uint32_t size = 0;
+  if (it == NULL) return -1;
+  for (int f = 0; f < iovcnt; ++f) size += iov[f].iov_len;
+  if (size > it->alloted) {
+    uint8_t *nb = zmbv_avi_realloc(zavi, it->data, size);
+    if (nb == NULL) return -1;
+    it->data = nb;
+    it->alloted = size;
+  }
+  it->size = 0;
+  for (int f = 0; f < iovcnt; ++f) {
+    memcpy(it->data+it->size, iov[f].iov_base, iov[f].iov_len);
+    it->size += iov[f].iov_len;
+  }
+  zmbv_avi_queue_commit(zavi, it);
+  return 0;
+}
+
+
+/* return !0 if the writer thread failed */
+static int zmbv_avi_async_failed (zmbv_avi_t zavi) {
+  int res = 0;
+  if (zavi->async) {
+    pthread_mutex_lock(&zavi->qlock);
+    res = zavi->qerror;
+    pthread_mutex_unlock(&zavi->qlock);
+  }
+  return res;
+}
+
+
+/* drain the queue and stop the writer thread */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_async_stop (zmbv_avi_t zavi) {
+  int res = 0;
+  if (zavi->async) {
+    pthread_mutex_lock(&zavi->qlock);
+    zavi->qstop = 1;
+    pthread_cond_signal(&zavi->qnotempty);
+    pthread_mutex_unlock(&zavi->qlock);
+    pthread_join(zavi->iothread, NULL);
+    res = (zavi->qerror ? -1 : 0);
+    for (int f = 0; f < zavi->qsize; ++f) if (zavi->queue[f].data != NULL) zmbv_avi_free(zavi, zavi->queue[f].data);
+    zmbv_avi_free(zavi, zavi->queue);
+    zavi->queue = NULL;
+    pthread_cond_destroy(&zavi->qnotfull);
+    pthread_cond_destroy(&zavi->qnotempty);
+    pthread_mutex_destroy(&zavi->qlock);
+    zavi->async = 0;
+  }
+  return res;
+}
+#endif
+
+
+/******************************************************************************/
+#ifdef ZMBV_USE_IO_URING
+static int zmbv_avi_uring_enter (int fd, unsigned submit, unsigned wait) {
+  int res;
+  do {
+    res = syscall(__NR_io_uring_enter, fd, submit, wait, (wait ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+  } while (res < 0 && errno == EINTR);
+  return res;
+}
+
+
+/* process finished writes; `wait`: block until at least this many arrived */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_uring_reap (zmbv_avi_t zavi, unsigned wait) {
+  if (wait > 0 && zmbv_avi_uring_enter(zavi->uring, 0, wait) < 0) { zavi->uring_error = 1; return -1; }
+  for (;;) {
+    unsigned head = *zavi->cqhead;
+    if (head == __atomic_load_n(zavi->cqtail, __ATOMIC_ACQUIRE)) break;
+    const struct io_uring_cqe *cqe = &zavi->cqes[head&*zavi->cqmask];
+    uint32_t slot = (uint32_t)cqe->user_data;
+    /* expected length is in the high half of user_data */
+    if (cqe->res < 0 || (uint32_t)cqe->res != (uint32_t)(cqe->user_data>>32)) zavi->uring_error = 1;
+    if (slot != AVI_URING_NOSLOT) zavi->slotbusy[slot] = 0;
+    --zavi->inflight;
+    __atomic_store_n(zavi->cqhead, head+1, __ATOMIC_RELEASE);
+  }
+  return (zavi->uring_error ? -1 : 0);
+}
+
+
+/* queue one write; it will be linked to the next one if `link` is set */
+static void zmbv_avi_uring_prep (zmbv_avi_t zavi, const void *buf, uint32_t len, int slot, int link) {
+  unsigned tail = *zavi->sqtail;
+  unsigned idx = tail&*zavi->sqmask;
+  struct io_uring_sqe *sqe = &zavi->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = (slot >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+  sqe->flags = (link ? IOSQE_IO_LINK : 0);
+  sqe->fd = zavi->fd;
+  sqe->off = zavi->outpos;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  if (slot >= 0) sqe->buf_index = slot;
+  sqe->user_data = ((uint64_t)len<<32)|(slot >= 0 ? (uint32_t)slot : AVI_URING_NOSLOT);
+  zavi->sqarray[idx] = idx;
+  __atomic_store_n(zavi->sqtail, tail+1, __ATOMIC_RELEASE);
+  zavi->outpos += len;
+  ++zavi->inflight;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_uring_submit (zmbv_avi_t zavi, unsigned count) {
+  while (count > 0) {
+    int res = zmbv_avi_uring_enter(zavi->uring, count, 0);
+    if (res <= 0) { zavi->uring_error = 1; return -1; }
+    count -= res;
+  }
+  return 0;
+}
+
+
+/* submit current write buffer and switch to a free one */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_uring_flush (zmbv_avi_t zavi) {
+  int next = -1;
+  if (zmbv_avi_uring_reap(zavi, 0) < 0) return -1;
+  zavi->slotbusy[zavi->curslot] = 1;
+  zmbv_avi_uring_prep(zavi, zavi->wbuf, zavi->wbufused, zavi->curslot, 0);
+  zavi->wbufused = 0;
+  if (zmbv_avi_uring_submit(zavi, 1) < 0) return -1;
+  while (next < 0) {
+    for (int f = 1; f <= zavi->nslots; ++f) {
+      int n = (zavi->curslot+f)%zavi->nslots;
+      if (!zavi->slotbusy[n]) { next = n; break; }
+    }
+    if (next < 0 && zmbv_avi_uring_reap(zavi, 1) < 0) return -1;
+  }
+  zavi->curslot = next;
+  zavi->wbuf = zavi->slots[next];
+  return 0;
+}
+
+
+/* write buffered data and caller memory as a linked chain, and wait for it */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_uring_writev (zmbv_avi_t zavi, const struct iovec *iov, int iovcnt) {
+  if (zmbv_avi_uring_reap(zavi, 0) < 0) return -1;
+  for (int f = 0; f < iovcnt; ++f) {
+    int slot = (iov[f].iov_base == zavi->wbuf ? zavi->curslot : -1);
+    zmbv_avi_uring_prep(zavi, iov[f].iov_base, iov[f].iov_len, slot, (f+1 < iovcnt));
+  }
+  if (zmbv_avi_uring_submit(zavi, iovcnt) < 0) return -1;
+  /* caller memory should stay valid until the writes are done */
+  while (zavi->inflight > 0) if (zmbv_avi_uring_reap(zavi, 1) < 0) return -1;
+  return 0;
+}
+
+
+/* wait for all writes, tear down the ring and go back to write() */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_uring_stop (zmbv_avi_t zavi) {
+  int res = 0;
+  if (zavi->uring >= 0) {
+    while (zavi->inflight > 0 && res == 0) res = zmbv_avi_uring_reap(zavi, 1);
+    if (zavi->uring_error) res = -1;
+    if (res == 0 && lseek(zavi->fd, zavi->outpos, SEEK_SET) == (off_t)-1) res = -1;
+    if (zavi->sqes != NULL) munmap(zavi->sqes, zavi->sqessize);
+    if (zavi->cqring != NULL && zavi->cqring != zavi->sqring) munmap(zavi->cqring, zavi->cqringsize);
+    if (zavi->sqring != NULL) munmap(zavi->sqring, zavi->sqringsize);
+    close(zavi->uring);
+    /* keep the current buffer as the write buffer */
+    for (int f = 0; f < zavi->nslots; ++f) if (zavi->slots[f] != zavi->wbuf) zmbv_avi_free(zavi, zavi->slots[f]);
+    zmbv_avi_free(zavi, zavi->slots);
+    zmbv_avi_free(zavi, zavi->slotbusy);
+    zavi->slots = NULL;
+    zavi->slotbusy = NULL;
+    zavi->sqes = NULL;
+    zavi->sqring = zavi->cqring = NULL;
+    zavi->nslots = zavi->inflight = 0;
+    zavi->uring = -1;
+    if (res < 0) zavi->was_file_error = 1;
+  }
+  return res;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_uring_start (zmbv_avi_t zavi, int depth) {
+  struct io_uring_params p;
+  struct iovec iov[AVI_MAX_URING];
+  uint8_t *sq, *cq;
+  zavi->outpos = lseek(zavi->fd, 0, SEEK_CUR);
+  if (zavi->outpos == (off_t)-1) return -1;
+  memset(&p, 0, sizeof(p));
+  /* one buffer write or one linked chunk (4 writes) per buffer */
+  zavi->uring = syscall(__NR_io_uring_setup, depth*4, &p);
+  if (zavi->uring < 0) { zavi->uring = -1; return -1; }
+  zavi->inflight = 0;
+  zavi->uring_error = 0;
+  zavi->sqringsize = p.sq_off.array+p.sq_entries*sizeof(unsigned);
+  zavi->cqringsize = p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features&IORING_FEAT_SINGLE_MMAP) {
+    if (zavi->cqringsize > zavi->sqringsize) zavi->sqringsize = zavi->cqringsize;
+    zavi->cqringsize = zavi->sqringsize;
+  }
+  zavi->sqring = mmap(NULL, zavi->sqringsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, zavi->uring, IORING_OFF_SQ_RING);
+  if (zavi->sqring == MAP_FAILED) { zavi->sqring = NULL; goto error; }
+  if (p.features&IORING_FEAT_SINGLE_MMAP) {
+    zavi->cqring = zavi->sqring;
+  } else {
+    zavi->cqring = mmap(NULL, zavi->cqringsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, zavi->uring, IORING_OFF_CQ_RING);
+    if (zavi->cqring == MAP_FAILED) { zavi->cqring = NULL; goto error; }
+  }
+  zavi->sqessize = p.sq_entries*sizeof(struct io_uring_sqe);
+  zavi->sqes = mmap(NULL, zavi->sqessize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, zavi->uring, IORING_OFF_SQES);
+  if (zavi->sqes == MAP_FAILED) { zavi->sqes = NULL; goto error; }
+  sq = (uint8_t *)zavi->sqring;
+  cq = (uint8_t *)zavi->cqring;
+  zavi->sqhead = (unsigned *)(sq+p.sq_off.head);
+  zavi->sqtail = (unsigned *)(sq+p.sq_off.tail);
+  zavi->sqmask = (unsigned *)(sq+p.sq_off.ring_mask);
+  zavi->sqarray = (unsigned *)(sq+p.sq_off.array);
+  zavi->cqhead = (unsigned *)(cq+p.cq_off.head);
+  zavi->cqtail = (unsigned *)(cq+p.cq_off.tail);
+  zavi->cqmask = (unsigned *)(cq+p.cq_off.ring_mask);
+  zavi->cqes = (struct io_uring_cqe *)(cq+p.cq_off.cqes);
+  /* current write buffer becomes slot 0 */
+  zavi->slots = zmbv_avi_calloc(zavi, depth, sizeof(zavi->slots[0]));
+  zavi->slotbusy = zmbv_avi_calloc(zavi, depth, 1);
+  if (zavi->slots == NULL || zavi->slotbusy == NULL) goto error;
+  zavi->nslots = depth;
+  zavi->curslot = 0;
+  zavi->slots[0] = zavi->wbuf;
+  for (int f = 1; f < depth; ++f) {
+    zavi->slots[f] = zmbv_avi_malloc(zavi, zavi->wbufsize);
+    if (zavi->slots[f] == NULL) goto error;
+  }
+  for (int f = 0; f < depth; ++f) {
+    iov[f].iov_base = zavi->slots[f];
+    iov[f].iov_len = zavi->wbufsize;
+  }
+  if (syscall(__NR_io_uring_register, zavi->uring, IORING_REGISTER_BUFFERS, iov, depth) < 0) goto error;
+  return 0;
+error:
+  zmbv_avi_uring_stop(zavi);
+  zavi->was_file_error = 0;
+  return -1;
+}
+#endif
+
+
+/* write data to file, or pass it to the writer thread in async mode */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_output (zmbv_avi_t zavi, struct iovec *iov, int iovcnt) {
+#ifdef ZMBV_USE_THREADS
+  if (zavi->async) return zmbv_avi_queue_put(zavi, iov, iovcnt);
+#endif
+#ifdef ZMBV_USE_IO_URING
+  if (zavi->uring >= 0) return zmbv_avi_uring_writev(zavi, iov, iovcnt);
+#endif
+  return zmbv_avi_writev(zavi->fd, iov, iovcnt);
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_flush_wbuf (zmbv_avi_t zavi) {
+  if (zavi->wbufused > 0) {
+#ifdef ZMBV_USE_IO_URING
+    if (zavi->uring >= 0) {
+      if (zmbv_avi_uring_flush(zavi) < 0) { zavi->was_file_error = 1; return -1; }
+      return 0;
+    }
+#endif
+#ifdef ZMBV_USE_THREADS
+    if (zavi->async) {
+      /* hand the whole buffer over instead of copying it */
+      zmbv_avi_qitem_t *it = zmbv_avi_queue_reserve(zavi);
+      uint8_t *nb;
+      if (it == NULL) { zavi->was_file_error = 1; return -1; }
+      if (it->alloted >= zavi->wbufsize) {
+        nb = it->data;
+      } else {
+        nb = zmbv_avi_malloc(zavi, zavi->wbufsize);
+        if (nb == NULL) { zavi->was_file_error = 1; return -1; }
+        if (it->data != NULL) zmbv_avi_free(zavi, it->data);
+      }
+      it->data = zavi->wbuf;
+      it->alloted = zavi->wbufsize;
+      it->size = zavi->wbufused;
+      zavi->wbuf = nb;
+      zavi->wbufused = 0;
+      zmbv_avi_queue_commit(zavi, it);
+      return 0;
+    }
+#endif
+    struct iovec iov;
+    iov.iov_base = zavi->wbuf;
+    iov.iov_len = zavi->wbufused;
+    zavi->wbufused = 0;
+    if (zmbv_avi_output(zavi, &iov, 1) < 0) { zavi->was_file_error = 1; return -1; }
+  }
+  return 0;
+}
+
+
+/* free idx1 blocks; spill file is removed */
+static void zmbv_avi_free_index (zmbv_avi_t zavi) {
+  while (zavi->idxhead != NULL) {
+    zmbv_avi_idxblock_t *nb = zavi->idxhead->next;
+    zmbv_avi_free(zavi, zavi->idxhead);
+    zavi->idxhead = nb;
+  }
+  zavi->idxtail = NULL;
+  if (zavi->spillfd >= 0) {
+    close(zavi->spillfd);
+    unlink(zavi->spillname);
+    zavi->spillfd = -1;
+  }
+  if (zavi->spillname != NULL) { zmbv_avi_free(zavi, zavi->spillname); zavi->spillname = NULL; }
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_write_all (int fd, const void *buf, size_t size) {
+  const uint8_t *src = (const uint8_t *)buf;
+  while (size > 0) {
+    ssize_t wr = write(fd, src, size);
+    if (wr <= 0) return -1;
+    src += wr;
+    size -= wr;
+  }
+  return 0;
+}
+
+
+/* move all full idx1 blocks to the spill file, keeping the last one for new entries */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_spill_index (zmbv_avi_t zavi) {
+  while (zavi->idxhead != NULL && zavi->idxhead->used == AVI_IDX_BLOCK) {
+    zmbv_avi_idxblock_t *nb = zavi->idxhead->next;
+    if (zmbv_avi_write_all(zavi->spillfd, zavi->idxhead->data, AVI_IDX_BLOCK) < 0) return -1;
+    if (nb == NULL) {
+      // reuse it
+      zavi->idxhead->used = 0;
+      break;
+    }
+    zmbv_avi_free(zavi, zavi->idxhead);
+    zavi->idxhead = nb;
+  }
+  return 0;
+}
+
+
+/* room for one more idx1 entry */
+/* return NULL on error */
+static uint8_t *zmbv_avi_index_entry (zmbv_avi_t zavi) {
+  zmbv_avi_idxblock_t *tb = zavi->idxtail;
+  if (tb != NULL && tb->used == AVI_IDX_BLOCK && zavi->spillfd >= 0) {
+    if (zmbv_avi_spill_index(zavi) < 0) return NULL;
+  }
+  if (tb == NULL || tb->used == AVI_IDX_BLOCK) {
+    tb = zmbv_avi_malloc(zavi, sizeof(*tb));
+    if (tb == NULL) return NULL;
+    tb->next = NULL;
+    tb->used = 0;
+    if (zavi->idxtail != NULL) zavi->idxtail->next = tb; else zavi->idxhead = tb;
+    zavi->idxtail = tb;
+  }
+  tb->used += 16;
+  zavi->indexbytes += 16;
+  return tb->data+tb->used-16;
+}
+
+
+/* (re)allocate super indexes; entries already there are kept */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_alloc_indx (zmbv_avi_t zavi, int entries) {
+  for (int f = 0; f < AVI_STREAMS; ++f) {
+    zmbv_avi_superentry_t *ns = zmbv_avi_realloc(zavi, zavi->streams[f].super, entries*sizeof(ns[0]));
+    if (ns == NULL) return -1;
+    zavi->streams[f].super = ns;
+  }
+  zavi->indxentries = entries;
+  return 0;
+}
+
+
+zmbv_avi_t zmbv_avi_start (const char *fname, int width, int height, double fps, int audiorate, const zmbv_allocator_t *alloc) {
+  if (alloc != NULL && (alloc->alloc == NULL || alloc->realloc == NULL || alloc->free == NULL)) return NULL;
   if (fname != NULL && fname[0] && width > 0 && height > 0 && width <= 16384 && height <= 16384 && fps > 0 && fps <= 100) {
-    zmbv_avi_t zavi = malloc(sizeof(*zavi));
+    zmbv_avi_t zavi = (alloc != NULL ? alloc->alloc(alloc->udata, sizeof(*zavi)) : malloc(sizeof(*zavi)));
     if (zavi == NULL) return NULL;
     memset(zavi, 0, sizeof(*zavi));
+    if (alloc != NULL) zavi->alloc = *alloc;
     zavi->fd = -1;
-    zavi->indexsize = 16*4096;
-    zavi->indexused = 8;
-    zavi->index = malloc(zavi->indexsize);
-    if (zavi->index == NULL) goto error;
+#ifdef ZMBV_USE_IO_URING
+    zavi->uring = -1;
+#endif
+    zavi->spillfd = -1;
+    zavi->segsize = 16;
+    zavi->segs = zmbv_avi_calloc(zavi, zavi->segsize, sizeof(zavi->segs[0]));
+    if (zavi->segs == NULL) goto error;
+    zavi->segcount = 1;
+    memcpy(zavi->streams[0].tag, "00dc", 4);
+    memcpy(zavi->streams[1].tag, "01wb", 4);
+    if (zmbv_avi_alloc_indx(zavi, AVI_INDX_ENTRIES) < 0) goto error;
     zavi->fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_BINARY, 0644);
     if (zavi->fd < 0) goto error;
     zavi->width = width;
     zavi->height = height;
     zavi->fps = fps;
+    if (zmbv_avi_set_flush_policy(zavi, AVI_WBUF_SIZE, AVI_WBUF_MSECS) < 0) goto error;
     {
-      uint8_t eh[AVI_HEADER_SIZE];
+      uint8_t eh[AVI_HEADER_SIZE(AVI_INDX_ENTRIES)];
       memset(eh, 0, sizeof(eh));
       if (write(zavi->fd, eh, sizeof(eh)) != sizeof(eh)) goto error;
     }
+    zavi->hdrsize = AVI_HEADER_SIZE(AVI_INDX_ENTRIES);
+    zavi->filepos = zavi->hdrsize;
     zavi->frames = 0;
     zavi->written = 0;
-    //zavi->audioused = 0;
     zavi->audiorate = audiorate;
     zavi->audiowritten = 0;
+    zavi->audiochannels = 2;
+    zavi->audiobits = 16;
+    zavi->audioalign = 4;
+    zavi->audiointerleave = 1;
     return zavi;
 error:
     if (zavi->fd >= 0) {
       close(zavi->fd);
       unlink(fname);
     }
-    if (zavi->index != NULL) free(zavi->index);
-    free(zavi);
+    for (int f = 0; f < AVI_STREAMS; ++f) if (zavi->streams[f].super != NULL) zmbv_avi_free(zavi, zavi->streams[f].super);
+    if (zavi->segs != NULL) zmbv_avi_free(zavi, zavi->segs);
+    if (zavi->wbuf != NULL) zmbv_avi_free(zavi, zavi->wbuf);
+    zmbv_avi_free(zavi, zavi);
   }
   return NULL;
 }
 
 
+int zmbv_avi_set_flush_policy (zmbv_avi_t zavi, uint32_t bytes, int msecs) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && msecs >= 0) {
+    if (bytes != zavi->wbufsize) {
+      uint8_t *nb = NULL;
+#ifdef ZMBV_USE_IO_URING
+      /* write buffers are registered with the ring */
+      if (zavi->uring >= 0) return -1;
+#endif
+      if (zmbv_avi_flush_wbuf(zavi) < 0) return -1;
+      if (bytes > 0 && (nb = zmbv_avi_malloc(zavi, bytes)) == NULL) return -1;
+      if (zavi->wbuf != NULL) zmbv_avi_free(zavi, zavi->wbuf);
+      zavi->wbuf = nb;
+      zavi->wbufsize = bytes;
+    }
+    zavi->flush_msecs = msecs;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_avi_flush (zmbv_avi_t zavi) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error) return zmbv_avi_flush_wbuf(zavi);
+  return -1;
+}
+
+
+int zmbv_avi_set_async (zmbv_avi_t zavi, int depth) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && depth >= 0) {
+#ifdef ZMBV_USE_THREADS
+#ifdef ZMBV_USE_IO_URING
+    if (zavi->uring >= 0) return (depth == 0 ? 0 : -1);
+#endif
+    if (depth > AVI_MAX_QUEUE) depth = AVI_MAX_QUEUE;
+    if (zavi->async) {
+      if (zavi->qsize == depth) return 0;
+      /* restart with the new depth; buffered chunks go first */
+      if (zmbv_avi_flush_wbuf(zavi) < 0) return -1;
+      if (zmbv_avi_async_stop(zavi) < 0) { zavi->was_file_error = 1; return -1; }
+    }
+    if (depth == 0) return 0;
+    zavi->queue = zmbv_avi_calloc(zavi, depth, sizeof(zavi->queue[0]));
+    if (zavi->queue == NULL) return -1;
+    zavi->qsize = depth;
+    zavi->qhead = zavi->qcount = zavi->qmaxcount = 0;
+    zavi->qstop = zavi->qerror = 0;
+    zavi->qbytes = zavi->qwaits = 0;
+    pthread_mutex_init(&zavi->qlock, NULL);
+    pthread_cond_init(&zavi->qnotempty, NULL);
+    pthread_cond_init(&zavi->qnotfull, NULL);
+    if (pthread_create(&zavi->iothread, NULL, zmbv_avi_io_thread, zavi) != 0) {
+      pthread_cond_destroy(&zavi->qnotfull);
+      pthread_cond_destroy(&zavi->qnotempty);
+      pthread_mutex_destroy(&zavi->qlock);
+      zmbv_avi_free(zavi, zavi->queue);
+      zavi->queue = NULL;
+      return -1;
+    }
+    zavi->async = 1;
+    return 0;
+#else
+    if (depth == 0) return 0;
+#endif
+  }
+  return -1;
+}
+
+
+int zmbv_avi_set_io_uring (zmbv_avi_t zavi, int depth) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && depth >= 0) {
+#ifdef ZMBV_USE_IO_URING
+    if (depth > AVI_MAX_URING) depth = AVI_MAX_URING;
+    if (zavi->uring >= 0) {
+      if (zavi->nslots == depth) return 0;
+      if (zmbv_avi_uring_stop(zavi) < 0) return -1;
+    }
+    if (depth == 0) return 0;
+#ifdef ZMBV_USE_THREADS
+    if (zavi->async) return -1;
+#endif
+    if (zavi->wbufsize == 0) return -1;
+    /* buffered data goes out first */
+    if (zmbv_avi_flush_wbuf(zavi) < 0) return -1;
+    return (zmbv_avi_uring_start(zavi, depth) == 0 ? 0 : 1);
+#else
+    return (depth == 0 ? 0 : 1);
+#endif
+  }
+  return -1;
+}
+
+
+int zmbv_avi_set_prealloc (zmbv_avi_t zavi, uint64_t bytes) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error) {
+#if defined(_WIN32) || defined(__APPLE__)
+    return (bytes == 0 ? 0 : 1);
+#else
+    zavi->prealloc = (bytes+AVI_PREALLOC_MIN-1)/AVI_PREALLOC_MIN*AVI_PREALLOC_MIN;
+    return 0;
+#endif
+  }
+  return -1;
+}
+
+
+int zmbv_avi_set_drop_cache (zmbv_avi_t zavi, int on) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error) {
+#if defined(_WIN32) || defined(__APPLE__)
+    return (on ? 1 : 0);
+#else
+    zavi->dropcache = !!on;
+    return 0;
+#endif
+  }
+  return -1;
+}
+
+
+int zmbv_avi_set_index_spill (zmbv_avi_t zavi, const char *fname) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && fname != NULL && fname[0] && zavi->spillfd < 0) {
+    // idx1 is already written
+    if (zavi->segcount > 1) return 0;
+    if ((zavi->spillname = zmbv_avi_strdup(zavi, fname)) == NULL) return -1;
+    zavi->spillfd = open(fname, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC|O_BINARY, 0644);
+    if (zavi->spillfd < 0) {
+      zmbv_avi_free(zavi, zavi->spillname);
+      zavi->spillname = NULL;
+      return -1;
+    }
+    if (zmbv_avi_spill_index(zavi) < 0) { zavi->was_file_error = 1; return -1; }
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_avi_get_queue_stats (zmbv_avi_t zavi, zmbv_avi_queue_stats_t *stats) {
+  if (zavi != NULL && stats != NULL) {
+    memset(stats, 0, sizeof(*stats));
+#ifdef ZMBV_USE_THREADS
+    if (zavi->async) {
+      pthread_mutex_lock(&zavi->qlock);
+      stats->capacity = zavi->qsize;
+      stats->depth = zavi->qcount;
+      stats->max_depth = zavi->qmaxcount;
+      stats->bytes = zavi->qbytes;
+      stats->waits = zavi->qwaits;
+      pthread_mutex_unlock(&zavi->qlock);
+    }
+#endif
+    return 0;
+  }
+  return -1;
+}
+
+
+/******************************************************************************/
+/* reserve file space up to at least `need` */
+/* failures just turn preallocation off: writes will tell if the disk is really full */
+static void zmbv_avi_preallocate (zmbv_avi_t zavi, uint64_t need) {
+  uint64_t end = zavi->allocated;
+  while (end < need) end += zavi->prealloc;
+#if defined(__linux__)
+  // no zero-filling fallback like posix_fallocate() has: it would race with the writer thread
+  // space past the end doesn't change the file size, so a crashed file has no zero tail;
+  // filesystems that can't do that get it the old way, and the file grows
+  int res = -1;
+# ifdef FALLOC_FL_KEEP_SIZE
+  if ((res = fallocate(zavi->fd, FALLOC_FL_KEEP_SIZE, zavi->allocated, end-zavi->allocated)) != 0 && errno != EOPNOTSUPP) { zavi->prealloc = 0; return; }
+# endif
+  if (res != 0 && fallocate(zavi->fd, 0, zavi->allocated, end-zavi->allocated) != 0) { zavi->prealloc = 0; return; }
+#elif !defined(_WIN32) && !defined(__APPLE__)
+  if (posix_fallocate(zavi->fd, zavi->allocated, end-zavi->allocated) != 0) { zavi->prealloc = 0; return; }
+#endif
+  zavi->allocated = end;
+}
+
+
+/* drop page cache of data written a while ago */
+/* DONTNEED skips dirty pages but starts their writeback, so each range gets advised twice: */
+/* once to start writing it, and one window later to drop it */
+static void zmbv_avi_drop_cache (zmbv_avi_t zavi, int final) {
+#if !defined(_WIN32) && !defined(__APPLE__)
+  uint64_t end = zavi->filepos-zavi->wbufused;
+  if (!final) {
+    if (end < zavi->advised+2*AVI_DROP_WINDOW) return;
+    end -= AVI_DROP_WINDOW;
+  }
+  if (zavi->advised > zavi->dropped) posix_fadvise(zavi->fd, zavi->dropped, zavi->advised-zavi->dropped, POSIX_FADV_DONTNEED);
+  if (end > zavi->advised) posix_fadvise(zavi->fd, zavi->advised, end-zavi->advised, POSIX_FADV_DONTNEED);
+  zavi->dropped = zavi->advised;
+  zavi->advised = end;
+#else
+  (void)zavi; (void)final;
+#endif
+}
+
+
+/* append data to the file through the write buffer */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_put (zmbv_avi_t zavi, struct iovec *iov, int iovcnt) {
+  uint32_t total = 0;
+  for (int f = 0; f < iovcnt; ++f) total += iov[f].iov_len;
+  if (zavi->prealloc > 0 && zavi->filepos+total > zavi->allocated) zmbv_avi_preallocate(zavi, zavi->filepos+total);
+  if (zavi->dropcache) zmbv_avi_drop_cache(zavi, 0);
+#ifdef ZMBV_USE_IO_URING
+  // registered buffers only work for data copied into them
+  if (zavi->uring >= 0 && zavi->wbufused+total > zavi->wbufsize && total <= zavi->wbufsize) {
+    if (zmbv_avi_flush_wbuf(zavi) < 0) return -1;
+  }
+#endif
+  if (zavi->wbufused+total <= zavi->wbufsize) {
+    // collect small chunks
+    if (zavi->wbufused == 0) zavi->wbuftime = zmbv_avi_msecs();
+    for (int f = 0; f < iovcnt; ++f) {
+      memcpy(zavi->wbuf+zavi->wbufused, iov[f].iov_base, iov[f].iov_len);
+      zavi->wbufused += iov[f].iov_len;
+    }
+    zavi->filepos += total;
+    if (zavi->flush_msecs > 0 && zmbv_avi_msecs()-zavi->wbuftime >= (uint64_t)zavi->flush_msecs) {
+      if (zmbv_avi_flush_wbuf(zavi) < 0) return -1;
+    }
+  } else {
+    // buffered data and new data in one go
+    struct iovec biov[8];
+    int bcnt = 0;
+    if (zavi->wbufused > 0) {
+      biov[bcnt].iov_base = zavi->wbuf;
+      biov[bcnt++].iov_len = zavi->wbufused;
+      zavi->wbufused = 0;
+    }
+    for (int f = 0; f < iovcnt; ++f) biov[bcnt++] = iov[f];
+    if (zmbv_avi_output(zavi, biov, bcnt) < 0) return -1;
+    zavi->filepos += total;
+  }
+  return 0;
+}
+
+
+/* write idx1 chunk: spilled entries first, then the ones in memory */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_put_index (zmbv_avi_t zavi) {
+  struct iovec iov;
+  uint8_t hdr[8];
+  uint32_t d = HTOLE32(zavi->indexbytes);
+  memcpy(hdr, "idx1", 4);
+  memcpy(hdr+4, &d, 4);
+  iov.iov_base = hdr;
+  iov.iov_len = 8;
+  if (zmbv_avi_put(zavi, &iov, 1) < 0) return -1;
+  if (zavi->spillfd >= 0) {
+    off_t left = lseek(zavi->spillfd, 0, SEEK_CUR);
+    uint8_t *buf;
+    if (left < 0 || lseek(zavi->spillfd, 0, SEEK_SET) != 0) return -1;
+    if ((buf = zmbv_avi_malloc(zavi, AVI_IDX_BLOCK)) == NULL) return -1;
+    while (left > 0) {
+      ssize_t rd = read(zavi->spillfd, buf, (left < AVI_IDX_BLOCK ? left : AVI_IDX_BLOCK));
+      if (rd <= 0) { zmbv_avi_free(zavi, buf); return -1; }
+      iov.iov_base = buf;
+      iov.iov_len = rd;
+      if (zmbv_avi_put(zavi, &iov, 1) < 0) { zmbv_avi_free(zavi, buf); return -1; }
+      left -= rd;
+    }
+    zmbv_avi_free(zavi, buf);
+  }
+  for (zmbv_avi_idxblock_t *ib = zavi->idxhead; ib != NULL; ib = ib->next) {
+    if (ib->used == 0) continue;
+    iov.iov_base = ib->data;
+    iov.iov_len = ib->used;
+    if (zmbv_avi_put(zavi, &iov, 1) < 0) return -1;
+  }
+  zmbv_avi_free_index(zavi);
+  return 0;
+}
+
+
+/* write out standard index chunk (ix##) for the stream with the entries not written yet; */
+/* `whole`: with all entries of the current RIFF instead, replacing its earlier super index entries */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_put_ix (zmbv_avi_t zavi, int sn, int whole) {
+  zmbv_avi_stream_t *st = &zavi->streams[sn];
+  uint32_t first = (whole ? 0 : st->ixdone), count = st->ixused-first;
+  if (count > 0) {
+    uint8_t hdr[32];
+    struct iovec iov[2];
+    uint32_t d;
+    uint64_t q;
+    zmbv_avi_superentry_t *se;
+    if (whole) st->superused = st->segsuper;
+    if (st->superused >= zavi->indxentries) return -1;
+    memcpy(hdr, "ix00", 4);
+    hdr[2] = '0'+sn/10;
+    hdr[3] = '0'+sn%10;
+    d = HTOLE32(24+count*8); memcpy(hdr+4, &d, 4);
+    hdr[8] = 2; hdr[9] = 0; // wLongsPerEntry
+    hdr[10] = 0; // bIndexSubType
+    hdr[11] = 1; // bIndexType: AVI_INDEX_OF_CHUNKS
+    d = HTOLE32(count); memcpy(hdr+12, &d, 4); // nEntriesInUse
+    memcpy(hdr+16, st->tag, 4); // dwChunkId
+    q = zavi->segstart; // qwBaseOffset
+    d = HTOLE32((uint32_t)q); memcpy(hdr+20, &d, 4);
+    d = HTOLE32((uint32_t)(q>>32)); memcpy(hdr+24, &d, 4);
+    memset(hdr+28, 0, 4); // dwReserved
+    se = &st->super[st->superused++];
+    se->offset = zavi->filepos;
+    se->size = 32+count*8;
+    se->duration = (whole ? st->segduration : st->ixduration);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = 32;
+    iov[1].iov_base = st->ix+first;
+    iov[1].iov_len = count*8;
+    if (zmbv_avi_put(zavi, iov, 2) < 0) return -1;
+    zavi->written += 32+count*8;
+    st->ixdone = st->ixused;
+    st->ixduration = 0;
+  }
+  return 0;
+}
+
+
+/* finish current RIFF: standard indexes, and idx1 for the first one */
+/* every RIFF ends up with one ix## per stream, so checkpoints don't use up the super index */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_close_segment (zmbv_avi_t zavi) {
+  zmbv_avi_segment_t *seg = &zavi->segs[zavi->segcount-1];
+  for (int sn = 0; sn < AVI_STREAMS; ++sn) {
+    zmbv_avi_stream_t *st = &zavi->streams[sn];
+    int pieces = st->superused-st->segsuper+(st->ixused > st->ixdone);
+    if (zmbv_avi_put_ix(zavi, sn, (pieces > 1)) < 0) return -1;
+    st->ixused = st->ixdone = 0;
+    st->segduration = 0;
+    st->segsuper = st->superused;
+  }
+  seg->movisize = zavi->written+4;
+  if (zavi->segcount == 1) {
+    if (zmbv_avi_put_index(zavi) < 0) return -1;
+    zavi->firstframes = zavi->frames;
+  }
+  seg->riffsize = zavi->filepos-seg->offset-8;
+  return 0;
+}
+
+
+/* start new RIFF-AVIX segment; its sizes are fixed at stop */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_open_segment (zmbv_avi_t zavi) {
+  static const uint8_t hdr[24] = {'R','I','F','F',0,0,0,0,'A','V','I','X','L','I','S','T',0,0,0,0,'m','o','v','i'};
+  struct iovec iov;
+  if (zavi->segcount == zavi->segsize) {
+    zmbv_avi_segment_t *ns = zmbv_avi_realloc(zavi, zavi->segs, (zavi->segsize+16)*sizeof(zavi->segs[0]));
+    if (ns == NULL) return -1;
+    zavi->segs = ns;
+    zavi->segsize += 16;
+  }
+  zavi->segstart = zavi->filepos;
+  zavi->segs[zavi->segcount].offset = zavi->filepos;
+  zavi->segs[zavi->segcount].riffsize = 0;
+  zavi->segs[zavi->segcount].movisize = 0;
+  ++zavi->segcount;
+  zavi->written = 0;
+  iov.iov_base = (void *)hdr;
+  iov.iov_len = sizeof(hdr);
+  return zmbv_avi_put(zavi, &iov, 1);
+}
+
+
+/******************************************************************************/
 #define AVIOUT4(_S_)  do { memcpy(&avi_header[header_pos], _S_, 4); header_pos += 4; } while (0)
 #define AVIOUTw(_S_)  do { uint16_t w = HTOLE16(_S_); memcpy(&avi_header[header_pos], &w, 2); header_pos += 2; } while (0)
 #define AVIOUTd(_S_)  do { uint32_t d = HTOLE32(_S_); memcpy(&avi_header[header_pos], &d, 4); header_pos += 4; } while (0)
 
+/* super index (indx) for the stream, with room for `indxentries` entries */
+static uint32_t zmbv_avi_build_indx (zmbv_avi_t zavi, int sn, uint8_t *avi_header, uint32_t header_pos) {
+  const zmbv_avi_stream_t *st = &zavi->streams[sn];
+  uint32_t end = header_pos+8+AVI_INDX_SIZE(zavi->indxentries);
+  AVIOUT4("indx");
+  AVIOUTd(AVI_INDX_SIZE(zavi->indxentries));
+  AVIOUTw(4); // wLongsPerEntry
+  avi_header[header_pos++] = 0; // bIndexSubType
+  avi_header[header_pos++] = 0; // bIndexType: AVI_INDEX_OF_INDEXES
+  AVIOUTd(st->superused); // nEntriesInUse
+  AVIOUT4(st->tag); // dwChunkId
+  AVIOUTd(0); // dwReserved
+  AVIOUTd(0);
+  AVIOUTd(0);
+  for (int f = 0; f < st->superused; ++f) {
+    AVIOUTd((uint32_t)st->super[f].offset); // qwOffset
+    AVIOUTd((uint32_t)(st->super[f].offset>>32));
+    AVIOUTd(st->super[f].size); // dwSize
+    AVIOUTd(st->super[f].duration); // dwDuration
+  }
+  return end;
+}
+
+
+static void zmbv_avi_build_header (zmbv_avi_t zavi, uint8_t *avi_header) {
+  uint32_t main_list;
+  uint32_t header_pos = 0;
+  int has_audio = (zavi->audiowritten > 0);
+  memset(avi_header, 0, zavi->hdrsize);
+  AVIOUT4("RIFF"); // riff header
+  AVIOUTd(zavi->segs[0].riffsize);
+  AVIOUT4("AVI ");
+  AVIOUT4("LIST"); // list header
+  main_list = header_pos;
+  AVIOUTd(0); // TODO size of list
+  AVIOUT4("hdrl");
+
+  AVIOUT4("avih");
+  AVIOUTd(56); // # of bytes to follow
+  AVIOUTd((uint32_t)round(1000000.0f/zavi->fps)); // microseconds per frame
+  AVIOUTd(0);
+  AVIOUTd(0); // PaddingGranularity (whatever that might be)
+  AVIOUTd(0x110); // Flags, 0x10 has index, 0x100 interleaved
+  AVIOUTd(zavi->firstframes); // TotalFrames in the first RIFF; dmlh has the real count
+  AVIOUTd(0); // InitialFrames
+  AVIOUTd(has_audio ? 2 : 1); // Stream count
+  AVIOUTd(0); // SuggestedBufferSize
+  AVIOUTd(zavi->width); // Width
+  AVIOUTd(zavi->height); // Height
+  AVIOUTd(0); // TimeScale:  Unit used to measure time
+  AVIOUTd(0); // DataRate:   Data rate of playback
+  AVIOUTd(0); // StartTime:  Starting time of AVI data
+  AVIOUTd(0); // DataLength: Size of AVI data chunk
+
+  // video stream list
+  AVIOUT4("LIST");
+  AVIOUTd(4+8+56+8+40+8+AVI_INDX_SIZE(zavi->indxentries)); // size of the list
+  AVIOUT4("strl");
+  // video stream header
+  AVIOUT4("strh");
+  AVIOUTd(56); // # of bytes to follow
+  AVIOUT4("vids"); // type
+  AVIOUT4(CODEC_4CC); // handler */
+  AVIOUTd(0); // Flags
+  AVIOUTd(0); // Reserved, MS says: wPriority, wLanguage
+  AVIOUTd(0); // InitialFrames
+  AVIOUTd(1000000); // Scale
+  AVIOUTd((uint32_t)round(1000000.0f*zavi->fps)); // Rate: Rate/Scale == samples/second
+  AVIOUTd(0); // Start
+  AVIOUTd(zavi->frames); // Length
+  AVIOUTd(0); // SuggestedBufferSize
+  AVIOUTd(~0); // Quality
+  AVIOUTd(0); // SampleSize
+  AVIOUTd(0); // Frame
+  AVIOUTd(0); // Frame
+  // the video stream format
+  AVIOUT4("strf");
+  AVIOUTd(40); // # of bytes to follow
+  AVIOUTd(40); // Size
+  AVIOUTd(zavi->width); // Width
+  AVIOUTd(zavi->height); // Height
+  //OUTSHRT(1); OUTSHRT(24); // Planes, Count
+  AVIOUTd(0);
+  AVIOUT4(CODEC_4CC); // Compression
+  AVIOUTd(zavi->width*zavi->height*4); // SizeImage (in bytes?)
+  AVIOUTd(0); // XPelsPerMeter
+  AVIOUTd(0); // YPelsPerMeter
+  AVIOUTd(0); // ClrUsed: Number of colors used
+  AVIOUTd(0); // ClrImportant: Number of colors important
+  header_pos = zmbv_avi_build_indx(zavi, 0, avi_header, header_pos);
+
+  if (has_audio) {
+    // audio stream list
+    AVIOUT4("LIST");
+    AVIOUTd(4+8+56+8+16+8+AVI_INDX_SIZE(zavi->indxentries)); // Length of list in bytes
+    AVIOUT4("strl");
+    // the audio stream header
+    AVIOUT4("strh");
+    AVIOUTd(56); // # of bytes to follow
+    AVIOUT4("auds");
+    AVIOUTd(0); // Format (Optionally)
+    AVIOUTd(0); // Flags
+    AVIOUTd(0); // Reserved, MS says: wPriority, wLanguage
+    AVIOUTd(0); // InitialFrames
+    AVIOUTd(zavi->audioalign); // Scale
+    AVIOUTd(zavi->audiorate*zavi->audioalign); // rate, actual rate is scale/rate
+    AVIOUTd(0); // Start
+    if (!zavi->audiorate) zavi->audiorate = 1;
+    AVIOUTd((uint32_t)(zavi->audiowritten/zavi->audioalign)); // Length in sample frames
+    AVIOUTd(0); // SuggestedBufferSize
+    AVIOUTd(~0); // Quality
+    AVIOUTd(zavi->audioalign); // SampleSize
+    AVIOUTd(0); // Frame
+    AVIOUTd(0); // Frame
+    // the audio stream format
+    AVIOUT4("strf");
+    AVIOUTd(16); // # of bytes to follow
+    AVIOUTw(1); // Format, WAVE_ZMBV_FORMAT_PCM
+    AVIOUTw(zavi->audiochannels); // Number of channels
+    AVIOUTd(zavi->audiorate); // SamplesPerSec
+    AVIOUTd(zavi->audiorate*zavi->audioalign); // AvgBytesPerSec
+    AVIOUTw(zavi->audioalign); // BlockAlign
+    AVIOUTw(zavi->audiobits); // BitsPerSample
+    header_pos = zmbv_avi_build_indx(zavi, 1, avi_header, header_pos);
+  }
+  // OpenDML extended header
+  AVIOUT4("LIST");
+  AVIOUTd(4+8+248);
+  AVIOUT4("odml");
+  AVIOUT4("dmlh");
+  AVIOUTd(248);
+  AVIOUTd(zavi->frames); // dwTotalFrames
+  header_pos += 244;
+  int nmain = header_pos-main_list-4;
+  // finish stream list, i.e. put number of bytes in the list to proper pos
+  int njunk = zavi->hdrsize-8-12-header_pos;
+  AVIOUT4("JUNK");
+  AVIOUTd(njunk);
+  // fix the size of the main list
+  header_pos = main_list;
+  AVIOUTd(nmain);
+  header_pos = zavi->hdrsize-12;
+  AVIOUT4("LIST");
+  AVIOUTd(zavi->segs[0].movisize); // Length of list in bytes
+  AVIOUT4("movi");
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_pwrite (int fd, const void *buf, size_t size, off_t ofs) {
+  const uint8_t *src = (const uint8_t *)buf;
+  while (size > 0) {
+    ssize_t wr = pwrite(fd, src, size, ofs);
+    if (wr <= 0) return -1;
+    src += wr;
+    ofs += wr;
+    size -= wr;
+  }
+  return 0;
+}
+
+
+/* write header and sizes of RIFF-AVIX segments; all data should be in the file already */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_write_header (zmbv_avi_t zavi) {
+  uint8_t *avi_header = zmbv_avi_malloc(zavi, zavi->hdrsize);
+  int res = -1;
+  if (avi_header == NULL) return -1;
+  /* try and write an avi header */
+  zmbv_avi_build_header(zavi, avi_header);
+  if (zmbv_avi_pwrite(zavi->fd, avi_header, zavi->hdrsize, 0) < 0) goto quit;
+  // sizes of RIFF-AVIX segments
+  for (int f = 1; f < zavi->segcount; ++f) {
+    uint32_t d = HTOLE32(zavi->segs[f].riffsize);
+    if (zmbv_avi_pwrite(zavi->fd, &d, 4, zavi->segs[f].offset+4) < 0) goto quit;
+    d = HTOLE32(zavi->segs[f].movisize);
+    if (zmbv_avi_pwrite(zavi->fd, &d, 4, zavi->segs[f].offset+16) < 0) goto quit;
+  }
+  res = 0;
+quit:
+  zmbv_avi_free(zavi, avi_header);
+  return res;
+}
+
+
+/* wait until everything written so far is in the file */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_barrier (zmbv_avi_t zavi) {
+  if (zmbv_avi_flush_wbuf(zavi) < 0) return -1;
+#ifdef ZMBV_USE_THREADS
+  if (zavi->async) {
+    int err;
+    ZMBV_TRACE_BEGIN(ttime);
+    pthread_mutex_lock(&zavi->qlock);
+    while (zavi->qcount > 0 && !zavi->qerror) pthread_cond_wait(&zavi->qnotfull, &zavi->qlock);
+    ZMBV_TRACE_END(ZMBV_TRACE_QUEUE_WAIT, (int)zavi->frames, ttime);
+    err = zavi->qerror;
+    pthread_mutex_unlock(&zavi->qlock);
+    if (err) return -1;
+  }
+#endif
+#ifdef ZMBV_USE_IO_URING
+  if (zavi->uring >= 0) {
+    while (zavi->inflight > 0) if (zmbv_avi_uring_reap(zavi, 1) < 0) return -1;
+  }
+#endif
+  return 0;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_sync (int fd) {
+#ifdef _WIN32
+  return (_commit(fd) == 0 ? 0 : -1);
+#elif defined(__APPLE__)
+  return (fsync(fd) == 0 ? 0 : -1);
+#else
+  return (fdatasync(fd) == 0 ? 0 : -1);
+#endif
+}
+
+
+int zmbv_avi_checkpoint (zmbv_avi_t zavi) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error) {
+    zmbv_avi_segment_t *seg = &zavi->segs[zavi->segcount-1];
+    // index what we have so far; when the super index runs low, one ix## with all entries of
+    // this RIFF replaces its earlier ones, keeping some room for closing RIFFs
+    for (int sn = 0; sn < AVI_STREAMS; ++sn) {
+      const zmbv_avi_stream_t *st = &zavi->streams[sn];
+      int whole = (st->superused >= zavi->indxentries-AVI_INDX_RESERVE);
+      if (whole && st->segsuper >= zavi->indxentries-AVI_INDX_RESERVE) goto error; /* too many RIFFs */
+      if (zmbv_avi_put_ix(zavi, sn, whole) < 0) goto error;
+    }
+    if (zmbv_avi_barrier(zavi) < 0) goto error;
+    // current RIFF as if it ends here; the first one has no idx1 yet
+    seg->movisize = zavi->written+4;
+    seg->riffsize = zavi->filepos-seg->offset-8;
+    if (zavi->segcount == 1) zavi->firstframes = zavi->frames;
+    if (zmbv_avi_write_header(zavi) < 0) goto error;
+    ++zavi->ckpt_count;
+    if (zavi->ckpt_sync > 0 && zavi->ckpt_count%zavi->ckpt_sync == 0 && zmbv_avi_sync(zavi->fd) < 0) goto error;
+    return 0;
+error:
+    zavi->was_file_error = 1;
+  }
+  return -1;
+}
+
+
+int zmbv_avi_set_checkpoint (zmbv_avi_t zavi, int frames, int syncevery) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && frames >= 0 && syncevery >= 0) {
+    // every checkpoint takes super index entries, so get more room while header can still grow
+    if (frames > 0 && zavi->indxentries < AVI_INDX_ENTRIES_CKPT && zavi->filepos == zavi->hdrsize) {
+      uint32_t newsize = AVI_HEADER_SIZE(AVI_INDX_ENTRIES_CKPT);
+      uint8_t *zeroes = zmbv_avi_calloc(zavi, 1, newsize-zavi->hdrsize);
+      struct iovec iov;
+      int res;
+      if (zeroes == NULL) return -1;
+      iov.iov_base = zeroes;
+      iov.iov_len = newsize-zavi->hdrsize;
+      res = zmbv_avi_put(zavi, &iov, 1);
+      zmbv_avi_free(zavi, zeroes);
+      if (res < 0 || zmbv_avi_alloc_indx(zavi, AVI_INDX_ENTRIES_CKPT) < 0) { zavi->was_file_error = 1; return -1; }
+      zavi->hdrsize = newsize;
+    }
+    zavi->ckpt_frames = frames;
+    zavi->ckpt_sync = syncevery;
+    zavi->ckpt_next = zavi->frames+frames;
+    return 0;
+  }
+  return -1;
+}
+
+
+/* write collected audio as one chunk; `all` also writes an incomplete last sample frame */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_flush_audio (zmbv_avi_t zavi, int all) {
+  uint32_t size = (all ? zavi->audioused : zavi->audioused/zavi->audioalign*zavi->audioalign);
+  zavi->audioframe = zavi->frames;
+  if (size > 0) {
+    if (zmbv_avi_write_chunk(zavi, "01wb", size, zavi->audiobuf, 0) < 0) return -1;
+    zavi->audiowritten += size;
+    zavi->audioused -= size;
+    if (zavi->audioused > 0) memmove(zavi->audiobuf, zavi->audiobuf+size, zavi->audioused);
+  }
+  return 0;
+}
+
+
 int zmbv_avi_stop (zmbv_avi_t zavi) {
   int res = -1;
   if (zavi != NULL) {
-    if (!zavi->was_file_error && zavi->fd >= 0) {
-      uint8_t avi_header[AVI_HEADER_SIZE];
-      uint32_t main_list;
-      uint32_t header_pos = 0;
-      /* try and write an avi header */
-      AVIOUT4("RIFF"); // riff header
-      AVIOUTd(AVI_HEADER_SIZE+zavi->written-8+zavi->indexused);
-      AVIOUT4("AVI ");
-      AVIOUT4("LIST"); // list header
-      main_list = header_pos;
-      AVIOUTd(0); // TODO size of list
-      AVIOUT4("hdrl");
-
-      AVIOUT4("avih");
-      AVIOUTd(56); // # of bytes to follow
-      AVIOUTd((uint32_t)round(1000000.0f/zavi->fps)); // microseconds per frame
-      AVIOUTd(0);
-      AVIOUTd(0); // PaddingGranularity (whatever that might be)
-      AVIOUTd(0x110); // Flags, 0x10 has index, 0x100 interleaved
-      AVIOUTd(zavi->frames); // TotalFrames
-      AVIOUTd(0); // InitialFrames
-      AVIOUTd(2); // Stream count
-      AVIOUTd(0); // SuggestedBufferSize
-      AVIOUTd(zavi->width); // Width
-      AVIOUTd(zavi->height); // Height
-      AVIOUTd(0); // TimeScale:  Unit used to measure time
-      AVIOUTd(0); // DataRate:   Data rate of playback
-      AVIOUTd(0); // StartTime:  Starting time of AVI data
-      AVIOUTd(0); // DataLength: Size of AVI data chunk
-
-      // video stream list
-      AVIOUT4("LIST");
-      AVIOUTd(4+8+56+8+40); // size of the list
-      AVIOUT4("strl");
-      // video stream header
-      AVIOUT4("strh");
-      AVIOUTd(56); // # of bytes to follow
-      AVIOUT4("vids"); // type
-      AVIOUT4(CODEC_4CC); // handler */
-      AVIOUTd(0); // Flags
-      AVIOUTd(0); // Reserved, MS says: wPriority, wLanguage
-      AVIOUTd(0); // InitialFrames
-      AVIOUTd(1000000); // Scale
-      AVIOUTd((uint32_t)round(1000000.0f*zavi->fps)); // Rate: Rate/Scale == samples/second
-      AVIOUTd(0); // Start
-      AVIOUTd(zavi->frames); // Length
-      AVIOUTd(0); // SuggestedBufferSize
-      AVIOUTd(~0); // Quality
-      AVIOUTd(0); // SampleSize
-      AVIOUTd(0); // Frame
-      AVIOUTd(0); // Frame
-      // the video stream format
-      AVIOUT4("strf");
-      AVIOUTd(40); // # of bytes to follow
-      AVIOUTd(40); // Size
-      AVIOUTd(zavi->width); // Width
-      AVIOUTd(zavi->height); // Height
-      //OUTSHRT(1); OUTSHRT(24); // Planes, Count
-      AVIOUTd(0);
-      AVIOUT4(CODEC_4CC); // Compression
-      AVIOUTd(zavi->width*zavi->height*4); // SizeImage (in bytes?)
-      AVIOUTd(0); // XPelsPerMeter
-      AVIOUTd(0); // YPelsPerMeter
-      AVIOUTd(0); // ClrUsed: Number of colors used
-      AVIOUTd(0); // ClrImportant: Number of colors important
-
-      if (zavi->audiowritten > 0) {
-        // audio stream list
-        AVIOUT4("LIST");
-        AVIOUTd(4+8+56+8+16); // Length of list in bytes
-        AVIOUT4("strl");
-        // the audio stream header
-        AVIOUT4("strh");
-        AVIOUTd(56); // # of bytes to follow
-        AVIOUT4("auds");
-        AVIOUTd(0); // Format (Optionally)
-        AVIOUTd(0); // Flags
-        AVIOUTd(0); // Reserved, MS says: wPriority, wLanguage
-        AVIOUTd(0); // InitialFrames
-        AVIOUTd(4); // Scale
-        AVIOUTd(zavi->audiorate*4); // rate, actual rate is scale/rate
-        AVIOUTd(0); // Start
-        if (!zavi->audiorate) zavi->audiorate = 1;
-        AVIOUTd(zavi->audiowritten/4); // Length
-        AVIOUTd(0); // SuggestedBufferSize
-        AVIOUTd(~0); // Quality
-        AVIOUTd(4); // SampleSize
-        AVIOUTd(0); // Frame
-        AVIOUTd(0); // Frame
-        // the audio stream format
-        AVIOUT4("strf");
-        AVIOUTd(16); // # of bytes to follow
-        AVIOUTw(1); // Format, WAVE_ZMBV_FORMAT_PCM
-        AVIOUTw(2); // Number of channels
-        AVIOUTd(zavi->audiorate); // SamplesPerSec
-        AVIOUTd(zavi->audiorate*4); // AvgBytesPerSec
-        AVIOUTw(4); // BlockAlign
-        AVIOUTw(16); // BitsPerSample
-      }
-      int nmain = header_pos-main_list-4;
-      // finish stream list, i.e. put number of bytes in the list to proper pos
-      int njunk = AVI_HEADER_SIZE-8-12-header_pos;
-      AVIOUT4("JUNK");
-      AVIOUTd(njunk);
-      // fix the size of the main list
-      header_pos = main_list;
-      AVIOUTd(nmain);
-      header_pos = AVI_HEADER_SIZE-12;
-      AVIOUT4("LIST");
-      AVIOUTd(zavi->written+4); // Length of list in bytes
-      AVIOUT4("movi");
-      // first add the index table to the end
-      memcpy(zavi->index, "idx1", 4);
-      {
-        uint32_t d = HTOLE32(zavi->indexused-8);
-        memcpy(zavi->index+4, &d, 4);
-        if (write(zavi->fd, zavi->index, zavi->indexused) != zavi->indexused) goto quit;
-      }
-      // now replace the header
-      if (lseek(zavi->fd, 0, SEEK_SET) == (off_t)-1) goto quit;
-      if (write(zavi->fd, &avi_header, AVI_HEADER_SIZE) != AVI_HEADER_SIZE) goto quit;
+    if (!zavi->was_file_error && zavi->fd >= 0 && zmbv_avi_flush_audio(zavi, 1) == 0 && zmbv_avi_close_segment(zavi) == 0 && zmbv_avi_flush_wbuf(zavi) == 0) {
+#ifdef ZMBV_USE_THREADS
+      // header and segment sizes are written directly
+      if (zmbv_avi_async_stop(zavi) < 0) goto quit;
+#endif
+#ifdef ZMBV_USE_IO_URING
+      if (zmbv_avi_uring_stop(zavi) < 0) goto quit;
+#endif
+      if (zmbv_avi_write_header(zavi) < 0) goto quit;
+      // cut off preallocated space
+      if (zavi->allocated > zavi->filepos && ftruncate(zavi->fd, zavi->filepos) < 0) goto quit;
+      if (zavi->ckpt_sync > 0 && zmbv_avi_sync(zavi->fd) < 0) goto quit;
+      if (zavi->dropcache) zmbv_avi_drop_cache(zavi, 1);
       res = 0;
     }
 quit:
+#ifdef ZMBV_USE_THREADS
+    zmbv_avi_async_stop(zavi);
+#endif
+#ifdef ZMBV_USE_IO_URING
+    zmbv_avi_uring_stop(zavi);
+#endif
     if (zavi->fd >= 0) { if (close(zavi->fd) < 0 && res == 0) res = -1; }
-    if (zavi->index != NULL) free(zavi->index);
-    free(zavi);
+    zmbv_avi_free_index(zavi);
+    for (int f = 0; f < AVI_STREAMS; ++f) {
+      if (zavi->streams[f].ix != NULL) zmbv_avi_free(zavi, zavi->streams[f].ix);
+      if (zavi->streams[f].super != NULL) zmbv_avi_free(zavi, zavi->streams[f].super);
+    }
+    if (zavi->segs != NULL) zmbv_avi_free(zavi, zavi->segs);
+    if (zavi->wbuf != NULL) zmbv_avi_free(zavi, zavi->wbuf);
+    if (zavi->audiobuf != NULL) zmbv_avi_free(zavi, zavi->audiobuf);
+    zmbv_avi_free(zavi, zavi);
   }
-  return -1;
+  return res;
 }
 
 #undef AVIOUT4
@@ -264,46 +1525,87 @@ quit:
 
 
 int zmbv_avi_write_chunk (zmbv_avi_t zavi, const char tag[4], uint32_t size, const void *data, uint32_t flags) {
-  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && (size == 0 || data != NULL)) {
+#ifdef ZMBV_USE_THREADS
+  // report failures of the writer thread
+  if (zavi != NULL && zmbv_avi_async_failed(zavi)) zavi->was_file_error = 1;
+#endif
+#ifdef ZMBV_USE_IO_URING
+  // report failed writes that completed since the last call
+  if (zavi != NULL && zavi->uring >= 0 && zmbv_avi_uring_reap(zavi, 0) < 0) zavi->was_file_error = 1;
+#endif
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && (size == 0 || data != NULL) && size <= AVI_MAX_CHUNK) {
     uint8_t chunk[8];
     uint8_t *index;
     uint32_t pos, writesize, d;
+    static const uint8_t pad = 0;
+    struct iovec iov[3];
+    int iovcnt = 0;
+    zmbv_avi_stream_t *st = NULL;
+    uint64_t pending;
+    ZMBV_TRACE_BEGIN(ttime);
+    // standard index entries go to the stream with this number
+    if (tag[0] >= '0' && tag[0] <= '9' && tag[1] >= '0' && tag[1] <= '9' && (tag[0]-'0')*10+(tag[1]-'0') < AVI_STREAMS) {
+      st = &zavi->streams[(tag[0]-'0')*10+(tag[1]-'0')];
+    }
+    writesize = (size+1)&~1;
+    // start new RIFF when this one gets too big, counting in indexes still to be written
+    pending = 8+writesize;
+    for (int f = 0; f < AVI_STREAMS; ++f) pending += 32+(zavi->streams[f].ixused+1)*8;
+    if (zavi->segcount == 1) pending += 8+zavi->indexbytes+16;
+    if (zavi->filepos-zavi->segstart+pending > AVI_RIFF_LIMIT) {
+      if (zmbv_avi_close_segment(zavi) < 0 || zmbv_avi_open_segment(zavi) < 0) goto error;
+    }
     chunk[0] = tag[0];
     chunk[1] = tag[1];
     chunk[2] = tag[2];
     chunk[3] = tag[3];
     d = HTOLE32(size);
     memcpy(&chunk[4], &d, 4);
+    if (st != NULL) {
+      zmbv_avi_ixentry_t *ie;
+      if (st->ixused == st->ixsize) {
+        zmbv_avi_ixentry_t *ni = zmbv_avi_realloc(zavi, st->ix, (st->ixsize+4096)*sizeof(st->ix[0]));
+        if (ni == NULL) goto error;
+        st->ix = ni;
+        st->ixsize += 4096;
+      }
+      ie = &st->ix[st->ixused++];
+      // offset of chunk data from segment start; bit 31 of size marks delta frames
+      ie->offset = HTOLE32((uint32_t)(zavi->filepos-zavi->segstart+8));
+      ie->size = HTOLE32(size|((flags&0x10) || (tag[2] == 'w' && tag[3] == 'b') ? 0 : 0x80000000u));
+      d = (tag[2] == 'w' && tag[3] == 'b' ? size/zavi->audioalign : 1);
+      st->ixduration += d;
+      st->segduration += d;
+    }
     // write the actual data
-    if (write(zavi->fd, chunk, 8) != 8) goto error;
-    writesize = (size+1)&~1;
-    if (size > 0 && write(zavi->fd, data, size) != size) goto error;
+    iov[iovcnt].iov_base = chunk;
+    iov[iovcnt++].iov_len = 8;
+    if (size > 0) {
+      iov[iovcnt].iov_base = (void *)data;
+      iov[iovcnt++].iov_len = size;
+    }
     if (writesize != size) {
-      uint8_t b;
-      if (writesize-size != 1) abort(); // just in case
-      b = 0;
-      if (write(zavi->fd, &b, 1) != 1) goto error;
+      iov[iovcnt].iov_base = (void *)&pad;
+      iov[iovcnt++].iov_len = 1;
     }
+    if (zmbv_avi_put(zavi, iov, iovcnt) < 0) goto error;
     pos = zavi->written+4;
     zavi->written += writesize+8;
-    if (zavi->indexused+16 >= zavi->indexsize) {
-      uint8_t *ni = realloc(zavi->index, zavi->indexsize+16*4096);
-      if (ni == NULL) goto error;
-      zavi->index = ni;
-      zavi->indexsize += 16*4096;
-    }
-    index = zavi->index+zavi->indexused;
-    zavi->indexused += 16;
-    index[0] = tag[0];
-    index[1] = tag[1];
-    index[2] = tag[2];
-    index[3] = tag[3];
-    d = HTOLE32(flags);
-    memcpy(index+4, &d, 4);
-    d = HTOLE32(pos);
-    memcpy(index+8, &d, 4);
-    d = HTOLE32(size);
-    memcpy(index+12, &d, 4);
+    // idx1 only covers the first RIFF
+    if (zavi->segcount == 1) {
+      if ((index = zmbv_avi_index_entry(zavi)) == NULL) goto error;
+      index[0] = tag[0];
+      index[1] = tag[1];
+      index[2] = tag[2];
+      index[3] = tag[3];
+      d = HTOLE32(flags);
+      memcpy(index+4, &d, 4);
+      d = HTOLE32(pos);
+      memcpy(index+8, &d, 4);
+      d = HTOLE32(size);
+      memcpy(index+12, &d, 4);
+    }
+    ZMBV_TRACE_END(ZMBV_TRACE_AVI_CHUNK, (int)zavi->frames, ttime);
     return 0;
 error:
     zavi->was_file_error = 1;
@@ -317,23 +1619,67 @@ int zmbv_avi_write_chunk_video (zmbv_avi_t zavi, const void *framedata, int size
   if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && size > 1 && framedata != NULL) {
     uint8_t b;
     memcpy(&b, framedata, 1);
+    // audio collected for the previous frames goes in front of this one
+    if (zavi->audiointerleave > 0 && zavi->audioused >= (uint32_t)zavi->audioalign && zavi->frames-zavi->audioframe >= (uint32_t)zavi->audiointerleave) {
+      if (zmbv_avi_flush_audio(zavi, 0) < 0) return -1;
+    }
     res = zmbv_avi_write_chunk(zavi, "00dc", size, framedata, (b&0x01 ? 0x10 : 0));
     if (res == 0) ++zavi->frames;
+    if (res == 0 && zavi->ckpt_frames > 0 && zavi->frames >= zavi->ckpt_next) {
+      zavi->ckpt_next = zavi->frames+zavi->ckpt_frames;
+      res = zmbv_avi_checkpoint(zavi);
+    }
   }
   return res;
 }
 
 
+int zmbv_avi_set_audio_format (zmbv_avi_t zavi, int channels, int bits) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && channels >= 1 && channels <= 8 &&
+      (bits == 8 || bits == 16 || bits == 24 || bits == 32)) {
+    // the format is for the whole stream
+    if (zavi->audiowritten > 0 || zavi->audioused > 0) return -1;
+    zavi->audiochannels = channels;
+    zavi->audiobits = bits;
+    zavi->audioalign = channels*bits/8;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_avi_set_audio_interleave (zmbv_avi_t zavi, int frames) {
+  if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && frames >= 0) {
+    if (frames == 0 && zmbv_avi_flush_audio(zavi, 0) < 0) return -1;
+    zavi->audiointerleave = frames;
+    return 0;
+  }
+  return -1;
+}
+
+
 int zmbv_avi_write_chunk_audio (zmbv_avi_t zavi, const void *data, int size) {
   if (zavi != NULL && zavi->fd >= 0 && !zavi->was_file_error && (size == 0 || data != NULL)) {
     if (size < 0) return -1;
     if (size == 0) return 0;
-    //int res = zmbv_avi_write_chunk(zavi, "01wb", zavi->audioused*4, zavi->audiobuf, 0);
-    int res = zmbv_avi_write_chunk(zavi, "01wb", size, data, 0);
-    //zavi->audiowritten = zavi->audioused*4;
-    zavi->audiowritten = size;
-    //zavi->audioused = 0;
-    return res;
+    if (zavi->audiointerleave == 0 && zavi->audioused == 0 && size%zavi->audioalign == 0) {
+      if (zmbv_avi_write_chunk(zavi, "01wb", size, data, 0) < 0) return -1;
+      zavi->audiowritten += size;
+      return 0;
+    }
+    if (zavi->audioused+(uint64_t)size > AVI_MAX_CHUNK) return -1;
+    if (zavi->audioused+size > zavi->audiobufsize) {
+      uint32_t newsize = (zavi->audiobufsize ? zavi->audiobufsize : 65536);
+      uint8_t *nb;
+      while (newsize < zavi->audioused+size) newsize *= 2;
+      if ((nb = zmbv_avi_realloc(zavi, zavi->audiobuf, newsize)) == NULL) return -1;
+      zavi->audiobuf = nb;
+      zavi->audiobufsize = newsize;
+    }
+    memcpy(zavi->audiobuf+zavi->audioused, data, size);
+    zavi->audioused += size;
+    if (zavi->audiointerleave == 0) return zmbv_avi_flush_audio(zavi, 0);
+    return 0;
   }
   return -1;
 }
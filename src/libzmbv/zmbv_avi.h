@@ -25,12 +25,86 @@ extern "C" {
 
 #include <stdint.h>
 
+#include "zmbv_alloc.h"
+
 
 typedef struct zmbv_avi_s *zmbv_avi_t;
 
-extern zmbv_avi_t zmbv_avi_start (const char *fname, int width, int height, double fps, int audiorate);
+/* `alloc` is used for the writer and all its buffers and indexes; NULL: stdlib */
+/* returns NULL on error */
+extern zmbv_avi_t zmbv_avi_start (const char *fname, int width, int height, double fps, int audiorate, const zmbv_allocator_t *alloc);
 extern int zmbv_avi_stop (zmbv_avi_t zavi);
 
+/* chunks are collected in a `bytes` sized buffer and written out when it fills up, */
+/* or on the first write after the oldest buffered chunk got `msecs` old (0: no time limit); */
+/* chunks that don't fit go out in one writev() together with the buffered data */
+/* `bytes` 0 disables buffering; default is 256KB, no time limit */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_set_flush_policy (zmbv_avi_t zavi, uint32_t bytes, int msecs);
+/* write out buffered chunks */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_flush (zmbv_avi_t zavi);
+
+/* async mode: chunks are copied into a queue of `depth` buffers and written by a */
+/* separate thread; caller waits only when the queue is full; 0 goes back to direct writes */
+/* writer thread errors are reported by the next write call or by zmbv_avi_stop() */
+/* needs the library to be built with ZMBV_USE_THREADS */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_set_async (zmbv_avi_t zavi, int depth);
+
+/* io_uring mode: `depth` write buffers are registered with a ring and written without */
+/* waiting; chunks too big for a buffer go out as linked header/payload/padding writes */
+/* needs the library to be built with ZMBV_USE_IO_URING (Linux only), and buffering on; */
+/* can't be used together with async mode; 0 goes back to write() */
+/* return <0 on error; 0 on ok; 1 if io_uring is not available (writer keeps using write()) */
+extern int zmbv_avi_set_io_uring (zmbv_avi_t zavi, int depth);
+
+/* reserve file space `bytes` at a time (rounded up to 1MB; 0: off, the default), so files */
+/* written in parallel get long extents; zmbv_avi_stop() frees what was not used; on Linux the */
+/* reserved space past the end doesn't count in the file size where the filesystem supports that */
+/* return <0 on error; 0 on ok; 1 if not supported on this platform */
+extern int zmbv_avi_set_prealloc (zmbv_avi_t zavi, uint64_t bytes);
+/* !0: drop written data from the page cache (posix_fadvise(DONTNEED) some MBs behind) */
+/* return <0 on error; 0 on ok; 1 if not supported on this platform */
+extern int zmbv_avi_set_drop_cache (zmbv_avi_t zavi, int on);
+
+/* idx1 entries (16 bytes per chunk of the first RIFF) are kept in memory by default; */
+/* this streams them to `fname` instead, keeping one 64KB block in memory */
+/* the file is copied into the AVI when the first RIFF is closed, and removed */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_set_index_spill (zmbv_avi_t zavi, const char *fname);
+
+typedef struct {
+  int capacity; /* queue depth; 0: not in async mode */
+  int depth; /* buffers waiting to be written now */
+  int max_depth; /* highest depth seen */
+  uint64_t bytes; /* bytes waiting to be written now */
+  uint64_t waits; /* times the caller had to wait for a free buffer */
+} zmbv_avi_queue_stats_t;
+
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_get_queue_stats (zmbv_avi_t zavi, zmbv_avi_queue_stats_t *stats);
+
+/* crash safety: every `frames` video frames index what was written so far (ix00/ix01 chunks), */
+/* wait for the data to reach the file and rewrite the header with current counts, so the */
+/* file is playable up to the last checkpoint; fsync every `syncevery` checkpoints (0: never) */
+/* call before writing the first chunk to get room for more checkpoints; 0 frames: off */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_set_checkpoint (zmbv_avi_t zavi, int frames, int syncevery);
+/* checkpoint now */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_checkpoint (zmbv_avi_t zavi);
+
+/* PCM format of audio chunks: 1-8 channels of 8, 16, 24 or 32 bit samples; */
+/* default is 16-bit stereo; can't be changed after audio was written */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_set_audio_format (zmbv_avi_t zavi, int channels, int bits);
+/* audio is collected and written as one chunk, in front of the video frame that comes */
+/* `frames` video frames after the previous audio chunk; default is 1 */
+/* 0 writes audio chunks right away; incomplete sample frames are held back */
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_set_audio_interleave (zmbv_avi_t zavi, int frames);
+
 extern int zmbv_avi_write_chunk (zmbv_avi_t zavi, const char tag[4], uint32_t size, const void *data, uint32_t flags);
 
 extern int zmbv_avi_write_chunk_video (zmbv_avi_t zavi, const void *framedata, int size);
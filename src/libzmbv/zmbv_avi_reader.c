@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#include "zmbv_avi_reader.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* AVIIF_KEYFRAME in idx1 */
+#define AVI_IDX1_KEY  (0x10)
+/* bit 31 of ix## entry size marks delta frames */
+#define AVI_IX_DELTA  (0x80000000u)
+
+
+typedef struct {
+  uint64_t offset; /* of payload */
+  uint32_t size;
+  uint32_t key;
+} zmbv_avi_rentry_t;
+
+typedef struct {
+  int num; /* stream number in chunk tags; <0: no such stream */
+  zmbv_avi_rentry_t *ent;
+  int count, alloted;
+  uint64_t indx; /* super index payload offset; 0: none */
+  uint32_t indxsize;
+} zmbv_avi_rstream_t;
+
+typedef struct {
+  uint64_t start; /* first chunk */
+  uint64_t end;
+} zmbv_avi_movi_t;
+
+struct zmbv_avi_reader_s {
+  const uint8_t *map;
+  uint64_t size;
+#ifdef _WIN32
+  HANDLE fh, mh;
+#endif
+  zmbv_avi_info_t info;
+  int zmbv; /* video is ZMBV: keyframes can be told by the payload */
+  zmbv_avi_rstream_t streams[2];
+  zmbv_avi_movi_t *movis; /* movi lists of all RIFFs */
+  int movicount, movisize;
+  uint64_t idx1; /* idx1 payload offset; 0: none */
+  uint32_t idx1size;
+  int *keys; /* video keyframe numbers, ascending */
+  int keycount;
+};
+
+
+/******************************************************************************/
+static inline uint16_t zmbv_avi_rd16 (zmbv_avi_reader_t zr, uint64_t ofs) {
+  const uint8_t *p = zr->map+ofs;
+  return p[0]|(p[1]<<8);
+}
+
+static inline uint32_t zmbv_avi_rd32 (zmbv_avi_reader_t zr, uint64_t ofs) {
+  const uint8_t *p = zr->map+ofs;
+  return p[0]|(p[1]<<8)|(p[2]<<16)|((uint32_t)p[3]<<24);
+}
+
+static inline uint64_t zmbv_avi_rd64 (zmbv_avi_reader_t zr, uint64_t ofs) {
+  return zmbv_avi_rd32(zr, ofs)|((uint64_t)zmbv_avi_rd32(zr, ofs+4)<<32);
+}
+
+static inline int zmbv_avi_is4 (zmbv_avi_reader_t zr, uint64_t ofs, const char *tag) {
+  return (memcmp(zr->map+ofs, tag, 4) == 0);
+}
+
+
+/* stream number from chunk tag like "00dc"; <0: not a stream chunk */
+static int zmbv_avi_tag_stream (zmbv_avi_reader_t zr, uint64_t ofs) {
+  const uint8_t *p = zr->map+ofs;
+  if (p[0] < '0' || p[0] > '9' || p[1] < '0' || p[1] > '9') return -1;
+  return (p[0]-'0')*10+(p[1]-'0');
+}
+
+
+/* stream type the chunk belongs to; <0: none */
+static int zmbv_avi_tag_type (zmbv_avi_reader_t zr, uint64_t ofs) {
+  int num = zmbv_avi_tag_stream(zr, ofs);
+  if (num < 0) return -1;
+  for (int f = 0; f < 2; ++f) if (zr->streams[f].num == num) return f;
+  return -1;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_add_entry (zmbv_avi_reader_t zr, int type, uint64_t ofs, uint32_t size, int key) {
+  zmbv_avi_rstream_t *st = &zr->streams[type];
+  zmbv_avi_rentry_t *e;
+  // damaged or truncated files: stop at chunks that are not there
+  if (ofs > zr->size || size > zr->size-ofs) return -1;
+  if (st->count == st->alloted) {
+    int newsize = (st->alloted ? st->alloted*2 : 4096);
+    zmbv_avi_rentry_t *ne = realloc(st->ent, newsize*sizeof(ne[0]));
+    if (ne == NULL) return -1;
+    st->ent = ne;
+    st->alloted = newsize;
+  }
+  e = &st->ent[st->count++];
+  e->offset = ofs;
+  e->size = size;
+  e->key = (type == ZMBV_AVI_AUDIO || key);
+  return 0;
+}
+
+
+/******************************************************************************/
+/* stream list: strh, strf and indx */
+static void zmbv_avi_parse_strl (zmbv_avi_reader_t zr, uint64_t pos, uint64_t end, int num) {
+  int type = -1;
+  while (pos+8 <= end) {
+    uint32_t sz = zmbv_avi_rd32(zr, pos+4);
+    uint64_t data = pos+8;
+    if (sz > end-data) break;
+    if (zmbv_avi_is4(zr, pos, "strh") && sz >= 28) {
+      uint32_t scale = zmbv_avi_rd32(zr, data+20), rate = zmbv_avi_rd32(zr, data+24);
+      if (zmbv_avi_is4(zr, data, "vids") && zr->streams[ZMBV_AVI_VIDEO].num < 0) {
+        type = ZMBV_AVI_VIDEO;
+        if (scale > 0) zr->info.fps = (double)rate/scale;
+      } else if (zmbv_avi_is4(zr, data, "auds") && zr->streams[ZMBV_AVI_AUDIO].num < 0) {
+        type = ZMBV_AVI_AUDIO;
+        zr->info.has_audio = 1;
+      }
+      if (type >= 0) zr->streams[type].num = num;
+    } else if (zmbv_avi_is4(zr, pos, "strf") && type == ZMBV_AVI_VIDEO && sz >= 20) {
+      int32_t h = (int32_t)zmbv_avi_rd32(zr, data+8);
+      zr->info.width = (int32_t)zmbv_avi_rd32(zr, data+4);
+      zr->info.height = (h < 0 ? -h : h);
+      memcpy(zr->info.codec, zr->map+data+16, 4);
+      zr->info.codec[4] = 0;
+      zr->zmbv = (memcmp(zr->info.codec, "ZMBV", 4) == 0);
+    } else if (zmbv_avi_is4(zr, pos, "strf") && type == ZMBV_AVI_AUDIO && sz >= 16) {
+      zr->info.audiochannels = zmbv_avi_rd16(zr, data+2);
+      zr->info.audiorate = zmbv_avi_rd32(zr, data+4);
+      zr->info.audioalign = zmbv_avi_rd16(zr, data+12);
+      zr->info.audiobits = zmbv_avi_rd16(zr, data+14);
+    } else if (zmbv_avi_is4(zr, pos, "indx") && type >= 0 && sz >= 24) {
+      zr->streams[type].indx = data;
+      zr->streams[type].indxsize = sz;
+    }
+    pos = data+sz+(sz&1);
+  }
+}
+
+
+/* walk header list looking for stream lists */
+static void zmbv_avi_parse_hdrl (zmbv_avi_reader_t zr, uint64_t pos, uint64_t end) {
+  int num = 0;
+  while (pos+8 <= end) {
+    uint32_t sz = zmbv_avi_rd32(zr, pos+4);
+    if (sz > end-pos-8) break;
+    if (zmbv_avi_is4(zr, pos, "LIST") && sz >= 4 && zmbv_avi_is4(zr, pos+8, "strl")) {
+      zmbv_avi_parse_strl(zr, pos+12, pos+8+sz, num++);
+    }
+    pos += 8+sz+(sz&1);
+  }
+}
+
+
+/* walk RIFF-AVI and RIFF-AVIX chunks */
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_parse_riffs (zmbv_avi_reader_t zr) {
+  uint64_t riff = 0;
+  int hdrl = 0;
+  while (riff+12 <= zr->size && zmbv_avi_is4(zr, riff, "RIFF")) {
+    uint64_t pos = riff+12, end = riff+8+zmbv_avi_rd32(zr, riff+4);
+    if (riff == 0 ? !zmbv_avi_is4(zr, 8, "AVI ") : !zmbv_avi_is4(zr, riff+8, "AVIX")) break;
+    // crashed recordings may claim more than there is
+    if (end > zr->size) end = zr->size;
+    while (pos+8 <= end) {
+      uint32_t sz = zmbv_avi_rd32(zr, pos+4);
+      uint64_t cend = pos+8+sz;
+      if (cend > end) cend = end;
+      if (zmbv_avi_is4(zr, pos, "LIST") && sz >= 4 && pos+12 <= end) {
+        if (zmbv_avi_is4(zr, pos+8, "hdrl") && !hdrl) {
+          zmbv_avi_parse_hdrl(zr, pos+12, cend);
+          hdrl = 1;
+        } else if (zmbv_avi_is4(zr, pos+8, "movi")) {
+          if (zr->movicount == zr->movisize) {
+            zmbv_avi_movi_t *nm = realloc(zr->movis, (zr->movisize+16)*sizeof(nm[0]));
+            if (nm == NULL) return -1;
+            zr->movis = nm;
+            zr->movisize += 16;
+          }
+          zr->movis[zr->movicount].start = pos+12;
+          zr->movis[zr->movicount].end = cend;
+          ++zr->movicount;
+        }
+      } else if (zmbv_avi_is4(zr, pos, "idx1") && riff == 0) {
+        zr->idx1 = pos+8;
+        zr->idx1size = cend-pos-8;
+      }
+      pos += 8+(uint64_t)sz+(sz&1);
+    }
+    riff = end+(end&1);
+  }
+  return (hdrl && zr->streams[ZMBV_AVI_VIDEO].num >= 0 ? 0 : -1);
+}
+
+
+/******************************************************************************/
+/* OpenDML: super index -> standard indexes */
+static void zmbv_avi_load_indx (zmbv_avi_reader_t zr, int type) {
+  zmbv_avi_rstream_t *st = &zr->streams[type];
+  uint32_t used = zmbv_avi_rd32(zr, st->indx+4);
+  if (zmbv_avi_rd16(zr, st->indx) != 4 || zr->map[st->indx+3] != 0) return; // not an index of indexes
+  if (used > (st->indxsize-24)/16) used = (st->indxsize-24)/16;
+  for (uint32_t f = 0; f < used; ++f) {
+    uint64_t ix = zmbv_avi_rd64(zr, st->indx+24+f*16);
+    uint32_t n, sz;
+    uint64_t base;
+    if (ix > zr->size || zr->size-ix < 32 || zmbv_avi_rd16(zr, ix+8) != 2 || zr->map[ix+11] != 1) return;
+    sz = zmbv_avi_rd32(zr, ix+4);
+    n = zmbv_avi_rd32(zr, ix+12);
+    if (sz < 24 || sz > zr->size-ix-8 || n > (sz-24)/8) return;
+    base = zmbv_avi_rd64(zr, ix+20);
+    for (uint32_t e = 0; e < n; ++e) {
+      uint32_t eo = zmbv_avi_rd32(zr, ix+32+e*8), es = zmbv_avi_rd32(zr, ix+32+e*8+4);
+      if (zmbv_avi_add_entry(zr, type, base+eo, es&~AVI_IX_DELTA, !(es&AVI_IX_DELTA)) < 0) return;
+    }
+  }
+}
+
+
+/* AVI 1.0 index; offsets are from the 'movi' fourcc, or from the file start in some writers */
+static void zmbv_avi_load_idx1 (zmbv_avi_reader_t zr, const int *want) {
+  uint64_t base;
+  uint32_t n = zr->idx1size/16;
+  if (n == 0 || zr->movicount == 0) return;
+  base = zr->movis[0].start-4;
+  {
+    uint64_t first = zmbv_avi_rd32(zr, zr->idx1+8);
+    if (base+first+8 > zr->size || memcmp(zr->map+base+first, zr->map+zr->idx1, 4) != 0) base = 0;
+  }
+  for (uint32_t f = 0; f < n; ++f) {
+    uint64_t e = zr->idx1+f*16;
+    uint64_t ofs = base+zmbv_avi_rd32(zr, e+8);
+    int type = zmbv_avi_tag_type(zr, e);
+    if (type < 0 || !want[type]) continue;
+    if (ofs+8 > zr->size || memcmp(zr->map+ofs, zr->map+e, 4) != 0) break;
+    if (zmbv_avi_add_entry(zr, type, ofs+8, zmbv_avi_rd32(zr, e+12), zmbv_avi_rd32(zr, e+4)&AVI_IDX1_KEY) < 0) break;
+  }
+}
+
+
+/* no index: walk the movi lists, starting from list `first` */
+static void zmbv_avi_scan_movi (zmbv_avi_reader_t zr, const int *want, int first) {
+  for (int m = first; m < zr->movicount; ++m) {
+    uint64_t pos = zr->movis[m].start, end = zr->movis[m].end;
+    while (pos+8 <= end) {
+      uint32_t sz = zmbv_avi_rd32(zr, pos+4);
+      int type;
+      if (zmbv_avi_is4(zr, pos, "LIST")) { pos += 12; continue; } // 'rec ' lists
+      if (sz > end-pos-8) break; // truncated chunk: the recording ends here
+      type = zmbv_avi_tag_type(zr, pos);
+      if (type >= 0 && want[type]) {
+        int key = (type == ZMBV_AVI_VIDEO && zr->zmbv ? (sz > 0 && (zr->map[pos+8]&0x01)) : 1);
+        if (zmbv_avi_add_entry(zr, type, pos+8, sz, key) < 0) return;
+      }
+      pos += 8+(uint64_t)sz+(sz&1);
+    }
+  }
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_avi_load_index (zmbv_avi_reader_t zr) {
+  int want[2] = {0, 0};
+  zmbv_avi_rstream_t *vs = &zr->streams[ZMBV_AVI_VIDEO];
+  // streams that got nothing from the better index try the next one
+  for (int f = 0; f < 2; ++f) {
+    if (zr->streams[f].num < 0) continue;
+    if (zr->streams[f].indx) zmbv_avi_load_indx(zr, f);
+    want[f] = (zr->streams[f].count == 0);
+  }
+  if ((want[0] || want[1]) && zr->idx1) {
+    int rest[2];
+    zmbv_avi_load_idx1(zr, want);
+    for (int f = 0; f < 2; ++f) {
+      rest[f] = (want[f] && zr->streams[f].count > 0);
+      want[f] = (want[f] && zr->streams[f].count == 0);
+    }
+    // idx1 only covers the first RIFF
+    if (rest[0] || rest[1]) zmbv_avi_scan_movi(zr, rest, 1);
+  }
+  if (want[0] || want[1]) zmbv_avi_scan_movi(zr, want, 0);
+  // keyframe list for seeking
+  if (vs->count > 0) {
+    if ((zr->keys = malloc(vs->count*sizeof(zr->keys[0]))) == NULL) return -1;
+    for (int f = 0; f < vs->count; ++f) if (vs->ent[f].key) zr->keys[zr->keycount++] = f;
+  }
+  return 0;
+}
+
+
+/******************************************************************************/
+zmbv_avi_reader_t zmbv_avi_reader_open (const char *fname) {
+  if (fname != NULL && fname[0]) {
+    zmbv_avi_reader_t zr = malloc(sizeof(*zr));
+    if (zr == NULL) return NULL;
+    memset(zr, 0, sizeof(*zr));
+    zr->streams[0].num = zr->streams[1].num = -1;
+#ifdef _WIN32
+    {
+      LARGE_INTEGER sz;
+      zr->fh = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (zr->fh == INVALID_HANDLE_VALUE) { free(zr); return NULL; }
+      if (!GetFileSizeEx(zr->fh, &sz) || sz.QuadPart < 12) goto error;
+      zr->size = sz.QuadPart;
+      if ((zr->mh = CreateFileMappingA(zr->fh, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL) goto error;
+      if ((zr->map = MapViewOfFile(zr->mh, FILE_MAP_READ, 0, 0, 0)) == NULL) goto error;
+    }
+#else
+    {
+      struct stat st;
+      void *map;
+      int fd = open(fname, O_RDONLY|O_CLOEXEC|O_BINARY);
+      if (fd < 0) { free(zr); return NULL; }
+      if (fstat(fd, &st) != 0 || st.st_size < 12 || (uint64_t)st.st_size > (size_t)-1) { close(fd); free(zr); return NULL; }
+      zr->size = st.st_size;
+      map = mmap(NULL, zr->size, PROT_READ, MAP_SHARED, fd, 0);
+      // the mapping keeps the file
+      close(fd);
+      if (map == MAP_FAILED) { free(zr); return NULL; }
+      zr->map = map;
+    }
+#endif
+    if (zmbv_avi_parse_riffs(zr) < 0) goto error;
+    if (zmbv_avi_load_index(zr) < 0) goto error;
+    return zr;
+error:
+    zmbv_avi_reader_close(zr);
+  }
+  return NULL;
+}
+
+
+void zmbv_avi_reader_close (zmbv_avi_reader_t zr) {
+  if (zr != NULL) {
+#ifdef _WIN32
+    if (zr->map != NULL) UnmapViewOfFile(zr->map);
+    if (zr->mh != NULL) CloseHandle(zr->mh);
+    if (zr->fh != INVALID_HANDLE_VALUE && zr->fh != NULL) CloseHandle(zr->fh);
+#else
+    if (zr->map != NULL) munmap((void *)zr->map, zr->size);
+#endif
+    for (int f = 0; f < 2; ++f) if (zr->streams[f].ent != NULL) free(zr->streams[f].ent);
+    if (zr->movis != NULL) free(zr->movis);
+    if (zr->keys != NULL) free(zr->keys);
+    free(zr);
+  }
+}
+
+
+int zmbv_avi_reader_get_info (zmbv_avi_reader_t zr, zmbv_avi_info_t *info) {
+  if (zr != NULL && info != NULL) {
+    *info = zr->info;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_avi_reader_chunk_count (zmbv_avi_reader_t zr, zmbv_avi_stream_type_t stream) {
+  if (zr != NULL && (stream == ZMBV_AVI_VIDEO || stream == ZMBV_AVI_AUDIO)) return zr->streams[stream].count;
+  return -1;
+}
+
+
+int zmbv_avi_reader_get_chunk (zmbv_avi_reader_t zr, zmbv_avi_stream_type_t stream, int n, zmbv_avi_chunk_t *chunk) {
+  if (zr != NULL && chunk != NULL && (stream == ZMBV_AVI_VIDEO || stream == ZMBV_AVI_AUDIO) && n >= 0 && n < zr->streams[stream].count) {
+    const zmbv_avi_rentry_t *e = &zr->streams[stream].ent[n];
+    chunk->data = zr->map+e->offset;
+    chunk->size = e->size;
+    chunk->keyframe = e->key;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_avi_reader_keyframe_before (zmbv_avi_reader_t zr, int n) {
+  if (zr != NULL && n >= 0 && n < zr->streams[ZMBV_AVI_VIDEO].count && zr->keycount > 0) {
+    int lo = 0, hi = zr->keycount-1;
+    if (zr->keys[0] > n) return -1;
+    while (lo < hi) {
+      int mid = (lo+hi+1)/2;
+      if (zr->keys[mid] <= n) lo = mid; else hi = mid-1;
+    }
+    return zr->keys[lo];
+  }
+  return -1;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#ifndef ZMBVC_AVI_READER_H
+#define ZMBVC_AVI_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+/* AVI demuxer: the file is mapped into memory, and chunk payloads are returned as */
+/* pointers into the mapping; chunks are found through OpenDML indexes (indx/ix##) */
+/* when there are any, then idx1, then by walking the movi lists */
+typedef struct zmbv_avi_reader_s *zmbv_avi_reader_t;
+
+typedef enum {
+  ZMBV_AVI_VIDEO = 0,
+  ZMBV_AVI_AUDIO = 1
+} zmbv_avi_stream_type_t;
+
+typedef struct {
+  int width, height;
+  double fps;
+  char codec[5]; /* video fourcc, like "ZMBV" */
+  int has_audio;
+  int audiorate; /* samples per second */
+  int audiochannels;
+  int audiobits;
+  int audioalign; /* bytes per sample frame */
+} zmbv_avi_info_t;
+
+typedef struct {
+  const void *data; /* points into the mapped file; valid until zmbv_avi_reader_close() */
+  uint32_t size;
+  int keyframe; /* audio chunks are always keyframes */
+} zmbv_avi_chunk_t;
+
+/* returns NULL on error */
+extern zmbv_avi_reader_t zmbv_avi_reader_open (const char *fname);
+extern void zmbv_avi_reader_close (zmbv_avi_reader_t zr);
+
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_reader_get_info (zmbv_avi_reader_t zr, zmbv_avi_info_t *info);
+
+/* <0: error */
+extern int zmbv_avi_reader_chunk_count (zmbv_avi_reader_t zr, zmbv_avi_stream_type_t stream);
+/* return <0 on error; 0 on ok */
+extern int zmbv_avi_reader_get_chunk (zmbv_avi_reader_t zr, zmbv_avi_stream_type_t stream, int n, zmbv_avi_chunk_t *chunk);
+/* number of the last video keyframe at or before frame `n`; <0: error or no keyframe */
+extern int zmbv_avi_reader_keyframe_before (zmbv_avi_reader_t zr, int n);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
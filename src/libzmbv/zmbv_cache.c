@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#include "zmbv_cache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct {
+  int frame;
+  uint32_t used; /* LRU tick */
+  size_t size;
+  void *data;
+} zmbv_cache_entry_t;
+
+struct zmbv_cache_s {
+  zmbv_cache_free_fn freefn;
+  size_t budget;
+  size_t total;
+  uint32_t tick;
+  /* sorted by frame number */
+  zmbv_cache_entry_t *entries;
+  int count, alloted;
+};
+
+
+/******************************************************************************/
+zmbv_cache_t zmbv_cache_new (size_t budget, zmbv_cache_free_fn freefn) {
+  zmbv_cache_t cc = malloc(sizeof(*cc));
+  if (cc != NULL) {
+    memset(cc, 0, sizeof(*cc));
+    cc->freefn = freefn;
+    cc->budget = budget;
+  }
+  return cc;
+}
+
+
+static void zmbv_cache_drop (zmbv_cache_t cc, int idx) {
+  if (cc->freefn != NULL) cc->freefn(cc->entries[idx].data);
+  cc->total -= cc->entries[idx].size;
+  --cc->count;
+  memmove(cc->entries+idx, cc->entries+idx+1, (cc->count-idx)*sizeof(cc->entries[0]));
+}
+
+
+void zmbv_cache_clear (zmbv_cache_t cc) {
+  if (cc != NULL) {
+    while (cc->count > 0) zmbv_cache_drop(cc, cc->count-1);
+  }
+}
+
+
+void zmbv_cache_free (zmbv_cache_t cc) {
+  if (cc != NULL) {
+    zmbv_cache_clear(cc);
+    if (cc->entries != NULL) free(cc->entries);
+    free(cc);
+  }
+}
+
+
+/* evict until `need` more bytes fit into the budget */
+static void zmbv_cache_evict (zmbv_cache_t cc, size_t need) {
+  while (cc->count > 0 && cc->total+need > cc->budget) {
+    int lru = 0;
+    /* ticks can wrap, so compare distances from now */
+    for (int f = 1; f < cc->count; ++f) {
+      if (cc->tick-cc->entries[f].used > cc->tick-cc->entries[lru].used) lru = f;
+    }
+    zmbv_cache_drop(cc, lru);
+  }
+}
+
+
+int zmbv_cache_set_budget (zmbv_cache_t cc, size_t budget) {
+  if (cc != NULL) {
+    cc->budget = budget;
+    zmbv_cache_evict(cc, 0);
+    return 0;
+  }
+  return -1;
+}
+
+
+/******************************************************************************/
+/* returns index of the first entry with frame number >= `frame` */
+static int zmbv_cache_lower_bound (zmbv_cache_t cc, int frame) {
+  int lo = 0, hi = cc->count;
+  while (lo < hi) {
+    int mid = lo+(hi-lo)/2;
+    if (cc->entries[mid].frame < frame) lo = mid+1; else hi = mid;
+  }
+  return lo;
+}
+
+
+int zmbv_cache_put (zmbv_cache_t cc, int frame, void *data, size_t size) {
+  int idx;
+  if (cc == NULL || data == NULL) return -1;
+  if (size > cc->budget) {
+    if (cc->freefn != NULL) cc->freefn(data);
+    return -1;
+  }
+  idx = zmbv_cache_lower_bound(cc, frame);
+  if (idx < cc->count && cc->entries[idx].frame == frame) zmbv_cache_drop(cc, idx);
+  zmbv_cache_evict(cc, size);
+  if (cc->count == cc->alloted) {
+    int newsz = (cc->alloted ? cc->alloted*2 : 64);
+    zmbv_cache_entry_t *ne = realloc(cc->entries, newsz*sizeof(cc->entries[0]));
+    if (ne == NULL) {
+      if (cc->freefn != NULL) cc->freefn(data);
+      return -1;
+    }
+    cc->entries = ne;
+    cc->alloted = newsz;
+  }
+  /* eviction could move things around */
+  idx = zmbv_cache_lower_bound(cc, frame);
+  memmove(cc->entries+idx+1, cc->entries+idx, (cc->count-idx)*sizeof(cc->entries[0]));
+  cc->entries[idx].frame = frame;
+  cc->entries[idx].used = ++cc->tick;
+  cc->entries[idx].size = size;
+  cc->entries[idx].data = data;
+  cc->total += size;
+  ++cc->count;
+  return 0;
+}
+
+
+void *zmbv_cache_get (zmbv_cache_t cc, int frame) {
+  if (cc != NULL) {
+    int idx = zmbv_cache_lower_bound(cc, frame);
+    if (idx < cc->count && cc->entries[idx].frame == frame) {
+      cc->entries[idx].used = ++cc->tick;
+      return cc->entries[idx].data;
+    }
+  }
+  return NULL;
+}
+
+
+int zmbv_cache_find_nearest (zmbv_cache_t cc, int first, int last, void **data) {
+  if (cc != NULL && first <= last) {
+    /* entry before the first one past `last` */
+    int idx = zmbv_cache_lower_bound(cc, last+1)-1;
+    if (idx >= 0 && cc->entries[idx].frame >= first) {
+      cc->entries[idx].used = ++cc->tick;
+      if (data != NULL) *data = cc->entries[idx].data;
+      return cc->entries[idx].frame;
+    }
+  }
+  return -1;
+}
+
+
+/******************************************************************************/
+int zmbv_cache_count (zmbv_cache_t cc) {
+  return (cc != NULL ? cc->count : -1);
+}
+
+
+int64_t zmbv_cache_used (zmbv_cache_t cc) {
+  return (cc != NULL ? (int64_t)cc->total : -1);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#ifndef ZMBVC_CACHE_H
+#define ZMBVC_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* frame number keyed cache with LRU eviction under a memory budget */
+/* entries are opaque (decoder state snapshots from zmbv_decode_state_save() or */
+/* zmbvu_decode_state_save(), for example); cache owns them and frees with `freefn` */
+typedef struct zmbv_cache_s *zmbv_cache_t;
+
+typedef void (*zmbv_cache_free_fn) (void *data);
+
+/* returns NULL on error */
+extern zmbv_cache_t zmbv_cache_new (size_t budget, zmbv_cache_free_fn freefn);
+extern void zmbv_cache_free (zmbv_cache_t cc);
+extern void zmbv_cache_clear (zmbv_cache_t cc);
+
+/* evicts least recently used entries until the new budget is met */
+/* return <0 on error; 0 on ok */
+extern int zmbv_cache_set_budget (zmbv_cache_t cc, size_t budget);
+
+/* replaces the entry for the same frame; entry bigger than the whole budget is rejected */
+/* cache takes `data` in any case: it is freed on error */
+/* return <0 on error; 0 on ok */
+extern int zmbv_cache_put (zmbv_cache_t cc, int frame, void *data, size_t size);
+/* marks entry as most recently used; NULL if frame is not cached */
+extern void *zmbv_cache_get (zmbv_cache_t cc, int frame);
+/* finds the highest cached frame in [first..last] and marks it as most recently used */
+/* returns frame number or -1 */
+extern int zmbv_cache_find_nearest (zmbv_cache_t cc, int first, int last, void **data);
+
+/* <0: error */
+extern int zmbv_cache_count (zmbv_cache_t cc);
+extern int64_t zmbv_cache_used (zmbv_cache_t cc);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
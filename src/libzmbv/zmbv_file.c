@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#include "zmbv_file.h"
+#include "zmbv_cache.h"
+
+#ifdef ZMBV_INCLUDE_DECODER
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define ZMBV_FILE_HEADER_SIZE  (12)
+
+/* first byte of each packed frame */
+#define ZMBV_FILE_FRAME_KEY  (0x01)
+
+/* with the cache on, every this many frames of a GOP (and the frames seeks stop at) are snapshotted */
+#define ZMBV_FILE_CACHE_STEP  (8)
+
+
+struct zmbv_file_s {
+  int fd;
+  int flags;
+  int count; /* frames */
+  off_t *offsets; /* packed data offsets */
+  uint32_t *sizes; /* packed data sizes */
+  int kfcount;
+  int *keyframes; /* frame numbers, ascending */
+  zmbv_decode_state_t *states; /* one per keyframe, if ZMBV_FILE_FLAG_CACHE_KEYFRAMES */
+  zmbv_cache_t cache; /* snapshots of decoded frames, if enabled */
+  size_t cachebudget;
+  zmbv_codec_t zc;
+  int curframe; /* <0: nothing decoded */
+  uint8_t *packed;
+  uint32_t packedsize;
+};
+
+
+/******************************************************************************/
+static int zmbv_file_read (zmbv_file_t zf, off_t ofs, void *buf, size_t size) {
+  uint8_t *dest = (uint8_t *)buf;
+  while (size > 0) {
+    ssize_t rd = pread(zf->fd, dest, size, ofs);
+    if (rd <= 0) return -1;
+    dest += rd;
+    ofs += rd;
+    size -= rd;
+  }
+  return 0;
+}
+
+
+/* returns frame number or -1 */
+static int zmbv_file_find_record (zmbv_file_t zf, off_t recofs) {
+  int lo = 0, hi = zf->count-1;
+  while (lo <= hi) {
+    int mid = lo+(hi-lo)/2;
+    off_t ofs = zf->offsets[mid]-4;
+    if (ofs == recofs) return mid;
+    if (ofs < recofs) lo = mid+1; else hi = mid-1;
+  }
+  return -1;
+}
+
+
+/* build keyframe list from the index at the end of file */
+/* return <0 on error; 0 on ok */
+static int zmbv_file_load_index (zmbv_file_t zf, const uint8_t *tags, off_t idxofs, off_t fsize) {
+  uint32_t *idx;
+  int entries, last = -1;
+  if (idxofs < ZMBV_FILE_HEADER_SIZE || idxofs >= fsize || (fsize-idxofs)%4 != 0) return -1;
+  entries = (fsize-idxofs)/4;
+  if (entries > zf->count) return -1;
+  idx = malloc(entries*sizeof(idx[0]));
+  if (idx == NULL) return -1;
+  if (zmbv_file_read(zf, idxofs, idx, entries*sizeof(idx[0])) < 0) { free(idx); return -1; }
+  zf->kfcount = 0;
+  for (int f = 0; f < entries; ++f) {
+    int fno = zmbv_file_find_record(zf, idx[f]);
+    /* index entries should point to keyframes, in order */
+    if (fno <= last || (tags[fno]&ZMBV_FILE_FRAME_KEY) == 0) { free(idx); return -1; }
+    zf->keyframes[zf->kfcount++] = last = fno;
+  }
+  free(idx);
+  return (zf->kfcount > 0 ? 0 : -1);
+}
+
+
+zmbv_file_t zmbv_file_open (const char *fname, int width, int height, int flags) {
+  zmbv_file_t zf;
+  uint32_t hdr[3];
+  uint8_t *tags = NULL;
+  struct stat st;
+  off_t pos, limit;
+  if (fname == NULL || !fname[0]) return NULL;
+  zf = malloc(sizeof(*zf));
+  if (zf == NULL) return NULL;
+  memset(zf, 0, sizeof(*zf));
+  zf->flags = flags;
+  zf->curframe = -1;
+  zf->fd = open(fname, O_RDONLY|O_CLOEXEC|O_BINARY);
+  if (zf->fd < 0) { free(zf); return NULL; }
+  if (fstat(zf->fd, &st) != 0) goto error;
+  if (zmbv_file_read(zf, 0, hdr, sizeof(hdr)) < 0) goto error;
+  if (hdr[0] == 0 || hdr[0] > (st.st_size-ZMBV_FILE_HEADER_SIZE)/4) goto error;
+  zf->count = hdr[0];
+  zf->offsets = malloc(zf->count*sizeof(zf->offsets[0]));
+  zf->sizes = malloc(zf->count*sizeof(zf->sizes[0]));
+  zf->keyframes = malloc(zf->count*sizeof(zf->keyframes[0]));
+  tags = malloc(zf->count);
+  if (zf->offsets == NULL || zf->sizes == NULL || zf->keyframes == NULL || tags == NULL) goto error;
+  /* frame records end where the index starts */
+  limit = (hdr[2] >= ZMBV_FILE_HEADER_SIZE && hdr[2] <= st.st_size ? hdr[2] : st.st_size);
+  pos = ZMBV_FILE_HEADER_SIZE;
+  for (int f = 0; f < zf->count; ++f) {
+    uint8_t rec[5];
+    uint32_t size;
+    if (pos+4 > limit || zmbv_file_read(zf, pos, rec, (pos+5 <= limit ? 5 : 4)) < 0) goto error;
+    memcpy(&size, rec, 4);
+    if (size == 0 || size > limit-pos-4) goto error;
+    zf->offsets[f] = pos+4;
+    zf->sizes[f] = size;
+    tags[f] = rec[4];
+    if (size > zf->packedsize) zf->packedsize = size;
+    pos += 4+size;
+  }
+  if (zmbv_file_load_index(zf, tags, hdr[2], st.st_size) < 0) {
+    /* no usable index; use frame tags */
+    zf->kfcount = 0;
+    for (int f = 0; f < zf->count; ++f) if (tags[f]&ZMBV_FILE_FRAME_KEY) zf->keyframes[zf->kfcount++] = f;
+    if (zf->kfcount == 0) goto error;
+  }
+  free(tags);
+  tags = NULL;
+  if (flags&ZMBV_FILE_FLAG_CACHE_KEYFRAMES) {
+    zf->states = calloc(zf->kfcount, sizeof(zf->states[0]));
+    if (zf->states == NULL) goto error;
+  }
+  zf->packed = malloc(zf->packedsize);
+  if (zf->packed == NULL) goto error;
+  zf->zc = zmbv_codec_new(ZMBV_INIT_FLAG_NONE, -1, NULL);
+  if (zf->zc == NULL) goto error;
+  if (zmbv_decode_setup(zf->zc, width, height) < 0) goto error;
+  return zf;
+error:
+  if (tags != NULL) free(tags);
+  zmbv_file_close(zf);
+  return NULL;
+}
+
+
+void zmbv_file_close (zmbv_file_t zf) {
+  if (zf != NULL) {
+    if (zf->fd >= 0) close(zf->fd);
+    if (zf->states != NULL) {
+      for (int f = 0; f < zf->kfcount; ++f) zmbv_decode_state_free(zf->states[f]);
+      free(zf->states);
+    }
+    if (zf->cache != NULL) zmbv_cache_free(zf->cache);
+    if (zf->zc != NULL) zmbv_codec_free(zf->zc);
+    if (zf->packed != NULL) free(zf->packed);
+    if (zf->keyframes != NULL) free(zf->keyframes);
+    if (zf->sizes != NULL) free(zf->sizes);
+    if (zf->offsets != NULL) free(zf->offsets);
+    free(zf);
+  }
+}
+
+
+/******************************************************************************/
+int zmbv_file_frame_count (zmbv_file_t zf) {
+  return (zf != NULL ? zf->count : -1);
+}
+
+
+int zmbv_file_keyframe_count (zmbv_file_t zf) {
+  return (zf != NULL ? zf->kfcount : -1);
+}
+
+
+int zmbv_file_get_frame_number (zmbv_file_t zf) {
+  return (zf != NULL ? zf->curframe : -1);
+}
+
+
+zmbv_codec_t zmbv_file_get_codec (zmbv_file_t zf) {
+  return (zf != NULL ? zf->zc : NULL);
+}
+
+
+static void zmbv_file_state_free (void *data) {
+  zmbv_decode_state_free((zmbv_decode_state_t)data);
+}
+
+
+int zmbv_file_set_cache (zmbv_file_t zf, int64_t budget) {
+  if (zf != NULL && budget >= 0) {
+    if (budget == 0) {
+      if (zf->cache != NULL) zmbv_cache_free(zf->cache);
+      zf->cache = NULL;
+      return 0;
+    }
+    if ((uint64_t)budget > (size_t)-1) budget = (int64_t)((size_t)-1>>1);
+    if (zf->cache != NULL) {
+      if (zmbv_cache_set_budget(zf->cache, (size_t)budget) < 0) return -1;
+    } else {
+      if ((zf->cache = zmbv_cache_new((size_t)budget, zmbv_file_state_free)) == NULL) return -1;
+    }
+    zf->cachebudget = (size_t)budget;
+    return 0;
+  }
+  return -1;
+}
+
+
+/******************************************************************************/
+/* returns keyframe list index of the last keyframe at or before frame `n`; -1 if none */
+static int zmbv_file_find_keyframe (zmbv_file_t zf, int n) {
+  int lo = 0, hi = zf->kfcount-1, res = -1;
+  while (lo <= hi) {
+    int mid = lo+(hi-lo)/2;
+    if (zf->keyframes[mid] <= n) { res = mid; lo = mid+1; } else hi = mid-1;
+  }
+  return res;
+}
+
+
+/* snapshot takes a bit more than the decoded frame */
+static size_t zmbv_file_state_estimate (zmbv_file_t zf) {
+  size_t pixelsize;
+  switch (zmbv_get_decoded_format(zf->zc)) {
+    case ZMBV_FORMAT_8BPP: pixelsize = 1; break;
+    case ZMBV_FORMAT_15BPP: case ZMBV_FORMAT_16BPP: pixelsize = 2; break;
+    default: pixelsize = 4; break;
+  }
+  return (size_t)zmbv_get_width(zf->zc)*zmbv_get_height(zf->zc)*pixelsize;
+}
+
+
+/* `target`: a seek stops at this frame, so it is worth caching */
+/* return <0 on error; 0 on ok */
+static int zmbv_file_decode (zmbv_file_t zf, int n, int target) {
+  int k;
+  if (zmbv_file_read(zf, zf->offsets[n], zf->packed, zf->sizes[n]) < 0 ||
+      zmbv_decode_frame(zf->zc, zf->packed, zf->sizes[n]) < 0) {
+    zf->curframe = -1;
+    return -1;
+  }
+  zf->curframe = n;
+  /* caching is best-effort: failed snapshot only means slower seeks */
+  if (zf->states == NULL && zf->cache == NULL) return 0;
+  if ((k = zmbv_file_find_keyframe(zf, n)) < 0) return 0;
+  if (zf->states != NULL && zf->keyframes[k] == n && (zf->packed[0]&ZMBV_FILE_FRAME_KEY) != 0) {
+    if (zf->states[k] == NULL) zf->states[k] = zmbv_decode_state_save(zf->zc);
+    if (zf->states[k] != NULL) return 0;
+  }
+  /* plain playback only leaves a snapshot every few frames to scrub back to */
+  if (zf->cache != NULL && (target || (n-zf->keyframes[k])%ZMBV_FILE_CACHE_STEP == 0) &&
+      zmbv_file_state_estimate(zf) < zf->cachebudget && zmbv_cache_get(zf->cache, n) == NULL) {
+    zmbv_decode_state_t st = zmbv_decode_state_save(zf->zc);
+    if (st != NULL) zmbv_cache_put(zf->cache, n, st, zmbv_decode_state_memory(st));
+  }
+  return 0;
+}
+
+
+int zmbv_file_seek_to_frame (zmbv_file_t zf, int n) {
+  if (zf != NULL && n >= 0 && n < zf->count) {
+    int k = zmbv_file_find_keyframe(zf, n), kf;
+    if (k < 0) return -1;
+    kf = zf->keyframes[k];
+    if (zf->curframe == n) return 0;
+    if (zf->cache != NULL) {
+      /* closest cached frame of this GOP not past `n`, if it is ahead of the current one */
+      void *st = NULL;
+      int cf = zmbv_cache_find_nearest(zf->cache, (zf->curframe >= kf && zf->curframe < n ? zf->curframe+1 : kf), n, &st);
+      if (cf >= 0) zf->curframe = (zmbv_decode_state_restore(zf->zc, (zmbv_decode_state_t)st) == 0 ? cf : -1);
+    }
+    if (zf->curframe < kf || zf->curframe > n) {
+      /* not in the same GOP, or already past the frame: start over from the keyframe */
+      if (zf->states != NULL && zf->states[k] != NULL && zmbv_decode_state_restore(zf->zc, zf->states[k]) == 0) {
+        zf->curframe = kf;
+      } else if (zmbv_file_decode(zf, kf, (kf == n)) < 0) {
+        return -1;
+      }
+    }
+    while (zf->curframe < n) {
+      if (zmbv_file_decode(zf, zf->curframe+1, (zf->curframe+1 == n)) < 0) return -1;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_file_next_frame (zmbv_file_t zf) {
+  if (zf != NULL) {
+    if (zf->curframe+1 >= zf->count) return 1;
+    /* nothing decoded yet, or the last frame failed: start from the beginning */
+    if (zf->curframe < 0) return zmbv_file_seek_to_frame(zf, 0);
+    return zmbv_file_decode(zf, zf->curframe+1, 0);
+  }
+  return -1;
+}
+
+#endif /* ZMBV_INCLUDE_DECODER */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#ifndef ZMBVC_FILE_H
+#define ZMBVC_FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zmbv.h"
+
+#ifdef ZMBV_INCLUDE_DECODER
+
+/* reader for the raw .zmbv stream files `test` writes:
+ *   uint32_t frame count
+ *   uint32_t keyframe index count (not reliable, not used)
+ *   uint32_t keyframe index offset
+ *   frames: uint32_t size, followed by `size` bytes of packed frame
+ *   keyframe index: uint32_t file offsets of keyframe records, up to the end of file
+ * files without a usable index are still accepted; keyframes are found by frame tags then
+ */
+typedef struct zmbv_file_s *zmbv_file_t;
+
+typedef enum {
+  ZMBV_FILE_FLAG_NONE = 0,
+  /* keep decoder state snapshot for every keyframe seeking passed; */
+  /* this makes seeking back into a known GOP skip the keyframe inflate */
+  ZMBV_FILE_FLAG_CACHE_KEYFRAMES = 0x01
+} zmbv_file_flags_t;
+
+/* .zmbv files do not store frame dimensions, so caller should know them */
+/* returns NULL on error */
+extern zmbv_file_t zmbv_file_open (const char *fname, int width, int height, int flags);
+extern void zmbv_file_close (zmbv_file_t zf);
+
+/* keep decoder state snapshots of decoded frames in a LRU cache limited to `budget` bytes, */
+/* so stepping back or scrubbing inside a GOP restarts from the closest cached frame; */
+/* frames seeks stop at and every 8th frame of a GOP are cached */
+/* 0 turns the cache off (the default) */
+/* return <0 on error; 0 on ok */
+extern int zmbv_file_set_cache (zmbv_file_t zf, int64_t budget);
+
+/* <0: error */
+extern int zmbv_file_frame_count (zmbv_file_t zf);
+extern int zmbv_file_keyframe_count (zmbv_file_t zf);
+
+/* decode frame `n`, starting from the nearest keyframe at or before it */
+/* (or from the current frame, if it is in the same GOP and not past `n`) */
+/* return <0 on error; 0 on ok */
+extern int zmbv_file_seek_to_frame (zmbv_file_t zf, int n);
+/* decode the frame following the current one */
+/* return <0 on error; 0 on ok; 1 if there are no more frames */
+extern int zmbv_file_next_frame (zmbv_file_t zf);
+
+/* number of the last decoded frame; <0: nothing decoded yet */
+extern int zmbv_file_get_frame_number (zmbv_file_t zf);
+/* use zmbv_get_palette() and zmbv_get_decoded_line() on it to get the frame */
+extern zmbv_codec_t zmbv_file_get_codec (zmbv_file_t zf);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif
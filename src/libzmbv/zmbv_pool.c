@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#include "zmbv_pool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef ZMBV_USE_THREADS
+#include <pthread.h>
+#endif
+
+
+typedef struct {
+  zmbv_codec_t zc;
+  int width, height;
+  zmbv_format_t format;
+} zmbv_pool_entry_t;
+
+struct zmbv_pool_s {
+  zmbv_pool_kind_t kind;
+  zmvb_init_flags_t flags;
+  int complevel;
+  zmbv_allocator_t alloc;
+  int hasalloc;
+  /* most recently returned last */
+  zmbv_pool_entry_t *idle;
+  int count, maxidle;
+  uint64_t created, reused;
+#ifdef ZMBV_USE_THREADS
+  pthread_mutex_t lock;
+#endif
+};
+
+
+#ifdef ZMBV_USE_THREADS
+# define POOL_LOCK(zp)    pthread_mutex_lock(&(zp)->lock)
+# define POOL_UNLOCK(zp)  pthread_mutex_unlock(&(zp)->lock)
+#else
+# define POOL_LOCK(zp)    do {} while (0)
+# define POOL_UNLOCK(zp)  do {} while (0)
+#endif
+
+
+/******************************************************************************/
+zmbv_pool_t zmbv_pool_new (zmbv_pool_kind_t kind, zmvb_init_flags_t flags, int complevel, const zmbv_allocator_t *alloc, int maxidle) {
+  zmbv_pool_t zp;
+#ifndef ZMBV_INCLUDE_DECODER
+  if (kind == ZMBV_POOL_DECODER) return NULL;
+#endif
+  if ((kind != ZMBV_POOL_ENCODER && kind != ZMBV_POOL_DECODER) || maxidle < 0) return NULL;
+  if ((zp = malloc(sizeof(*zp))) == NULL) return NULL;
+  memset(zp, 0, sizeof(*zp));
+  if (maxidle > 0 && (zp->idle = malloc(maxidle*sizeof(zp->idle[0]))) == NULL) { free(zp); return NULL; }
+#ifdef ZMBV_USE_THREADS
+  if (pthread_mutex_init(&zp->lock, NULL) != 0) { free(zp->idle); free(zp); return NULL; }
+#endif
+  zp->kind = kind;
+  zp->flags = flags;
+  zp->complevel = complevel;
+  if (alloc != NULL) {
+    zp->alloc = *alloc;
+    zp->hasalloc = 1;
+  }
+  zp->maxidle = maxidle;
+  return zp;
+}
+
+
+void zmbv_pool_free (zmbv_pool_t zp) {
+  if (zp != NULL) {
+    for (int f = 0; f < zp->count; ++f) zmbv_codec_free(zp->idle[f].zc);
+#ifdef ZMBV_USE_THREADS
+    pthread_mutex_destroy(&zp->lock);
+#endif
+    if (zp->idle != NULL) free(zp->idle);
+    free(zp);
+  }
+}
+
+
+/* set up for the new geometry; a fresh codec is created if `zc` is NULL */
+/* returns NULL on error (`zc` is freed) */
+static zmbv_codec_t zmbv_pool_setup (zmbv_pool_t zp, zmbv_codec_t zc, int width, int height, zmbv_format_t fmt) {
+  int res;
+  if (zc == NULL && (zc = zmbv_codec_new(zp->flags, zp->complevel, (zp->hasalloc ? &zp->alloc : NULL))) == NULL) return NULL;
+#ifdef ZMBV_INCLUDE_DECODER
+  if (zp->kind == ZMBV_POOL_DECODER) res = zmbv_decode_setup(zc, width, height); else
+#endif
+  res = zmbv_encode_setup(zc, width, height);
+  if (res == 0 && fmt != ZMBV_FORMAT_NONE) res = zmbv_codec_reserve(zc, fmt);
+  if (res < 0) {
+    zmbv_codec_free(zc);
+    return NULL;
+  }
+  return zc;
+}
+
+
+int zmbv_pool_prewarm (zmbv_pool_t zp, int count, int width, int height, zmbv_format_t fmt) {
+  if (zp != NULL && count >= 0) {
+    for (int f = 0; f < count; ++f) {
+      zmbv_codec_t zc;
+      int full;
+      POOL_LOCK(zp);
+      full = (zp->count >= zp->maxidle);
+      POOL_UNLOCK(zp);
+      if (full) break;
+      if ((zc = zmbv_pool_setup(zp, NULL, width, height, fmt)) == NULL) return -1;
+      zmbv_pool_put(zp, zc);
+    }
+    return 0;
+  }
+  return -1;
+}
+
+
+zmbv_codec_t zmbv_pool_get (zmbv_pool_t zp, int width, int height, zmbv_format_t fmt) {
+  if (zp != NULL) {
+    zmbv_codec_t zc = NULL;
+    int best = -1, bestscore = -1;
+    POOL_LOCK(zp);
+    /* same geometry and format is best, then same geometry, then the most recent one */
+    for (int f = zp->count-1; f >= 0; --f) {
+      const zmbv_pool_entry_t *e = &zp->idle[f];
+      int score = (e->width == width && e->height == height ? 2+(e->format == fmt) : 0);
+      if (score > bestscore) { best = f; bestscore = score; }
+    }
+    if (best >= 0) {
+      zc = zp->idle[best].zc;
+      zp->idle[best] = zp->idle[--zp->count];
+      ++zp->reused;
+    } else {
+      ++zp->created;
+    }
+    POOL_UNLOCK(zp);
+    return zmbv_pool_setup(zp, zc, width, height, fmt);
+  }
+  return NULL;
+}
+
+
+void zmbv_pool_put (zmbv_pool_t zp, zmbv_codec_t zc) {
+  if (zp != NULL && zc != NULL) {
+    zmbv_pool_entry_t e;
+    if (zp->kind == ZMBV_POOL_ENCODER) {
+      zmbv_encode_set_block_size(zc, 0, 0);
+      zmbv_encode_set_search(zc, -1, 0);
+    }
+#ifdef ZMBV_INCLUDE_DECODER
+    if (zp->kind == ZMBV_POOL_DECODER) {
+      zmbv_decode_set_threads(zc, 0);
+      zmbv_decode_set_pipelined(zc, 0);
+      zmbv_decode_set_stats_callback(zc, NULL, NULL);
+    }
+#endif
+    e.zc = zc;
+    e.width = zmbv_get_width(zc);
+    e.height = zmbv_get_height(zc);
+    e.format = zmbv_get_frame_format(zc);
+    POOL_LOCK(zp);
+    if (zp->count < zp->maxidle) {
+      zp->idle[zp->count++] = e;
+      zc = NULL;
+    }
+    POOL_UNLOCK(zp);
+    if (zc != NULL) zmbv_codec_free(zc);
+  }
+}
+
+
+int zmbv_pool_get_stats (zmbv_pool_t zp, zmbv_pool_stats_t *stats) {
+  if (zp != NULL && stats != NULL) {
+    POOL_LOCK(zp);
+    stats->idle = zp->count;
+    stats->created = zp->created;
+    stats->reused = zp->reused;
+    POOL_UNLOCK(zp);
+    return 0;
+  }
+  return -1;
+}
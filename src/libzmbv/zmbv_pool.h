@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#ifndef ZMBVC_POOL_H
+#define ZMBVC_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zmbv.h"
+
+
+/* pool of idle codecs: returned codecs keep their frame buffers and zlib state, and are */
+/* set up again with a zlib reset instead of being created from scratch */
+/* all codecs of a pool are encoders, or all are decoders (needs ZMBV_INCLUDE_DECODER) */
+/* the pool is thread-safe if the library is built with ZMBV_USE_THREADS */
+typedef struct zmbv_pool_s *zmbv_pool_t;
+
+typedef enum {
+  ZMBV_POOL_ENCODER = 0,
+  ZMBV_POOL_DECODER = 1
+} zmbv_pool_kind_t;
+
+/* `flags`, `complevel` and `alloc` are passed to zmbv_codec_new() */
+/* at most `maxidle` codecs are kept; more returned ones are freed */
+/* returns NULL on error */
+extern zmbv_pool_t zmbv_pool_new (zmbv_pool_kind_t kind, zmvb_init_flags_t flags, int complevel, const zmbv_allocator_t *alloc, int maxidle);
+/* frees idle codecs; codecs that are out stay valid, free them with zmbv_codec_free() */
+extern void zmbv_pool_free (zmbv_pool_t zp);
+
+/* create `count` codecs for this geometry ahead of time (up to the idle limit) */
+/* return <0 on error; 0 on ok */
+extern int zmbv_pool_prewarm (zmbv_pool_t zp, int count, int width, int height, zmbv_format_t fmt);
+
+/* codec set up for encoding or decoding `width`x`height` frames, with buffers for `fmt` */
+/* frames (ZMBV_FORMAT_NONE: allocated with the first frame); idle codec that had the same */
+/* geometry is preferred; returns NULL on error */
+extern zmbv_codec_t zmbv_pool_get (zmbv_pool_t zp, int width, int height, zmbv_format_t fmt);
+/* give the codec back; encoder block size and search go back to defaults; decoder threads, */
+/* pipelining and stats callback are turned off */
+extern void zmbv_pool_put (zmbv_pool_t zp, zmbv_codec_t zc);
+
+typedef struct {
+  int idle; /* codecs in the pool now */
+  uint64_t created; /* zmbv_pool_get() calls that had to create a codec */
+  uint64_t reused; /* zmbv_pool_get() calls served from the pool */
+} zmbv_pool_stats_t;
+
+/* return <0 on error; 0 on ok */
+extern int zmbv_pool_get_stats (zmbv_pool_t zp, zmbv_pool_stats_t *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
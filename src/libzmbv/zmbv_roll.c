@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#include "zmbv_roll.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+#ifdef ZMBV_USE_THREADS
+#include <pthread.h>
+#endif
+
+
+/* file that is being finished, or is kept for retention */
+typedef struct zmbv_roll_file_s {
+  struct zmbv_roll_file_s *next;
+  zmbv_avi_t zavi; /* NULL: finished */
+  char *fname;
+} zmbv_roll_file_t;
+
+struct zmbv_roll_s {
+  char *pattern;
+  int width, height;
+  double fps;
+  int audiorate;
+  zmbv_codec_t zc;
+  uint8_t *outbuf;
+  int outbufsize;
+  /* current file */
+  zmbv_avi_t zavi;
+  char *fname;
+  int segment; /* <0: none yet */
+  uint64_t bytes;
+  uint32_t frames;
+  /* limits */
+  uint64_t maxbytes; /* 0: none */
+  uint32_t maxframes; /* 0: none */
+  int split;
+  zmbv_roll_open_fn openfn;
+  void *openudata;
+  /* retention; owned by the finishing thread */
+  int keep;
+  zmbv_roll_retire_fn retire;
+  void *retireudata;
+  zmbv_roll_file_t *kept, *keptlast; /* finished files, oldest first */
+  int keptcount;
+  int error; /* finishing some file failed */
+#ifdef ZMBV_USE_THREADS
+  int threadstarted;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  zmbv_roll_file_t *queue, *queuelast; /* files to finish */
+  int quit;
+#endif
+};
+
+
+/******************************************************************************/
+/* pattern should have exactly one %d conversion */
+static int zmbv_roll_check_pattern (const char *pattern) {
+  int conv = 0;
+  for (const char *p = pattern; *p; ++p) {
+    if (*p != '%') continue;
+    if (p[1] == '%') { ++p; continue; }
+    ++p;
+    while (*p && strchr("-+ #0123456789", *p) != NULL) ++p;
+    if (*p != 'd') return -1;
+    ++conv;
+  }
+  return (conv == 1 ? 0 : -1);
+}
+
+
+static char *zmbv_roll_make_name (zmbv_roll_t zr, int segment) {
+  int len = snprintf(NULL, 0, zr->pattern, segment);
+  char *res;
+  if (len < 0 || (res = malloc(len+1)) == NULL) return NULL;
+  snprintf(res, len+1, zr->pattern, segment);
+  return res;
+}
+
+
+static void zmbv_roll_free_file (zmbv_roll_file_t *fl) {
+  if (fl->zavi != NULL) zmbv_avi_stop(fl->zavi);
+  if (fl->fname != NULL) free(fl->fname);
+  free(fl);
+}
+
+
+/******************************************************************************/
+static inline void zmbv_roll_lock (zmbv_roll_t zr) {
+#ifdef ZMBV_USE_THREADS
+  pthread_mutex_lock(&zr->lock);
+#else
+  (void)zr;
+#endif
+}
+
+static inline void zmbv_roll_unlock (zmbv_roll_t zr) {
+#ifdef ZMBV_USE_THREADS
+  pthread_mutex_unlock(&zr->lock);
+#else
+  (void)zr;
+#endif
+}
+
+
+/* finish the file and apply retention */
+static void zmbv_roll_finish (zmbv_roll_t zr, zmbv_roll_file_t *fl) {
+  int res = zmbv_avi_stop(fl->zavi);
+  fl->zavi = NULL;
+  fl->next = NULL;
+  zmbv_roll_lock(zr);
+  if (res < 0) zr->error = 1;
+  if (zr->keptlast != NULL) zr->keptlast->next = fl; else zr->kept = fl;
+  zr->keptlast = fl;
+  ++zr->keptcount;
+  while (zr->keep > 0 && zr->keptcount > zr->keep) {
+    zmbv_roll_file_t *old = zr->kept;
+    zr->kept = old->next;
+    if (zr->kept == NULL) zr->keptlast = NULL;
+    --zr->keptcount;
+    if (zr->retire == NULL || zr->retire(zr->retireudata, old->fname) == 0) unlink(old->fname);
+    zmbv_roll_free_file(old);
+  }
+  zmbv_roll_unlock(zr);
+}
+
+
+#ifdef ZMBV_USE_THREADS
+static void *zmbv_roll_thread (void *arg) {
+  zmbv_roll_t zr = (zmbv_roll_t)arg;
+  pthread_mutex_lock(&zr->lock);
+  for (;;) {
+    zmbv_roll_file_t *fl;
+    while (zr->queue == NULL && !zr->quit) pthread_cond_wait(&zr->cond, &zr->lock);
+    if (zr->queue == NULL) break;
+    fl = zr->queue;
+    zr->queue = fl->next;
+    if (zr->queue == NULL) zr->queuelast = NULL;
+    pthread_mutex_unlock(&zr->lock);
+    zmbv_roll_finish(zr, fl);
+    pthread_mutex_lock(&zr->lock);
+  }
+  pthread_mutex_unlock(&zr->lock);
+  return NULL;
+}
+#endif
+
+
+/* hand the current file over for finishing */
+/* return <0 on error; 0 on ok */
+static int zmbv_roll_close_current (zmbv_roll_t zr) {
+  zmbv_roll_file_t *fl;
+  if (zr->zavi == NULL) return 0;
+  if ((fl = malloc(sizeof(*fl))) == NULL) return -1;
+  fl->next = NULL;
+  fl->zavi = zr->zavi;
+  fl->fname = zr->fname;
+  zr->zavi = NULL;
+  zr->fname = NULL;
+#ifdef ZMBV_USE_THREADS
+  pthread_mutex_lock(&zr->lock);
+  if (!zr->threadstarted) {
+    if (pthread_create(&zr->thread, NULL, zmbv_roll_thread, zr) == 0) zr->threadstarted = 1;
+  }
+  if (zr->threadstarted) {
+    if (zr->queuelast != NULL) zr->queuelast->next = fl; else zr->queue = fl;
+    zr->queuelast = fl;
+    pthread_cond_signal(&zr->cond);
+    pthread_mutex_unlock(&zr->lock);
+    return 0;
+  }
+  pthread_mutex_unlock(&zr->lock);
+#endif
+  zmbv_roll_finish(zr, fl);
+  return 0;
+}
+
+
+/* return <0 on error; 0 on ok */
+static int zmbv_roll_open_next (zmbv_roll_t zr) {
+  int segment = zr->segment+1;
+  char *fname;
+  zmbv_avi_t zavi;
+  if (zmbv_roll_close_current(zr) < 0) return -1;
+  if ((fname = zmbv_roll_make_name(zr, segment)) == NULL) return -1;
+  zavi = zmbv_avi_start(fname, zr->width, zr->height, zr->fps, zr->audiorate, NULL);
+  if (zavi == NULL) { free(fname); return -1; }
+  if (zr->openfn != NULL && zr->openfn(zr->openudata, zavi, fname, segment) < 0) {
+    zmbv_avi_stop(zavi);
+    unlink(fname);
+    free(fname);
+    return -1;
+  }
+  zr->zavi = zavi;
+  zr->fname = fname;
+  zr->segment = segment;
+  zr->bytes = 0;
+  zr->frames = 0;
+  zr->split = 0;
+  return 0;
+}
+
+
+/******************************************************************************/
+zmbv_roll_t zmbv_roll_start (const char *pattern, int width, int height, double fps, int audiorate, int complevel) {
+  if (pattern != NULL && zmbv_roll_check_pattern(pattern) == 0 && width > 0 && height > 0 && fps > 0) {
+    zmbv_roll_t zr = malloc(sizeof(*zr));
+    if (zr == NULL) return NULL;
+    memset(zr, 0, sizeof(*zr));
+    zr->segment = -1;
+    zr->width = width;
+    zr->height = height;
+    zr->fps = fps;
+    zr->audiorate = audiorate;
+    if ((zr->pattern = strdup(pattern)) == NULL) goto error;
+    if ((zr->zc = zmbv_codec_new(ZMBV_INIT_FLAG_NONE, complevel, NULL)) == NULL) goto error;
+    if (zmbv_encode_setup(zr->zc, width, height) < 0) goto error;
+    // big enough for any format
+    if ((zr->outbufsize = zmbv_work_buffer_size(width, height, ZMBV_FORMAT_32BPP)) < 0) goto error;
+    if ((zr->outbuf = malloc(zr->outbufsize)) == NULL) goto error;
+#ifdef ZMBV_USE_THREADS
+    pthread_mutex_init(&zr->lock, NULL);
+    pthread_cond_init(&zr->cond, NULL);
+#endif
+    return zr;
+error:
+    if (zr->zc != NULL) zmbv_codec_free(zr->zc);
+    if (zr->pattern != NULL) free(zr->pattern);
+    free(zr);
+  }
+  return NULL;
+}
+
+
+int zmbv_roll_stop (zmbv_roll_t zr) {
+  int res = -1;
+  if (zr != NULL) {
+    res = (zmbv_roll_close_current(zr) < 0 ? -1 : 0);
+#ifdef ZMBV_USE_THREADS
+    if (zr->threadstarted) {
+      pthread_mutex_lock(&zr->lock);
+      zr->quit = 1;
+      pthread_cond_signal(&zr->cond);
+      pthread_mutex_unlock(&zr->lock);
+      pthread_join(zr->thread, NULL);
+    }
+    pthread_cond_destroy(&zr->cond);
+    pthread_mutex_destroy(&zr->lock);
+#endif
+    if (zr->error) res = -1;
+    while (zr->kept != NULL) {
+      zmbv_roll_file_t *fl = zr->kept;
+      zr->kept = fl->next;
+      zmbv_roll_free_file(fl);
+    }
+    if (zr->zavi != NULL) zmbv_avi_stop(zr->zavi);
+    if (zr->fname != NULL) free(zr->fname);
+    zmbv_codec_free(zr->zc);
+    free(zr->outbuf);
+    free(zr->pattern);
+    free(zr);
+  }
+  return res;
+}
+
+
+int zmbv_roll_set_limits (zmbv_roll_t zr, uint64_t bytes, double seconds) {
+  if (zr != NULL && seconds >= 0) {
+    zr->maxbytes = bytes;
+    zr->maxframes = (seconds > 0 ? (uint32_t)ceil(seconds*zr->fps) : 0);
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_roll_set_retention (zmbv_roll_t zr, int keep, zmbv_roll_retire_fn retire, void *udata) {
+  if (zr != NULL && keep >= 0) {
+    zmbv_roll_lock(zr);
+    zr->keep = keep;
+    zr->retire = retire;
+    zr->retireudata = udata;
+    zmbv_roll_unlock(zr);
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_roll_set_open_hook (zmbv_roll_t zr, zmbv_roll_open_fn fn, void *udata) {
+  if (zr != NULL) {
+    zr->openfn = fn;
+    zr->openudata = udata;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_roll_split (zmbv_roll_t zr) {
+  if (zr != NULL) {
+    zr->split = 1;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_roll_get_segment (zmbv_roll_t zr) {
+  return (zr != NULL ? zr->segment : -1);
+}
+
+
+int zmbv_roll_write_frame (zmbv_roll_t zr, zmvb_prepare_flags_t flags, zmbv_format_t fmt, const void *pal, const void *const line_ptrs[]) {
+  if (zr != NULL && line_ptrs != NULL) {
+    int written;
+    int rotate = (zr->frames > 0 && (zr->split || (zr->maxbytes > 0 && zr->bytes >= zr->maxbytes) ||
+                  (zr->maxframes > 0 && zr->frames >= zr->maxframes)));
+    if (zr->zavi == NULL || rotate) {
+      if (zmbv_roll_open_next(zr) < 0) return -1;
+    }
+    // every file starts with a keyframe
+    if (zr->frames == 0) {
+      flags |= ZMBV_PREP_FLAG_KEYFRAME;
+      zr->split = 0;
+    }
+    if (zmbv_encode_prepare_frame(zr->zc, flags, fmt, pal, zr->outbuf, zr->outbufsize) < 0) return -1;
+    if (zmbv_encode_lines(zr->zc, zr->height, line_ptrs) < 0) return -1;
+    if ((written = zmvb_encode_finish_frame(zr->zc)) < 0) return -1;
+    if (zmbv_avi_write_chunk_video(zr->zavi, zr->outbuf, written) < 0) return -1;
+    zr->bytes += 8+((written+1)&~1);
+    ++zr->frames;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbv_roll_write_audio (zmbv_roll_t zr, const void *data, int size) {
+  if (zr != NULL && size >= 0) {
+    // audio before the first frame opens the first file
+    if (zr->zavi == NULL && zmbv_roll_open_next(zr) < 0) return -1;
+    if (zmbv_avi_write_chunk_audio(zr->zavi, data, size) < 0) return -1;
+    zr->bytes += 8+((size+1)&~1);
+    return 0;
+  }
+  return -1;
+}
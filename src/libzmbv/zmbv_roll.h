@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#ifndef ZMBVC_ROLL_H
+#define ZMBVC_ROLL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zmbv.h"
+#include "zmbv_avi.h"
+
+
+/* rolling recorder: encodes frames and writes them to a chain of AVI files, */
+/* starting a new one when the current one gets too big or too long */
+/* every file starts with a keyframe; audio written after a frame goes to the file of that frame */
+/* previous files are finished by a background thread if the library is built with */
+/* ZMBV_USE_THREADS, or right away otherwise */
+typedef struct zmbv_roll_s *zmbv_roll_t;
+
+/* called for every new AVI before anything is written to it, to set it up */
+/* (audio format, flush policy, etc.); return <0 to fail the recording */
+typedef int (*zmbv_roll_open_fn) (void *udata, zmbv_avi_t zavi, const char *fname, int segment);
+/* called for finished files that fall out of retention; return 0 to have the file deleted, */
+/* !0 if the hook took care of it itself; runs on the finishing thread */
+typedef int (*zmbv_roll_retire_fn) (void *udata, const char *fname);
+
+/* `pattern` is a file name with one %d (flags and width allowed) for the segment number */
+/* returns NULL on error */
+extern zmbv_roll_t zmbv_roll_start (const char *pattern, int width, int height, double fps, int audiorate, int complevel);
+/* finishes the last file and waits for the background thread */
+/* return <0 on error (in any of the files); 0 on ok */
+extern int zmbv_roll_stop (zmbv_roll_t zr);
+
+/* start a new file when the current one reaches `bytes` or `seconds` (0: no limit); default: none */
+/* return <0 on error; 0 on ok */
+extern int zmbv_roll_set_limits (zmbv_roll_t zr, uint64_t bytes, double seconds);
+/* keep only the last `keep` finished files (0: keep all, the default) */
+/* return <0 on error; 0 on ok */
+extern int zmbv_roll_set_retention (zmbv_roll_t zr, int keep, zmbv_roll_retire_fn retire, void *udata);
+/* the hook is called for the next file on; set it right after zmbv_roll_start() to cover the first one */
+/* (the first file is opened with the first frame) */
+/* return <0 on error; 0 on ok */
+extern int zmbv_roll_set_open_hook (zmbv_roll_t zr, zmbv_roll_open_fn fn, void *udata);
+
+/* encode one frame from `height` line pointers; palette for ZMBV_FORMAT_8BPP */
+/* return <0 on error; 0 on ok */
+extern int zmbv_roll_write_frame (zmbv_roll_t zr, zmvb_prepare_flags_t flags, zmbv_format_t fmt, const void *pal, const void *const line_ptrs[]);
+/* return <0 on error; 0 on ok */
+extern int zmbv_roll_write_audio (zmbv_roll_t zr, const void *data, int size);
+/* force a new file with the next frame */
+/* return <0 on error; 0 on ok */
+extern int zmbv_roll_split (zmbv_roll_t zr);
+
+/* number of the file being written; <0: none yet */
+extern int zmbv_roll_get_segment (zmbv_roll_t zr);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#include "zmbv_trace.h"
+
+#ifdef ZMBV_USE_TRACE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+#ifdef _MSC_VER
+# define ZMBV_TRACE_TLS  __declspec(thread)
+#else
+# define ZMBV_TRACE_TLS  __thread
+#endif
+
+
+static const char *phase_names[ZMBV_TRACE_PHASE_MAX] = {
+  "prepare", "search", "deflate", "inflate", "rebuild", "band", "avi chunk", "avi write", "queue wait",
+};
+
+static zmbv_trace_event_t *events = NULL;
+static uint64_t capacity = 0;
+static uint64_t next = 0; /* events ever recorded; slot is next%capacity */
+static volatile int recording = 0;
+static zmbv_trace_cb callback = NULL;
+static void *callback_udata = NULL;
+
+static uint32_t thread_count = 0;
+static ZMBV_TRACE_TLS uint16_t thread_id = 0;
+
+
+/******************************************************************************/
+int zmbv_trace_start (int count) {
+  zmbv_trace_event_t *ev;
+  if (count <= 0) return -1;
+  recording = 0;
+  if ((ev = malloc(sizeof(zmbv_trace_event_t)*count)) == NULL) return -1;
+  free(events);
+  events = ev;
+  capacity = count;
+  next = 0;
+  recording = 1;
+  return 0;
+}
+
+
+void zmbv_trace_stop (void) {
+  recording = 0;
+}
+
+
+void zmbv_trace_free (void) {
+  recording = 0;
+  free(events);
+  events = NULL;
+  capacity = next = 0;
+}
+
+
+void zmbv_trace_set_callback (zmbv_trace_cb cb, void *udata) {
+  callback = cb;
+  callback_udata = udata;
+}
+
+
+/******************************************************************************/
+uint64_t zmbv_trace_now (void) {
+  if (!recording) return 0;
+#ifdef _WIN32
+  LARGE_INTEGER cnt, freq;
+  QueryPerformanceCounter(&cnt);
+  QueryPerformanceFrequency(&freq);
+  return (uint64_t)(cnt.QuadPart/freq.QuadPart)*1000000000ull+(uint64_t)(cnt.QuadPart%freq.QuadPart)*1000000000ull/freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+#endif
+}
+
+
+void zmbv_trace_add (int phase, int frame, uint64_t start_ns, uint64_t end_ns) {
+  zmbv_trace_event_t *ev;
+  if (start_ns == 0 || !recording) return;
+  if (end_ns == 0) end_ns = zmbv_trace_now();
+  if (thread_id == 0) thread_id = (uint16_t)__atomic_add_fetch(&thread_count, 1, __ATOMIC_RELAXED);
+  /* threads only race for the slot number; a slot is rewritten after `capacity` more events */
+  ev = &events[__atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)%capacity];
+  ev->start_ns = start_ns;
+  ev->end_ns = end_ns;
+  ev->frame = frame;
+  ev->thread = thread_id;
+  ev->phase = (uint16_t)phase;
+  if (callback != NULL) callback(ev, callback_udata);
+}
+
+
+/******************************************************************************/
+int zmbv_trace_get_events (zmbv_trace_event_t *dest, int max) {
+  uint64_t count = (next < capacity ? next : capacity), first = next-count;
+  if (dest == NULL || max <= 0) return 0;
+  if (count > (uint64_t)max) count = max;
+  for (uint64_t f = 0; f < count; ++f) dest[f] = events[(first+f)%capacity];
+  return (int)count;
+}
+
+
+const char *zmbv_trace_phase_name (int phase) {
+  return (phase >= 0 && phase < ZMBV_TRACE_PHASE_MAX ? phase_names[phase] : NULL);
+}
+
+
+int zmbv_trace_write_chrome (const char *fname) {
+  uint64_t count = (next < capacity ? next : capacity), first = next-count, base = UINT64_MAX;
+  uint32_t maxthread = 0;
+  FILE *fo;
+  if (fname == NULL || (fo = fopen(fname, "w")) == NULL) return -1;
+  /* timestamps go from the earliest event, in microseconds */
+  for (uint64_t f = 0; f < count; ++f) {
+    const zmbv_trace_event_t *ev = &events[(first+f)%capacity];
+    if (ev->start_ns < base) base = ev->start_ns;
+    if (ev->thread > maxthread) maxthread = ev->thread;
+  }
+  fprintf(fo, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  fprintf(fo, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"zmbv\"}}");
+  for (uint32_t t = 1; t <= maxthread; ++t) {
+    fprintf(fo, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}", t, t);
+  }
+  for (uint64_t f = 0; f < count; ++f) {
+    const zmbv_trace_event_t *ev = &events[(first+f)%capacity];
+    const char *name = zmbv_trace_phase_name(ev->phase);
+    char tmp[32];
+    if (name == NULL) { snprintf(tmp, sizeof(tmp), "phase %u", ev->phase); name = tmp; }
+    fprintf(fo, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+      name, (ev->phase < ZMBV_TRACE_PHASE_MAX ? "zmbv" : "app"), ev->thread,
+      (ev->start_ns-base)/1000.0, (ev->end_ns > ev->start_ns ? ev->end_ns-ev->start_ns : 0)/1000.0);
+    if (ev->frame >= 0) fprintf(fo, ", \"args\": {\"frame\": %d}", (int)ev->frame);
+    fprintf(fo, "}");
+  }
+  fprintf(fo, "\n]}\n");
+  return (fclose(fo) == 0 ? 0 : -1);
+}
+
+#endif /* ZMBV_USE_TRACE */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2002-2013  The DOSBox Team
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * C translation by Ketmar // Invisible Vector
+ */
+#ifndef ZMBVC_TRACE_H
+#define ZMBVC_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+/* trace points: every phase is recorded as one (phase, frame, thread, start, end) event */
+/* into a ring buffer, and can be exported as Chrome trace JSON (chrome://tracing, Perfetto) */
+/* without ZMBV_USE_TRACE there is no API and the trace points compile to nothing */
+typedef enum {
+  ZMBV_TRACE_PREPARE = 0, /* zmbv_encode_prepare_frame() */
+  ZMBV_TRACE_SEARCH,      /* motion search and xor data of an interframe */
+  ZMBV_TRACE_DEFLATE,
+  ZMBV_TRACE_INFLATE,     /* one inflate call; there are several per frame in pipelined mode */
+  ZMBV_TRACE_REBUILD,     /* building the frame from inflated data */
+  ZMBV_TRACE_BAND,        /* one row band of a threaded rebuild */
+  ZMBV_TRACE_AVI_CHUNK,   /* zmbv_avi_write_chunk() */
+  ZMBV_TRACE_AVI_WRITE,   /* writing data out to the AVI file (by the writer thread in async mode) */
+  ZMBV_TRACE_QUEUE_WAIT,  /* waiting for room in the async AVI writer queue */
+  ZMBV_TRACE_PHASE_MAX
+} zmbv_trace_phase_t;
+
+#ifdef ZMBV_USE_TRACE
+
+typedef struct {
+  uint64_t start_ns; /* zmbv_trace_now() clock */
+  uint64_t end_ns;
+  int32_t frame; /* frame number of the codec or AVI file; <0: none */
+  uint16_t thread; /* 1, 2, ... in the order threads made their first event */
+  uint16_t phase; /* zmbv_trace_phase_t */
+} zmbv_trace_event_t;
+
+/* start recording into a ring of `capacity` events; the oldest ones are overwritten */
+/* events of an earlier recording are dropped */
+/* start and stop should not be called while other threads are running traced code */
+/* return <0 on error; 0 on ok */
+extern int zmbv_trace_start (int capacity);
+/* stop recording; events are kept for export until the next start or zmbv_trace_free() */
+extern void zmbv_trace_stop (void);
+extern void zmbv_trace_free (void);
+
+/* called for every recorded event on the thread that made it; NULL: none (the default) */
+typedef void (*zmbv_trace_cb) (const zmbv_trace_event_t *ev, void *udata);
+extern void zmbv_trace_set_callback (zmbv_trace_cb cb, void *udata);
+
+/* monotonic nanoseconds (CLOCK_MONOTONIC, QueryPerformanceCounter on Windows); 0 when not recording */
+extern uint64_t zmbv_trace_now (void);
+/* record an event; `start_ns` 0: ignored (recording was off when it started); `end_ns` 0: now */
+/* applications can record their own phases with numbers from ZMBV_TRACE_PHASE_MAX up */
+extern void zmbv_trace_add (int phase, int frame, uint64_t start_ns, uint64_t end_ns);
+
+/* recorded events, oldest first; returns the number of events copied (up to `max`) */
+extern int zmbv_trace_get_events (zmbv_trace_event_t *dest, int max);
+/* returns "prepare", "search", ...; NULL for application phases */
+extern const char *zmbv_trace_phase_name (int phase);
+/* write recorded events as Chrome trace event JSON */
+/* return <0 on error; 0 on ok */
+extern int zmbv_trace_write_chrome (const char *fname);
+
+# define ZMBV_TRACE_BEGIN(_var)  uint64_t _var = zmbv_trace_now()
+# define ZMBV_TRACE_END(_phase,_frame,_var)  zmbv_trace_add((_phase), (_frame), (_var), 0)
+#else
+# define ZMBV_TRACE_BEGIN(_var)  ((void)0)
+# define ZMBV_TRACE_END(_phase,_frame,_var)  ((void)0)
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -8,6 +8,8 @@
 
 #include <stdlib.h>
 
+// Define MINIZ_NO_ZLIB_APIS to remove all ZLIB-style decompression API's.
+//#define MINIZ_NO_ZLIB_APIS
 
 #if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__i386) || defined(__i486__) || defined(__i486) || defined(i386) || defined(__ia64__) || defined(__x86_64__)
 // MINIZ_X86_OR_X64_CPU is only used to help set the below macros.
@@ -33,6 +35,8 @@
 extern "C" {
 #endif
 
+#ifndef MINIZ_NO_ZLIB_APIS
+
 // ------------------- zlib-style API Definitions.
 
 // For more compatibility with zlib, miniz.c uses unsigned long for some parameters/struct members. Beware: mz_ulong can be either 32 or 64-bits!
@@ -122,6 +126,8 @@ static int mz_inflate(mz_streamp pStream, int flush);
 // Deinitializes a decompressor.
 static int mz_inflateEnd(mz_streamp pStream);
 
+#endif // MINIZ_NO_ZLIB_APIS
+
 // ------------------- Types and macros
 
 typedef unsigned char mz_uint8;
@@ -267,6 +273,8 @@ typedef unsigned char mz_validate_uint64[sizeof(mz_uint64)==8 ? 1 : -1];
   extern "C" {
 #endif
 
+#ifndef MINIZ_NO_ZLIB_APIS
+
 // ------------------- zlib-style API's
 
 static void *def_alloc_func(void *opaque, size_t items, size_t size) { (void)opaque, (void)items, (void)size; return MZ_MALLOC(items * size); }
@@ -419,6 +427,8 @@ static int mz_inflateEnd(mz_streamp pStream)
   return MZ_OK;
 }
 
+#endif // MINIZ_NO_ZLIB_APIS
+
 // ------------------- Low-level Decompression (completely independent from all compression API's)
 
 #define TINFL_MEMCPY(d, s, l) memcpy(d, s, l)
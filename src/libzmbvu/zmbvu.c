@@ -18,11 +18,43 @@
  */
 #include "zmbvu.h"
 
+#ifdef ZMBVU_STATIC
+/* no heap at all: unpacker lives in caller memory, inflate is tinfl with its window there too */
+# ifdef ZMBVU_USE_THREADS
+#  error "ZMBVU_STATIC can't be used with ZMBVU_USE_THREADS"
+# endif
+# ifndef ZMBVU_USE_TINFL
+#  define ZMBVU_USE_TINFL
+# endif
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef ZMBVU_STATIC
+# include <time.h>
+#endif
+
+#if defined(_WIN32) && !defined(ZMBVU_STATIC)
+# include <windows.h>
+#endif
+
+#if defined(__linux__) && !defined(ZMBVU_STATIC)
+# include <sys/mman.h>
+#endif
+
+#ifdef ZMBVU_USE_THREADS
+# include <pthread.h>
+#endif
 
-#ifndef ZMBVU_USE_MINIZ
+#if defined(ZMBVU_USE_TINFL)
+# ifdef ZMBVU_STATIC
+#  define MINIZ_NO_MALLOC
+# endif
+/* only the low-level inflater is needed from miniz */
+# define MINIZ_NO_ZLIB_APIS
+# include "miniz.c"
+#elif !defined(ZMBVU_USE_MINIZ)
 # include <zlib.h>
 # define mz_deflateInit   deflateInit
 # define mz_inflateInit   inflateInit
@@ -30,10 +62,12 @@
 # define mz_inflateEnd    inflateEnd
 # define mz_deflateReset  deflateReset
 # define mz_inflateReset  inflateReset
+# define mz_inflateCopy   inflateCopy
 # define mz_deflate       deflate
 # define mz_inflate       inflate
 # define mz_stream        z_stream
 # define MZ_OK            Z_OK
+# define MZ_BUF_ERROR     Z_BUF_ERROR
 # define MZ_SYNC_FLUSH    Z_SYNC_FLUSH
 #else
 # ifdef MINIZ_NO_MALLOC
@@ -63,11 +97,38 @@
 
 #define MAX_VECTOR  (16)
 
+/* frame rows and the first pixel of the active area are aligned to this */
+#define FRAME_ALIGN  (64)
+/* frame buffers this big are mapped separately and asked for huge pages (Linux) */
+#define FRAME_HUGE_PAGE  (2*1024*1024)
+
+#ifdef ZMBVU_USE_TINFL
+/* tinfl inflates the whole frame in one call right after the last 32KB of the */
+/* previous frames, so decoder work buffer has room for this history in front */
+# define WORK_HISTORY  (TINFL_LZ_DICT_SIZE)
+#else
+# define WORK_HISTORY  (0)
+#endif
+
+/* max number of band threads for interframe reconstruction */
+#define ZMBVU_MAX_THREADS  (64)
+/* don't bother spawning a thread for less blocks than this */
+#define ZMBVU_MIN_BAND_BLOCKS  (256)
+
 enum {
   FRAME_MASK_KEYFRAME = 0x01,
   FRAME_MASK_DELTA_PALETTE = 0x02
 };
 
+/* what pipelined decoder expects next */
+enum {
+  ZMBVU_PIPE_PALETTE,
+  ZMBVU_PIPE_ROWS,
+  ZMBVU_PIPE_VECTORS,
+  ZMBVU_PIPE_BLOCKS,
+  ZMBVU_PIPE_DONE
+};
+
 
 /******************************************************************************/
 zmbvu_format_t zmbvu_bpp_to_format (int bpp) {
@@ -126,8 +187,23 @@ struct zmbvu_unpacker_s {
   uint8_t *oldframe, *newframe;
   uint8_t *buf1, *buf2, *work;
   int bufsize;
+  int buflead; /* buf1 is this far into the arena */
+  size_t bufslot; /* buf2 is this far after buf1 */
+  /* frame buffers, block table, vectors and work buffer are carved from one arena, */
+  /* which only grows, so format and resolution changes don't reallocate */
+  uint8_t *arena; /* FRAME_ALIGN aligned */
+  size_t arenasize;
+  void *arenamem; /* what was allocated: a mapping of arenasize bytes; or malloc()ed with alignment slack */
+  int arenamapped;
+  size_t arenadirty; /* bytes at the start of the arena that were written since it was allocated */
+  int laywidth, layheight, laypixelsize; /* frame layout the arena is carved for now; 0: none */
+  int fixed; /* zmbvu_unpacker_init(): unpacker and arena are in caller memory, arena can't grow */
+  int worksize;
+  int workroom; /* bytes in front of work buffer */
 
   int blockcount;
+  int blockwidth, blockheight;
+  int xblocks, yblocks;
   zmbvu_frame_block_t *blocks;
 
   int workUsed, workPos;
@@ -140,7 +216,27 @@ struct zmbvu_unpacker_s {
   zmbvu_format_t format;
   int pixelsize;
 
+  int threads; /* decoder band threads; <2: rebuild frames in the caller thread */
+
+  /* pipelined decoding: inflate pipe_chunk bytes at a time and rebuild what is complete */
+  int pipe_chunk; /* 0: inflate the whole frame first */
+  int pipe_state, pipe_pos, pipe_ofs;
+  int8_t *vectors; /* block info of the current frame */
+
+  zmbvu_allocator_t alloc; /* all NULL: stdlib */
+
+  zmbvu_decode_counters_t dcur; /* frame being decoded */
+  zmbvu_decode_stats_t dstats;
+  zmbvu_decode_stats_cb stats_cb;
+  void *stats_udata;
+
+#ifdef ZMBVU_USE_TINFL
+  tinfl_decompressor tinfl;
+  int tinfl_flags;
+  int histlen; /* bytes of inflate history right before work buffer */
+#else
   mz_stream zstream;
+#endif
   int zstream_inited; // <0: deflate; >0: inflate; 0: not inited
 };
 
@@ -149,13 +245,13 @@ struct zmbvu_unpacker_s {
 /* generate functions from templates */
 /* decoder templates */
 #define ZMBVU_UNXOR_BLOCK_TPL(_pxtype,_pxsize) \
-static inline void zmbvu_unxor_block_##_pxsize (zmbvu_unpacker_t zc, int vx, int vy, zmbvu_frame_block_t *block) { \
+static inline void zmbvu_unxor_block_##_pxsize (zmbvu_unpacker_t zc, int vx, int vy, const zmbvu_frame_block_t *block, const uint8_t *xordata) { \
   _pxtype *pold = ((_pxtype *)zc->oldframe)+block->start+(vy*zc->pitch)+vx; \
   _pxtype *pnew = ((_pxtype *)zc->newframe)+block->start; \
   for (int y = 0; y < block->dy; ++y) { \
     for (int x = 0; x < block->dx; ++x) { \
-      pnew[x] = pold[x]^*((_pxtype *)&zc->work[zc->workPos]); \
-      zc->workPos += sizeof(_pxtype); \
+      pnew[x] = pold[x]^*((const _pxtype *)xordata); \
+      xordata += sizeof(_pxtype); \
     } \
     pold += zc->pitch; \
     pnew += zc->pitch; \
@@ -164,7 +260,7 @@ static inline void zmbvu_unxor_block_##_pxsize (zmbvu_unpacker_t zc, int vx, int
 
 
 #define ZMBVU_COPY_BLOCK_TPL(_pxtype,_pxsize) \
-static inline void zmbvu_copy_block_##_pxsize (zmbvu_unpacker_t zc, int vx, int vy, zmbvu_frame_block_t *block) { \
+static inline void zmbvu_copy_block_##_pxsize (zmbvu_unpacker_t zc, int vx, int vy, const zmbvu_frame_block_t *block) { \
   _pxtype *pold = ((_pxtype *)zc->oldframe)+block->start+(vy*zc->pitch)+vx; \
   _pxtype *pnew = ((_pxtype *)zc->newframe)+block->start; \
   for (int y = 0; y < block->dy; ++y) { \
@@ -177,17 +273,23 @@ static inline void zmbvu_copy_block_##_pxsize (zmbvu_unpacker_t zc, int vx, int
 }
 
 
-#define ZMBVU_UNXOR_FRAME_TPL(_pxtype,_pxsize) \
-static inline void zmbvu_unxor_frame_##_pxsize (zmbvu_unpacker_t zc) { \
-  int8_t *vectors = (int8_t *)&zc->work[zc->workPos]; \
-  zc->workPos = (zc->workPos+zc->blockcount*2+3)&~3; \
-  for (int b = 0; b < zc->blockcount; ++b) { \
-    zmbvu_frame_block_t *block = &zc->blocks[b]; \
+/* reconstruct blocks [bfirst..bend); xor data for the first block starts at xordata */
+/* returns pointer right after the xor data of the last block */
+#define ZMBVU_UNXOR_BLOCKS_TPL(_pxtype,_pxsize) \
+static const uint8_t *zmbvu_unxor_blocks_##_pxsize (zmbvu_unpacker_t zc, const int8_t *vectors, int bfirst, int bend, const uint8_t *xordata) { \
+  for (int b = bfirst; b < bend; ++b) { \
+    const zmbvu_frame_block_t *block = &zc->blocks[b]; \
     int delta = vectors[b*2+0]&1; \
     int vx = vectors[b*2+0]>>1; \
     int vy = vectors[b*2+1]>>1; \
-    if (delta) zmbvu_unxor_block_##_pxsize(zc, vx, vy, block); else zmbvu_copy_block_##_pxsize(zc, vx, vy, block); \
+    if (delta) { \
+      zmbvu_unxor_block_##_pxsize(zc, vx, vy, block, xordata); \
+      xordata += block->dx*block->dy*sizeof(_pxtype); \
+    } else { \
+      zmbvu_copy_block_##_pxsize(zc, vx, vy, block); \
+    } \
   } \
+  return xordata; \
 }
 
 /* generate functions */
@@ -199,9 +301,100 @@ ZMBVU_COPY_BLOCK_TPL(uint8_t,  8)
 ZMBVU_COPY_BLOCK_TPL(uint16_t,16)
 ZMBVU_COPY_BLOCK_TPL(uint32_t,32)
 
-ZMBVU_UNXOR_FRAME_TPL(uint8_t,  8)
-ZMBVU_UNXOR_FRAME_TPL(uint16_t,16)
-ZMBVU_UNXOR_FRAME_TPL(uint32_t,32)
+ZMBVU_UNXOR_BLOCKS_TPL(uint8_t,  8)
+ZMBVU_UNXOR_BLOCKS_TPL(uint16_t,16)
+ZMBVU_UNXOR_BLOCKS_TPL(uint32_t,32)
+
+
+typedef const uint8_t *(*zmbvu_unxor_blocks_fn) (zmbvu_unpacker_t zc, const int8_t *vectors, int bfirst, int bend, const uint8_t *xordata);
+
+
+/******************************************************************************/
+/* trace points */
+#ifdef ZMBVU_USE_TRACE
+static uint64_t zmbvu_nsecs (void);
+
+static zmbvu_trace_cb zmbvu_trace_fn = NULL;
+static void *zmbvu_trace_udata = NULL;
+
+void zmbvu_set_trace_callback (zmbvu_trace_cb cb, void *udata) {
+  zmbvu_trace_fn = cb;
+  zmbvu_trace_udata = udata;
+}
+
+# define ZMBVU_TRACE_BEGIN(_var)  uint64_t _var = (zmbvu_trace_fn != NULL ? zmbvu_nsecs() : 0)
+# define ZMBVU_TRACE_END(_phase,_frame,_var)  do { \
+    if ((_var) != 0 && zmbvu_trace_fn != NULL) zmbvu_trace_fn((_phase), (_frame), (_var), zmbvu_nsecs(), zmbvu_trace_udata); \
+  } while (0)
+#else
+# define ZMBVU_TRACE_BEGIN(_var)  ((void)0)
+# define ZMBVU_TRACE_END(_phase,_frame,_var)  ((void)0)
+#endif
+
+#ifdef ZMBVU_USE_THREADS
+typedef struct {
+  zmbvu_unpacker_t zc;
+  zmbvu_unxor_blocks_fn unxor;
+  const int8_t *vectors;
+  int bfirst, bend;
+  int workpos;
+  int started;
+  pthread_t tid;
+} zmbvu_band_t;
+
+
+static void *zmbvu_band_thread (void *arg) {
+  zmbvu_band_t *band = (zmbvu_band_t *)arg;
+  ZMBVU_TRACE_BEGIN(ttime);
+  band->unxor(band->zc, band->vectors, band->bfirst, band->bend, &band->zc->work[band->workpos]);
+  ZMBVU_TRACE_END(ZMBVU_TRACE_BAND, (int)band->zc->dstats.total.frames, ttime);
+  return NULL;
+}
+#endif
+
+
+/* return <0 on error; 0 on ok */
+static int zmbvu_unxor_frame (zmbvu_unpacker_t zc, zmbvu_unxor_blocks_fn unxor) {
+  const int8_t *vectors = (const int8_t *)&zc->work[zc->workPos];
+  int workpos = (zc->workPos+zc->blockcount*2+3)&~3;
+  if (workpos > zc->workUsed) return -1; /* no room for block info */
+#ifdef ZMBVU_USE_THREADS
+  int bands = zc->threads;
+  if (bands > zc->yblocks) bands = zc->yblocks;
+  if (bands > zc->blockcount/ZMBVU_MIN_BAND_BLOCKS) bands = zc->blockcount/ZMBVU_MIN_BAND_BLOCKS;
+  if (bands > 1) {
+    zmbvu_band_t band[ZMBVU_MAX_THREADS];
+    int b = 0;
+    /* blocks only read the old frame, so the bands are independent once we know where */
+    /* the xor data of each band starts; it's a prefix sum over the block flags */
+    for (int t = 0; t < bands; ++t) {
+      band[t].zc = zc;
+      band[t].unxor = unxor;
+      band[t].vectors = vectors;
+      band[t].bfirst = b;
+      band[t].bend = (zc->yblocks*(t+1)/bands)*zc->xblocks;
+      band[t].workpos = workpos;
+      band[t].started = 0;
+      for (; b < band[t].bend; ++b) {
+        if (vectors[b*2+0]&1) workpos += zc->blocks[b].dx*zc->blocks[b].dy*zc->pixelsize;
+      }
+    }
+    if (workpos > zc->workUsed) return -1; /* not enough xor data */
+    for (int t = 1; t < bands; ++t) {
+      band[t].started = (pthread_create(&band[t].tid, NULL, zmbvu_band_thread, &band[t]) == 0);
+    }
+    zmbvu_band_thread(&band[0]);
+    for (int t = 1; t < bands; ++t) {
+      /* rebuild it here if we were unable to start a thread */
+      if (band[t].started) pthread_join(band[t].tid, NULL); else zmbvu_band_thread(&band[t]);
+    }
+    zc->workPos = workpos;
+    return 0;
+  }
+#endif
+  zc->workPos = (int)(unxor(zc, vectors, 0, zc->blockcount, &zc->work[workpos])-zc->work);
+  return 0;
+}
 
 
 /******************************************************************************/
@@ -224,8 +417,43 @@ static void zmbvu_create_vector_table (zmbvu_unpacker_t zc) {
 }
 
 
-zmbvu_unpacker_t zmbvu_unpacker_new (void) {
-  zmbvu_unpacker_t zc = malloc(sizeof(*zc));
+/******************************************************************************/
+#ifndef ZMBVU_STATIC
+static void *zmbvu_mem_alloc (const zmbvu_allocator_t *al, size_t size) {
+  return (al->alloc != NULL ? al->alloc(al->udata, size) : malloc(size));
+}
+
+
+static void zmbvu_mem_free (const zmbvu_allocator_t *al, void *ptr) {
+  if (al->free != NULL) al->free(al->udata, ptr); else free(ptr);
+}
+
+
+#ifndef ZMBVU_USE_TINFL
+/* zlib/miniz allocation hooks; opaque is the allocator */
+#ifdef ZMBVU_USE_MINIZ
+static void *zmbvu_zalloc (void *opaque, size_t items, size_t size) {
+#else
+static voidpf zmbvu_zalloc (voidpf opaque, uInt items, uInt size) {
+#endif
+  return zmbvu_mem_alloc((const zmbvu_allocator_t *)opaque, (size_t)items*size);
+}
+
+
+#ifdef ZMBVU_USE_MINIZ
+static void zmbvu_zfree (void *opaque, void *ptr) {
+#else
+static void zmbvu_zfree (voidpf opaque, voidpf ptr) {
+#endif
+  zmbvu_mem_free((const zmbvu_allocator_t *)opaque, ptr);
+}
+#endif
+
+
+zmbvu_unpacker_t zmbvu_unpacker_new (const zmbvu_allocator_t *alloc) {
+  zmbvu_unpacker_t zc;
+  if (alloc != NULL && (alloc->alloc == NULL || alloc->realloc == NULL || alloc->free == NULL)) return NULL;
+  zc = (alloc != NULL ? alloc->alloc(alloc->udata, sizeof(*zc)) : malloc(sizeof(*zc)));
   if (zc != NULL) {
     /*
     zc->blocks = NULL;
@@ -236,30 +464,139 @@ zmbvu_unpacker_t zmbvu_unpacker_new (void) {
     zc->zstream_inited = 0;
     */
     memset(zc, 0, sizeof(*zc));
+    if (alloc != NULL) zc->alloc = *alloc;
+#ifndef ZMBVU_USE_TINFL
+    zc->zstream.zalloc = zmbvu_zalloc;
+    zc->zstream.zfree = zmbvu_zfree;
+    zc->zstream.opaque = &zc->alloc;
+#endif
     zmbvu_create_vector_table(zc);
     zc->mode = ZMBVU_MODE_UNKNOWN;
   }
   return zc;
 }
+#endif
+
+
+#ifdef ZMBVU_USE_TINFL
+/* unpacker struct takes this much of the caller block, arena follows */
+#define ZMBVU_INIT_HEAD  ((sizeof(struct zmbvu_unpacker_s)+FRAME_ALIGN-1)&~(size_t)(FRAME_ALIGN-1))
+
+zmbvu_unpacker_t zmbvu_unpacker_init (void *mem, size_t size) {
+  uint8_t *base;
+  size_t skip;
+  zmbvu_unpacker_t zc;
+  if (mem == NULL) return NULL;
+  base = (uint8_t *)(((uintptr_t)mem+FRAME_ALIGN-1)&~(uintptr_t)(FRAME_ALIGN-1));
+  skip = (size_t)(base-(uint8_t *)mem);
+  if (size < skip+ZMBVU_INIT_HEAD) return NULL;
+  zc = (zmbvu_unpacker_t)base;
+  memset(zc, 0, sizeof(*zc));
+  zc->fixed = 1;
+  zc->arena = base+ZMBVU_INIT_HEAD;
+  zc->arenasize = size-skip-ZMBVU_INIT_HEAD;
+  zc->arenadirty = zc->arenasize; /* caller memory may hold anything */
+  zmbvu_create_vector_table(zc);
+  zc->mode = ZMBVU_MODE_UNKNOWN;
+  return zc;
+}
+#endif
+
+
+static void zmbvu_free_arena (zmbvu_unpacker_t zc) {
+  /* caller memory stays where it is; only the layout is forgotten */
+  if (!zc->fixed) {
+#ifndef ZMBVU_STATIC
+    if (zc->arenamem != NULL) {
+# ifdef __linux__
+      if (zc->arenamapped) munmap(zc->arenamem, zc->arenasize); else
+# endif
+      zmbvu_mem_free(&zc->alloc, zc->arenamem);
+    }
+#endif
+    zc->arenamem = NULL;
+    zc->arena = NULL;
+    zc->arenasize = 0;
+    zc->arenadirty = 0;
+  }
+  zc->laywidth = zc->layheight = zc->laypixelsize = 0;
+}
+
+
+/* make the arena at least `size` bytes; when it has to grow, the first `keep` bytes are copied */
+/* new arena is zeroed; big ones are mapped to get huge pages; caller memory can't grow */
+/* return <0 on error; 0 on ok */
+static int zmbvu_reserve_arena (zmbvu_unpacker_t zc, size_t size, size_t keep) {
+#ifndef ZMBVU_STATIC
+  void *mem = NULL;
+  uint8_t *arena = NULL;
+  int mapped = 0;
+#endif
+  if (size <= zc->arenasize) return 0;
+  if (zc->fixed) return -1;
+#ifndef ZMBVU_STATIC
+# ifdef __linux__
+  if (size >= FRAME_HUGE_PAGE && zc->alloc.alloc == NULL) {
+    size = (size+FRAME_HUGE_PAGE-1)&~(size_t)(FRAME_HUGE_PAGE-1);
+#  ifdef ZMBVU_USE_HUGETLB
+    mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (mem == MAP_FAILED)
+#  endif
+    mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+#  ifdef MADV_HUGEPAGE
+      madvise(mem, size, MADV_HUGEPAGE);
+#  endif
+      arena = mem;
+      mapped = 1;
+    } else {
+      mem = NULL;
+    }
+  }
+# endif
+  if (mem == NULL) {
+    if (zc->alloc.alloc != NULL) {
+      if ((mem = zc->alloc.alloc(zc->alloc.udata, size+FRAME_ALIGN)) == NULL) return -1;
+      arena = (uint8_t *)(((uintptr_t)mem+FRAME_ALIGN-1)&~(uintptr_t)(FRAME_ALIGN-1));
+      memset(arena, 0, size);
+    } else {
+      /* calloc() gets big blocks zeroed from the system without touching them */
+      if ((mem = calloc(1, size+FRAME_ALIGN)) == NULL) return -1;
+      arena = (uint8_t *)(((uintptr_t)mem+FRAME_ALIGN-1)&~(uintptr_t)(FRAME_ALIGN-1));
+    }
+  }
+  if (keep > 0) memcpy(arena, zc->arena, keep);
+  zmbvu_free_arena(zc);
+  zc->arenamem = mem;
+  zc->arena = arena;
+  zc->arenasize = size;
+  zc->arenamapped = mapped;
+  zc->arenadirty = keep;
+  return 0;
+#else
+  (void)keep;
+  return -1;
+#endif
+}
 
 
 static void zmbvu_free_buffers (zmbvu_unpacker_t zc) {
   if (zc != NULL) {
-    if (zc->blocks != NULL) free(zc->blocks);
-    if (zc->buf1 != NULL) free(zc->buf1);
-    if (zc->buf2 != NULL) free(zc->buf2);
-    if (zc->work != NULL) free(zc->work);
+    zmbvu_free_arena(zc);
     zc->blocks = NULL;
     zc->buf1 = NULL;
     zc->buf2 = NULL;
     zc->work = NULL;
+    zc->vectors = NULL;
   }
 }
 
 
 static void zmbvu_zlib_deinit (zmbvu_unpacker_t zc) {
   if (zc != NULL) {
+#ifndef ZMBVU_USE_TINFL
     if (zc->zstream_inited) mz_inflateEnd(&zc->zstream);
+#endif
     zc->zstream_inited = 0;
   }
 }
@@ -268,8 +605,13 @@ static void zmbvu_zlib_deinit (zmbvu_unpacker_t zc) {
 void zmbvu_unpacker_free (zmbvu_unpacker_t zc) {
   if (zc != NULL) {
     zmbvu_zlib_deinit(zc);
-    zmbvu_free_buffers(zc);
-    free(zc);
+#ifndef ZMBVU_STATIC
+    /* zmbvu_unpacker_init() memory belongs to the caller */
+    if (!zc->fixed) {
+      zmbvu_free_buffers(zc);
+      zmbvu_mem_free(&zc->alloc, zc);
+    }
+#endif
   }
 }
 
@@ -309,25 +651,105 @@ int zmbvu_decode_palette_changed (zmbvu_unpacker_t zc, const void *framedata, in
 
 
 /******************************************************************************/
+/* frame buffer geometry for `width`x`height` frames of `pixelsize` bytes per pixel */
+static void zmbvu_frame_layout (int width, int height, int pixelsize, int *pitchbytes, int *bufsize, int *buflead, size_t *bufslot) {
+  /* rows are padded to FRAME_ALIGN bytes; pitch that is a multiple of 4KB would make */
+  /* rows alias in L1, so it gets one more FRAME_ALIGN */
+  *pitchbytes = ((width+2*MAX_VECTOR)*pixelsize+FRAME_ALIGN-1)&~(FRAME_ALIGN-1);
+  if ((*pitchbytes&4095) == 0) *pitchbytes += FRAME_ALIGN;
+  *bufsize = (height+2*MAX_VECTOR)*(*pitchbytes)+2048;
+  /* buf1 starts this far into the arena, so first active pixel is aligned */
+  *buflead = (FRAME_ALIGN-(MAX_VECTOR*pixelsize)%FRAME_ALIGN)%FRAME_ALIGN;
+  /* buf2 is not a multiple of 4KB away from buf1 either */
+  *bufslot = (((size_t)*buflead+*bufsize+4095)&~(size_t)4095)+1024;
+}
+
+
+/* arena offsets of block table, vectors and work buffer after two frame slots */
+/* returns arena bytes needed */
+static size_t zmbvu_arena_layout (size_t bufslot, int blockcount, int workroom, int worksize, size_t *tabpos, size_t *vecpos, size_t *workpos) {
+  *tabpos = (2*bufslot+FRAME_ALIGN-1)&~(size_t)(FRAME_ALIGN-1);
+  *vecpos = *tabpos+sizeof(zmbvu_frame_block_t)*blockcount;
+  *workpos = (*vecpos+blockcount*2+workroom+FRAME_ALIGN-1)&~(size_t)(FRAME_ALIGN-1);
+  return *workpos+worksize;
+}
+
+
+#ifdef ZMBVU_USE_TINFL
+size_t zmbvu_memory_size (int width, int height, zmbvu_format_t fmt, int blockwidth, int blockheight) {
+  int pixelsize, pitchbytes, bufsize, buflead, blockcount;
+  size_t bufslot, tabpos, vecpos, workpos;
+  if (width < 1 || height < 1 || width > 16384 || height > 16384) return 0;
+  if (blockwidth == 0) blockwidth = 16;
+  if (blockheight == 0) blockheight = 16;
+  if (blockwidth < 1 || blockheight < 1 || blockwidth > 255 || blockheight > 255) return 0;
+  switch (fmt) {
+    case ZMBVU_FORMAT_8BPP: pixelsize = 1; break;
+    case ZMBVU_FORMAT_15BPP: case ZMBVU_FORMAT_16BPP: pixelsize = 2; break;
+    case ZMBVU_FORMAT_NONE: case ZMBVU_FORMAT_32BPP: pixelsize = 4; break;
+    default: return 0;
+  }
+  zmbvu_frame_layout(width, height, pixelsize, &pitchbytes, &bufsize, &buflead, &bufslot);
+  blockcount = ((width+blockwidth-1)/blockwidth)*((height+blockheight-1)/blockheight);
+  /* alignment slack for the caller block, unpacker struct, then the arena */
+  return FRAME_ALIGN+ZMBVU_INIT_HEAD+zmbvu_arena_layout(bufslot, blockcount, WORK_HISTORY, bufsize+((blockcount*2+3)&~3), &tabpos, &vecpos, &workpos);
+}
+#endif
+
+
+/* carve block table, vectors and work buffer after the frame buffers, growing the arena if needed */
+/* frame buffers and block geometry should be set up already; `keep` copies frame buffers and */
+/* block table on growth, otherwise whatever older layouts left in frame buffers is cleared */
+/* return <0 on error; 0 on ok */
+static int zmbvu_setup_work (zmbvu_unpacker_t zc, int keep) {
+  size_t frames = 2*zc->bufslot;
+  size_t tabpos, vecpos, workpos, need;
+  int swapped = (zc->oldframe != NULL && zc->oldframe == zc->buf2);
+  /* whole frame of xor data and the block info in front of it */
+  zc->worksize = zc->bufsize+((zc->blockcount*2+3)&~3);
+  if (zc->mode == ZMBVU_MODE_DECODER && zc->pipe_chunk > 0) {
+    /* room for one chunk plus the biggest piece that must be contiguous */
+    int unit = zc->blockwidth*zc->blockheight*zc->pixelsize;
+    if (unit < zc->palsize*3) unit = zc->palsize*3;
+    if (unit < ((zc->blockcount*2+3)&~3)) unit = (zc->blockcount*2+3)&~3;
+    zc->worksize = zc->pipe_chunk+unit;
+  }
+  zc->workroom = (zc->mode == ZMBVU_MODE_DECODER ? WORK_HISTORY : 0);
+  need = zmbvu_arena_layout(zc->bufslot, zc->blockcount, zc->workroom, zc->worksize, &tabpos, &vecpos, &workpos);
+  if (zmbvu_reserve_arena(zc, need, (keep ? vecpos : 0)) < 0) return -1;
+  if (!keep) {
+    /* fresh arena is all zeroes already */
+    size_t clear = (zc->arenadirty < frames ? zc->arenadirty : frames);
+    if (clear > 0) memset(zc->arena, 0, clear);
+  }
+  if (zc->arenadirty < need) zc->arenadirty = need;
+  zc->buf1 = zc->arena+zc->buflead;
+  zc->buf2 = zc->arena+zc->bufslot+zc->buflead;
+  zc->oldframe = (swapped ? zc->buf2 : zc->buf1);
+  zc->newframe = (swapped ? zc->buf1 : zc->buf2);
+  zc->blocks = (zmbvu_frame_block_t *)(zc->arena+tabpos);
+  zc->vectors = (int8_t *)(zc->arena+vecpos);
+  zc->work = zc->arena+workpos;
+  return 0;
+}
+
+
 static int zmbvu_setup_buffers (zmbvu_unpacker_t zc, zmbvu_format_t format, int blockwidth, int blockheight) {
   if (zc != NULL) {
-    int xblocks, xleft, yblocks, yleft, i;
+    int xblocks, xleft, yblocks, yleft, i, samelayout;
 
-    zmbvu_free_buffers(zc);
     zc->palsize = 0;
     switch (format) {
       case ZMBVU_FORMAT_8BPP: zc->pixelsize = 1; zc->palsize = 256; break;
       case ZMBVU_FORMAT_15BPP: case ZMBVU_FORMAT_16BPP: zc->pixelsize = 2; break;
       case ZMBVU_FORMAT_32BPP: zc->pixelsize = 4; break;
-      default: return -1;
+      default: zmbvu_free_buffers(zc); return -1;
     };
-    zc->bufsize = (zc->height+2*MAX_VECTOR)*zc->pitch*zc->pixelsize+2048;
-
-    zc->buf1 = malloc(zc->bufsize);
-    zc->buf2 = malloc(zc->bufsize);
-    zc->work = malloc(zc->bufsize);
-
-    if (zc->buf1 == NULL || zc->buf2 == NULL || zc->work == NULL) { zmbvu_free_buffers(zc); return -1; }
+    {
+      int pitchbytes;
+      zmbvu_frame_layout(zc->width, zc->height, zc->pixelsize, &pitchbytes, &zc->bufsize, &zc->buflead, &zc->bufslot);
+      zc->pitch = pitchbytes/zc->pixelsize;
+    }
 
     xblocks = (zc->width/blockwidth);
     xleft = zc->width%blockwidth;
@@ -337,8 +759,20 @@ static int zmbvu_setup_buffers (zmbvu_unpacker_t zc, zmbvu_format_t format, int
     if (yleft) ++yblocks;
 
     zc->blockcount = yblocks*xblocks;
-    zc->blocks = malloc(sizeof(zmbvu_frame_block_t)*zc->blockcount);
-    if (zc->blocks == NULL) { zmbvu_free_buffers(zc); return -1; }
+    zc->blockwidth = blockwidth;
+    zc->blockheight = blockheight;
+    zc->xblocks = xblocks;
+    zc->yblocks = yblocks;
+
+    /* frames only ever write their active area, so the borders of a layout we already */
+    /* have are still clear, and the old picture is as good as a cleared one: new layout */
+    /* is set up with a keyframe */
+    samelayout = (zc->laywidth == zc->width && zc->layheight == zc->height && zc->laypixelsize == zc->pixelsize);
+    zc->oldframe = zc->buf1;
+    if (zmbvu_setup_work(zc, samelayout) < 0) { zmbvu_free_buffers(zc); return -1; }
+    zc->laywidth = zc->width;
+    zc->layheight = zc->height;
+    zc->laypixelsize = zc->pixelsize;
 
     i = 0;
     for (int y = 0; y < yblocks; ++y) {
@@ -350,11 +784,6 @@ static int zmbvu_setup_buffers (zmbvu_unpacker_t zc, zmbvu_format_t format, int
       }
     }
 
-    memset(zc->buf1, 0, zc->bufsize);
-    memset(zc->buf2, 0, zc->bufsize);
-    memset(zc->work, 0, zc->bufsize);
-    zc->oldframe = zc->buf1;
-    zc->newframe = zc->buf2;
     zc->format = format;
     return 0;
   }
@@ -362,6 +791,245 @@ static int zmbvu_setup_buffers (zmbvu_unpacker_t zc, zmbvu_format_t format, int
 }
 
 
+/******************************************************************************/
+#ifndef ZMBVU_STATIC
+#if defined(ZMBVU_USE_MINIZ) && !defined(ZMBVU_USE_TINFL)
+/* miniz keeps the whole inflater in one flat struct */
+static int mz_inflateCopy (mz_streamp dest, mz_streamp source) {
+  inflate_state *st;
+  memcpy(dest, source, sizeof(*dest));
+  st = (inflate_state *)dest->zalloc(dest->opaque, 1, sizeof(inflate_state));
+  if (st == NULL) return MZ_MEM_ERROR;
+  memcpy(st, source->state, sizeof(inflate_state));
+  dest->state = (struct mz_internal_state *)st;
+  return MZ_OK;
+}
+#endif
+
+
+struct zmbvu_decode_state_s {
+  int width, height;
+  zmbvu_format_t format;
+  int blockwidth, blockheight;
+  int unpack_compression;
+  uint8_t palette[256*3];
+#ifdef ZMBVU_USE_TINFL
+  tinfl_decompressor tinfl;
+  int tinfl_flags;
+  int histlen;
+  uint8_t history[TINFL_LZ_DICT_SIZE];
+#else
+  mz_stream zstream;
+#endif
+  int memsize;
+  zmbvu_allocator_t alloc;
+  uint8_t *frame; /* width*height pixels */
+};
+
+
+zmbvu_decode_state_t zmbvu_decode_state_save (zmbvu_unpacker_t zc) {
+  if (zc != NULL && zc->mode == ZMBVU_MODE_DECODER && zc->format != ZMBVU_FORMAT_NONE) {
+    int linesize = zc->width*zc->pixelsize;
+    zmbvu_decode_state_t st = zmbvu_mem_alloc(&zc->alloc, sizeof(*st));
+    if (st == NULL) return NULL;
+    memset(st, 0, sizeof(*st));
+    st->alloc = zc->alloc;
+    st->frame = zmbvu_mem_alloc(&st->alloc, linesize*zc->height);
+    if (st->frame == NULL) { zmbvu_mem_free(&st->alloc, st); return NULL; }
+#ifdef ZMBVU_USE_TINFL
+    memcpy(&st->tinfl, &zc->tinfl, sizeof(st->tinfl));
+    st->tinfl_flags = zc->tinfl_flags;
+    st->histlen = zc->histlen;
+    memcpy(st->history, zc->work-zc->histlen, zc->histlen);
+#else
+    if (mz_inflateCopy(&st->zstream, &zc->zstream) != MZ_OK) { zmbvu_mem_free(&st->alloc, st->frame); zmbvu_mem_free(&st->alloc, st); return NULL; }
+    st->zstream.opaque = &st->alloc; /* snapshot can outlive the codec */
+#endif
+    st->width = zc->width;
+    st->height = zc->height;
+    st->format = zc->format;
+    st->blockwidth = zc->blockwidth;
+    st->blockheight = zc->blockheight;
+    st->unpack_compression = zc->unpack_compression;
+    memcpy(st->palette, zc->palette, sizeof(st->palette));
+    for (int y = 0; y < zc->height; ++y) memcpy(st->frame+y*linesize, zmbvu_get_decoded_line(zc, y), linesize);
+    st->memsize = (int)sizeof(*st)+linesize*zc->height;
+#ifndef ZMBVU_USE_TINFL
+    st->memsize += 48*1024; /* inflater state and window, roughly */
+#endif
+    return st;
+  }
+  return NULL;
+}
+
+
+int zmbvu_decode_state_restore (zmbvu_unpacker_t zc, zmbvu_decode_state_t st) {
+  if (zc != NULL && st != NULL && zc->mode == ZMBVU_MODE_DECODER) {
+    int linesize;
+    if (zc->width != st->width || zc->height != st->height) return -1;
+    if (zc->format != st->format || zc->blockwidth != st->blockwidth || zc->blockheight != st->blockheight) {
+      if (zmbvu_setup_buffers(zc, st->format, st->blockwidth, st->blockheight) < 0) return -1;
+    }
+    linesize = zc->width*zc->pixelsize;
+#ifdef ZMBVU_USE_TINFL
+    memcpy(&zc->tinfl, &st->tinfl, sizeof(zc->tinfl));
+    zc->tinfl_flags = st->tinfl_flags;
+    zc->histlen = st->histlen;
+    memcpy(zc->work-zc->histlen, st->history, zc->histlen);
+#else
+    {
+      /* zlib state points back to its stream, so copy right into place */
+      mz_stream old, fresh;
+      memcpy(&old, &zc->zstream, sizeof(old));
+      if (mz_inflateCopy(&zc->zstream, &st->zstream) != MZ_OK) {
+        memcpy(&zc->zstream, &old, sizeof(old));
+        return -1;
+      }
+      memcpy(&fresh, &zc->zstream, sizeof(fresh));
+      memcpy(&zc->zstream, &old, sizeof(old));
+      zmbvu_zlib_deinit(zc);
+      memcpy(&zc->zstream, &fresh, sizeof(fresh));
+      zc->zstream.opaque = &zc->alloc;
+      zc->zstream_inited = 1;
+    }
+#endif
+    zc->unpack_compression = st->unpack_compression;
+    memcpy(zc->palette, st->palette, sizeof(zc->palette));
+    for (int y = 0; y < zc->height; ++y) memcpy((void *)zmbvu_get_decoded_line(zc, y), st->frame+y*linesize, linesize);
+    return 0;
+  }
+  return -1;
+}
+
+
+void zmbvu_decode_state_free (zmbvu_decode_state_t st) {
+  if (st != NULL) {
+#ifndef ZMBVU_USE_TINFL
+    mz_inflateEnd(&st->zstream);
+#endif
+    zmbvu_mem_free(&st->alloc, st->frame);
+    zmbvu_mem_free(&st->alloc, st);
+  }
+}
+
+
+int zmbvu_decode_state_memory (zmbvu_decode_state_t st) {
+  return (st != NULL ? st->memsize : -1);
+}
+#endif
+
+
+/******************************************************************************/
+/* inflate backend */
+/* return <0 on error; 0 on ok */
+static int zmbvu_inflate_init (zmbvu_unpacker_t zc) {
+#ifdef ZMBVU_USE_TINFL
+  tinfl_init(&zc->tinfl);
+  zc->tinfl_flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+  zc->histlen = 0;
+#else
+  if (mz_inflateInit(&zc->zstream) != MZ_OK) return -1;
+#endif
+  zc->zstream_inited = 1;
+  return 0;
+}
+
+
+/* restart the stream on keyframe */
+/* return <0 on error; 0 on ok */
+static int zmbvu_inflate_reset (zmbvu_unpacker_t zc) {
+#ifdef ZMBVU_USE_TINFL
+  tinfl_init(&zc->tinfl);
+  zc->tinfl_flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+  zc->histlen = 0;
+  return 0;
+#else
+  return (mz_inflateReset(&zc->zstream) == MZ_OK ? 0 : -1);
+#endif
+}
+
+
+/* inflate the whole frame into work buffer */
+/* return # of bytes inflated or <0 on error */
+static int zmbvu_inflate_frame (zmbvu_unpacker_t zc, const uint8_t *data, int size) {
+#ifdef ZMBVU_USE_TINFL
+  size_t insize = size, outsize = zc->worksize;
+  int total, keep;
+  /* the stream is never finished, every frame ends with a sync flush */
+  tinfl_status status = tinfl_decompress(&zc->tinfl, data, &insize, zc->work-zc->histlen, zc->work, &outsize,
+    zc->tinfl_flags|TINFL_FLAG_HAS_MORE_INPUT|TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+  zc->tinfl_flags = 0;
+  if (status < TINFL_STATUS_DONE || status == TINFL_STATUS_HAS_MORE_OUTPUT) return -1;
+  /* keep the last 32KB in front of work buffer; frame data itself stays where it is */
+  total = zc->histlen+(int)outsize;
+  keep = (total < TINFL_LZ_DICT_SIZE ? total : TINFL_LZ_DICT_SIZE);
+  memmove(zc->work-keep, zc->work+outsize-keep, keep);
+  zc->histlen = keep;
+  return (int)outsize;
+#else
+  zc->zstream.next_in = (void *)data;
+  zc->zstream.avail_in = size;
+  zc->zstream.total_in = 0;
+  zc->zstream.next_out = (void *)zc->work;
+  zc->zstream.avail_out = zc->worksize;
+  zc->zstream.total_out = 0;
+  if (mz_inflate(&zc->zstream, MZ_SYNC_FLUSH/*MZ_NO_FLUSH*/) != MZ_OK) return -1; /* the thing that should not be */
+  return (int)zc->zstream.total_out;
+#endif
+}
+
+
+/******************************************************************************/
+/* decoder statistics */
+/* monotonic clock; ZMBVU_STATIC builds have none, so their times stay 0 */
+static uint64_t zmbvu_nsecs (void) {
+#if defined(ZMBVU_STATIC)
+  return 0;
+#elif defined(_WIN32)
+  LARGE_INTEGER cnt, freq;
+  QueryPerformanceCounter(&cnt);
+  QueryPerformanceFrequency(&freq);
+  return (uint64_t)(cnt.QuadPart/freq.QuadPart)*1000000000ull+(uint64_t)(cnt.QuadPart%freq.QuadPart)*1000000000ull/freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+#endif
+}
+
+
+static void zmbvu_count_blocks (zmbvu_unpacker_t zc, const int8_t *vectors) {
+  int xored = 0;
+  for (int b = 0; b < zc->blockcount; ++b) xored += vectors[b*2+0]&1;
+  zc->dcur.blocks_xor = xored;
+  zc->dcur.blocks_copy = zc->blockcount-xored;
+}
+
+
+/* frame is decoded: publish its counters; `stime` is when its data started to be processed */
+/* returns 0 */
+static int zmbvu_decode_done (zmbvu_unpacker_t zc, uint8_t tag, uint64_t stime) {
+  zmbvu_decode_counters_t *st = &zc->dcur, *tot = &zc->dstats.total;
+  st->frames = 1;
+  st->keyframes = ((tag&FRAME_MASK_KEYFRAME) != 0);
+  st->palette_updates = (zc->palsize && (tag&(FRAME_MASK_KEYFRAME|FRAME_MASK_DELTA_PALETTE)) != 0);
+  st->raw_bytes = zc->workUsed;
+  st->rebuild_ns = zmbvu_nsecs()-stime-st->inflate_ns;
+  tot->frames += st->frames;
+  tot->keyframes += st->keyframes;
+  tot->palette_updates += st->palette_updates;
+  tot->blocks_copy += st->blocks_copy;
+  tot->blocks_xor += st->blocks_xor;
+  tot->packed_bytes += st->packed_bytes;
+  tot->raw_bytes += st->raw_bytes;
+  tot->inflate_ns += st->inflate_ns;
+  tot->rebuild_ns += st->rebuild_ns;
+  zc->dstats.last = *st;
+  if (zc->stats_cb != NULL) zc->stats_cb(zc, st, zc->stats_udata);
+  return 0;
+}
+
+
 /******************************************************************************/
 int zmbvu_decode_setup (zmbvu_unpacker_t zc, int width, int height) {
   if (zc != NULL && width > 0 && height > 0 && width <= 16384 && height <= 16384) {
@@ -369,9 +1037,13 @@ int zmbvu_decode_setup (zmbvu_unpacker_t zc, int width, int height) {
     zc->height = height;
     zc->pitch = width+2*MAX_VECTOR;
     zc->format = ZMBVU_FORMAT_NONE;
-    zmbvu_zlib_deinit(zc);
-    if (mz_inflateInit(&zc->zstream) != MZ_OK) return -1;
-    zc->zstream_inited = 1;
+    if (zc->zstream_inited > 0) {
+      if (zmbvu_inflate_reset(zc) < 0) return -1;
+    } else {
+      zmbvu_zlib_deinit(zc);
+      if (zmbvu_inflate_init(zc) < 0) return -1;
+    }
+    memset(&zc->dstats, 0, sizeof(zc->dstats));
     zc->mode = ZMBVU_MODE_DECODER;
     zc->unpack_compression = 0;
     return 0;
@@ -380,11 +1052,193 @@ int zmbvu_decode_setup (zmbvu_unpacker_t zc, int width, int height) {
 }
 
 
+int zmbvu_decode_set_stats_callback (zmbvu_unpacker_t zc, zmbvu_decode_stats_cb cb, void *udata) {
+  if (zc != NULL) {
+    zc->stats_cb = cb;
+    zc->stats_udata = udata;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbvu_decode_get_stats (zmbvu_unpacker_t zc, zmbvu_decode_stats_t *stats) {
+  if (zc == NULL || stats == NULL || zc->mode != ZMBVU_MODE_DECODER) return -1;
+  *stats = zc->dstats;
+  return 0;
+}
+
+
+int zmbvu_decode_set_threads (zmbvu_unpacker_t zc, int count) {
+  if (zc != NULL && count >= 0) {
+#ifdef ZMBVU_USE_THREADS
+    if (count > ZMBVU_MAX_THREADS) count = ZMBVU_MAX_THREADS;
+#else
+    if (count > 1) return -1;
+#endif
+    zc->threads = count;
+    return 0;
+  }
+  return -1;
+}
+
+
+int zmbvu_decode_set_pipelined (zmbvu_unpacker_t zc, int chunksize) {
+  if (zc != NULL && zc->mode == ZMBVU_MODE_DECODER && chunksize >= 0) {
+#ifdef ZMBVU_USE_TINFL
+    if (chunksize > 0) return -1; /* tinfl needs the whole frame in one buffer */
+#endif
+    if (chunksize > 0 && chunksize < 4096) chunksize = 4096;
+    if (chunksize != zc->pipe_chunk) {
+      zc->pipe_chunk = chunksize;
+      /* resize work buffer if we already know the frame format */
+      if (zc->format != ZMBVU_FORMAT_NONE && zmbvu_setup_work(zc, 1) < 0) {
+        zmbvu_free_buffers(zc);
+        zc->format = ZMBVU_FORMAT_NONE;
+        return -1;
+      }
+    }
+    return 0;
+  }
+  return -1;
+}
+
+
+#ifndef ZMBVU_USE_TINFL
+/******************************************************************************/
+/* feed pipelined decoder with `avail` bytes of frame data */
+/* returns number of bytes used; the rest should be fed again with more data appended */
+static int zmbvu_pipe_consume (zmbvu_unpacker_t zc, zmbvu_unxor_blocks_fn unxor, uint8_t tag, const uint8_t *src, int avail) {
+  int used = 0;
+  for (;;) {
+    switch (zc->pipe_state) {
+      case ZMBVU_PIPE_PALETTE:
+        if (avail-used < zc->palsize*3) return used;
+        for (int i = 0; i < zc->palsize*3; ++i) {
+          if (tag&FRAME_MASK_KEYFRAME) zc->palette[i] = src[used+i]; else zc->palette[i] ^= src[used+i];
+        }
+        used += zc->palsize*3;
+        zc->pipe_state = (tag&FRAME_MASK_KEYFRAME ? ZMBVU_PIPE_ROWS : ZMBVU_PIPE_VECTORS);
+        break;
+      case ZMBVU_PIPE_ROWS: {
+        /* keyframe rows can be copied piecewise */
+        int linesize = zc->width*zc->pixelsize;
+        while (zc->pipe_pos < zc->height && used < avail) {
+          uint8_t *dest = zc->newframe+zc->pixelsize*(MAX_VECTOR+(zc->pipe_pos+MAX_VECTOR)*zc->pitch)+zc->pipe_ofs;
+          int n = linesize-zc->pipe_ofs;
+          if (n > avail-used) n = avail-used;
+          memcpy(dest, src+used, n);
+          used += n;
+          zc->pipe_ofs += n;
+          if (zc->pipe_ofs == linesize) { zc->pipe_ofs = 0; ++zc->pipe_pos; }
+        }
+        if (zc->pipe_pos < zc->height) return used;
+        zc->pipe_state = ZMBVU_PIPE_DONE;
+        break; }
+      case ZMBVU_PIPE_VECTORS:
+        /* block info is padded to 4 bytes */
+        if (avail-used < ((zc->blockcount*2+3)&~3)) return used;
+        memcpy(zc->vectors, src+used, zc->blockcount*2);
+        used += (zc->blockcount*2+3)&~3;
+        zc->pipe_pos = 0;
+        zc->pipe_state = ZMBVU_PIPE_BLOCKS;
+        break;
+      case ZMBVU_PIPE_BLOCKS: {
+        /* rebuild the longest run of blocks which xor data is here */
+        int bend = zc->pipe_pos, need = 0;
+        while (bend < zc->blockcount) {
+          int bsize = (zc->vectors[bend*2+0]&1 ? zc->blocks[bend].dx*zc->blocks[bend].dy*zc->pixelsize : 0);
+          if (avail-used-need < bsize) break;
+          need += bsize;
+          ++bend;
+        }
+        if (bend > zc->pipe_pos) {
+          unxor(zc, zc->vectors, zc->pipe_pos, bend, src+used);
+          used += need;
+          zc->pipe_pos = bend;
+        }
+        if (zc->pipe_pos < zc->blockcount) return used;
+        zc->pipe_state = ZMBVU_PIPE_DONE;
+        break; }
+      default:
+        return used;
+    }
+  }
+}
+
+
+/* inflate frame in chunks, rebuilding it while the data arrives */
+/* return <0 on error; 0 on ok */
+static int zmbvu_decode_frame_pipelined (zmbvu_unpacker_t zc, uint8_t tag, const uint8_t *data, int size) {
+  zmbvu_unxor_blocks_fn unxor;
+  uint64_t stime;
+  switch (zc->format) {
+    case ZMBVU_FORMAT_8BPP: unxor = zmbvu_unxor_blocks_8; break;
+    case ZMBVU_FORMAT_15BPP: case ZMBVU_FORMAT_16BPP: unxor = zmbvu_unxor_blocks_16; break;
+    case ZMBVU_FORMAT_32BPP: unxor = zmbvu_unxor_blocks_32; break;
+    default: return -1; /* the thing that should not be */
+  }
+  if (tag&FRAME_MASK_KEYFRAME) {
+    zc->newframe = zc->buf1;
+    zc->oldframe = zc->buf2;
+    zc->pipe_state = (zc->palsize ? ZMBVU_PIPE_PALETTE : ZMBVU_PIPE_ROWS);
+  } else {
+    uint8_t *tmp = zc->oldframe;
+    zc->oldframe = zc->newframe;
+    zc->newframe = tmp;
+    zc->pipe_state = (tag&FRAME_MASK_DELTA_PALETTE ? ZMBVU_PIPE_PALETTE : ZMBVU_PIPE_VECTORS);
+  }
+  zc->pipe_pos = zc->pipe_ofs = 0;
+  zc->workUsed = 0;
+  if (zc->unpack_compression == COMPRESSION_ZLIB) {
+    int have = 0;
+    zc->zstream.next_in = (void *)data;
+    zc->zstream.avail_in = size;
+    zc->zstream.total_in = 0;
+    for (;;) {
+      int res, got, used;
+      zc->zstream.next_out = (void *)(zc->work+have);
+      zc->zstream.avail_out = zc->worksize-have;
+      zc->zstream.total_out = 0;
+      ZMBVU_TRACE_BEGIN(ttime);
+      stime = zmbvu_nsecs();
+      res = mz_inflate(&zc->zstream, MZ_SYNC_FLUSH);
+      zc->dcur.inflate_ns += zmbvu_nsecs()-stime;
+      ZMBVU_TRACE_END(ZMBVU_TRACE_INFLATE, (int)zc->dstats.total.frames, ttime);
+      if (res != MZ_OK && res != MZ_BUF_ERROR) return -1;
+      got = (int)zc->zstream.total_out;
+      have += got;
+      zc->workUsed += got;
+      ZMBVU_TRACE_BEGIN(rtime);
+      used = zmbvu_pipe_consume(zc, unxor, tag, zc->work, have);
+      ZMBVU_TRACE_END(ZMBVU_TRACE_REBUILD, (int)zc->dstats.total.frames, rtime);
+      if (used > 0 && used < have) memmove(zc->work, zc->work+used, have-used);
+      have -= used;
+      /* all input eaten and all output flushed? */
+      if (zc->zstream.avail_in == 0 && zc->zstream.avail_out != 0) break;
+      if (got == 0 && used == 0) return -1; /* no progress */
+    }
+  } else {
+    /* no need to copy uncompressed data anywhere */
+    ZMBVU_TRACE_BEGIN(rtime);
+    zmbvu_pipe_consume(zc, unxor, tag, data, size);
+    ZMBVU_TRACE_END(ZMBVU_TRACE_REBUILD, (int)zc->dstats.total.frames, rtime);
+    zc->workUsed = size;
+  }
+  if (zc->pipe_state != ZMBVU_PIPE_DONE) return -1;
+  if ((tag&FRAME_MASK_KEYFRAME) == 0) zmbvu_count_blocks(zc, zc->vectors);
+  return 0;
+}
+#endif
+
+
 /******************************************************************************/
 int zmbvu_decode_frame (zmbvu_unpacker_t zc, const void *framedata, int size) {
   if (zc != NULL && framedata != NULL && size > 1 && zc->mode == ZMBVU_MODE_DECODER) {
     uint8_t tag;
     const uint8_t *data = (const uint8_t *)framedata;
+    uint64_t stime;
+    memset(&zc->dcur, 0, sizeof(zc->dcur));
     tag = *data++;
     if (tag > 2) return -1; /* for now we can have only 0, 1 or 2 in tag byte */
     if (--size <= 0) return -1;
@@ -395,26 +1249,35 @@ int zmbvu_decode_frame (zmbvu_unpacker_t zc, const void *framedata, int size) {
       if (size <= 0) return -1;
       if (header->low_version != DBZV_VERSION_LOW || header->high_version != DBZV_VERSION_HIGH) return -1;
       if (header->compression > COMPRESSION_ZLIB) return -1; /* invalid compression mode */
-      if (zc->format != (zmbvu_format_t)header->format && zmbvu_setup_buffers(zc, (zmbvu_format_t)header->format, header->blockwidth, header->blockheight) < 0) return -1;
+      if (header->blockwidth == 0 || header->blockheight == 0) return -1;
+      if (zc->format != (zmbvu_format_t)header->format || zc->blockwidth != header->blockwidth || zc->blockheight != header->blockheight) {
+        if (zmbvu_setup_buffers(zc, (zmbvu_format_t)header->format, header->blockwidth, header->blockheight) < 0) return -1;
+      }
       zc->unpack_compression = header->compression;
       if (zc->unpack_compression == COMPRESSION_ZLIB) {
-        if (mz_inflateReset(&zc->zstream) != MZ_OK) return -1;
+        if (zmbvu_inflate_reset(zc) < 0) return -1;
       }
     }
     if (size > zc->bufsize) return -1; /* frame too big */
+    zc->dcur.packed_bytes = size;
+    stime = zmbvu_nsecs();
+#ifndef ZMBVU_USE_TINFL
+    if (zc->pipe_chunk > 0) {
+      if (zmbvu_decode_frame_pipelined(zc, tag, data, size) < 0) return -1;
+      return zmbvu_decode_done(zc, tag, stime);
+    }
+#endif
+    ZMBVU_TRACE_BEGIN(ttime);
     if (zc->unpack_compression == COMPRESSION_ZLIB) {
-      zc->zstream.next_in = (void *)data;
-      zc->zstream.avail_in = size;
-      zc->zstream.total_in = 0;
-      zc->zstream.next_out = (void *)zc->work;
-      zc->zstream.avail_out = zc->bufsize;
-      zc->zstream.total_out = 0;
-      if (mz_inflate(&zc->zstream, MZ_SYNC_FLUSH/*MZ_NO_FLUSH*/) != MZ_OK) return -1; /* the thing that should not be */
-      zc->workUsed = zc->zstream.total_out;
+      zc->workUsed = zmbvu_inflate_frame(zc, data, size);
+      if (zc->workUsed < 0) return -1;
     } else {
       if (size > 0) memcpy(zc->work, data, size);
       zc->workUsed = size;
     }
+    ZMBVU_TRACE_END(ZMBVU_TRACE_INFLATE, (int)zc->dstats.total.frames, ttime);
+    zc->dcur.inflate_ns = zmbvu_nsecs()-stime;
+    ZMBVU_TRACE_BEGIN(rtime);
     zc->workPos = 0;
     if (tag&FRAME_MASK_KEYFRAME) {
       if (zc->palsize) {
@@ -443,14 +1306,19 @@ int zmbvu_decode_frame (zmbvu_unpacker_t zc, const void *framedata, int size) {
           zc->palette[i*3+2] ^= zc->work[zc->workPos++];
         }
       }
+      zmbvu_unxor_blocks_fn unxor;
       switch (zc->format) {
-        case ZMBVU_FORMAT_8BPP: zmbvu_unxor_frame_8(zc); break;
-        case ZMBVU_FORMAT_15BPP: case ZMBVU_FORMAT_16BPP: zmbvu_unxor_frame_16(zc); break;
-        case ZMBVU_FORMAT_32BPP: zmbvu_unxor_frame_32(zc); break;
+        case ZMBVU_FORMAT_8BPP: unxor = zmbvu_unxor_blocks_8; break;
+        case ZMBVU_FORMAT_15BPP: case ZMBVU_FORMAT_16BPP: unxor = zmbvu_unxor_blocks_16; break;
+        case ZMBVU_FORMAT_32BPP: unxor = zmbvu_unxor_blocks_32; break;
         default: return -1; /* the thing that should not be */
       }
+      const int8_t *vectors = (const int8_t *)&zc->work[zc->workPos];
+      if (zmbvu_unxor_frame(zc, unxor) < 0) return -1;
+      zmbvu_count_blocks(zc, vectors);
     }
-    return 0;
+    ZMBVU_TRACE_END(ZMBVU_TRACE_REBUILD, (int)zc->dstats.total.frames, rtime);
+    return zmbvu_decode_done(zc, tag, stime);
   }
   return -1;
 }
@@ -23,6 +23,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
@@ -47,24 +48,119 @@ typedef struct zmbvu_unpacker_s *zmbvu_unpacker_t;
 extern zmbvu_format_t zmbvu_bpp_to_format (int bpp);
 
 
-extern zmbvu_unpacker_t zmbvu_unpacker_new (void);
+/* memory callbacks for the unpacker, its buffers, inflate stream and state snapshots; */
+/* the struct is copied, `udata` is passed to every call; all three functions must be set */
+typedef struct {
+  void *(*alloc) (void *udata, size_t size);
+  void *(*realloc) (void *udata, void *ptr, size_t size);
+  void (*free) (void *udata, void *ptr);
+  void *udata;
+} zmbvu_allocator_t;
+
+#ifndef ZMBVU_STATIC
+/* `alloc` NULL: malloc()/free() */
+/* returns NULL on error */
+extern zmbvu_unpacker_t zmbvu_unpacker_new (const zmbvu_allocator_t *alloc);
+#endif
+#if defined(ZMBVU_USE_TINFL) || defined(ZMBVU_STATIC)
+/* unpackers in caller memory need tinfl: zlib and miniz streaming inflate allocate their state */
+/* bytes zmbvu_unpacker_init() needs to decode `width`x`height` frames of `fmt` (ZMBVU_FORMAT_NONE: */
+/* any format) with `blockwidth`x`blockheight` blocks (1..255 pixels each way; 0: 16, what DOSBox */
+/* writes); enough for bigger blocks too; includes the 32KB inflate window */
+/* returns 0 on error */
+extern size_t zmbvu_memory_size (int width, int height, zmbvu_format_t fmt, int blockwidth, int blockheight);
+/* unpacker that lives in `mem` and never allocates: frames that don't fit fail to decode */
+/* zmbvu_unpacker_free() only finishes it, memory stays the caller's */
+/* this is the only way to get an unpacker when built with ZMBVU_STATIC */
+/* returns NULL on error */
+extern zmbvu_unpacker_t zmbvu_unpacker_init (void *mem, size_t size);
+#endif
 extern void zmbvu_unpacker_free (zmbvu_unpacker_t zc);
 
 
 /* return <0 on error; 0 on ok */
 extern int zmbvu_decode_setup (zmbvu_unpacker_t zc, int width, int height);
+/* rebuild interframes with up to `count` threads working on separate row bands */
+/* 0 or 1: no threads; counts >1 need the library to be built with ZMBVU_USE_THREADS */
+/* return <0 on error; 0 on ok */
+extern int zmbvu_decode_set_threads (zmbvu_unpacker_t zc, int count);
+/* inflate frames `chunksize` bytes at a time and rebuild every piece as soon as its data is */
+/* there; the work buffer shrinks to about one chunk; 0 turns it off (the default) */
+/* call this after zmbvu_decode_setup(); band threads are not used in this mode */
+/* return <0 on error; 0 on ok */
+extern int zmbvu_decode_set_pipelined (zmbvu_unpacker_t zc, int chunksize);
 /* return <0 on error; 0 on ok */
 extern int zmbvu_decode_frame (zmbvu_unpacker_t zc, const void *framedata, int size);
 /* return !0 if palette was be changed on this frame */
 extern int zmbvu_decode_is_palette_changed (zmbvu_unpacker_t zc, const void *framedata, int size);
 
+typedef struct {
+  uint64_t frames;
+  uint64_t keyframes;
+  uint64_t palette_updates; /* frames that brought a palette or palette changes */
+  /* interframe blocks: just copied from the old frame; xored with frame data */
+  uint64_t blocks_copy;
+  uint64_t blocks_xor;
+  uint64_t packed_bytes; /* frame data after the frame header */
+  uint64_t raw_bytes; /* frame data after inflate */
+  /* time spent inflating, and rebuilding the frame from inflated data; always 0 with ZMBVU_STATIC */
+  uint64_t inflate_ns;
+  uint64_t rebuild_ns;
+} zmbvu_decode_counters_t;
+
+typedef struct {
+  zmbvu_decode_counters_t last; /* last decoded frame */
+  zmbvu_decode_counters_t total; /* all frames since zmbvu_decode_setup() */
+} zmbvu_decode_stats_t;
+
+/* return <0 on error; 0 on ok */
+extern int zmbvu_decode_get_stats (zmbvu_unpacker_t zc, zmbvu_decode_stats_t *stats);
+/* called at the end of every successful zmbvu_decode_frame() with the counters of that frame */
+typedef void (*zmbvu_decode_stats_cb) (zmbvu_unpacker_t zc, const zmbvu_decode_counters_t *frame, void *udata);
+/* `cb` NULL: no callback (the default) */
+/* return <0 on error; 0 on ok */
+extern int zmbvu_decode_set_stats_callback (zmbvu_unpacker_t zc, zmbvu_decode_stats_cb cb, void *udata);
+
+#ifdef ZMBVU_USE_TRACE
+/* trace points: decoding phases of all unpackers go to one callback */
+typedef enum {
+  ZMBVU_TRACE_INFLATE, /* one inflate call; there are several per frame in pipelined mode */
+  ZMBVU_TRACE_REBUILD, /* building the frame from inflated data */
+  ZMBVU_TRACE_BAND     /* one row band of a threaded rebuild */
+} zmbvu_trace_phase_t;
+
+/* called on the thread that did the work; times are monotonic nanoseconds */
+/* (CLOCK_MONOTONIC, QueryPerformanceCounter on Windows), so they line up with zmbv_trace_now() */
+typedef void (*zmbvu_trace_cb) (zmbvu_trace_phase_t phase, int frame, uint64_t start_ns, uint64_t end_ns, void *udata);
+/* `cb` NULL: no tracing (the default); without ZMBVU_USE_TRACE the trace points compile to nothing */
+/* ZMBVU_STATIC builds have no clock, so the callback is never called there */
+extern void zmbvu_set_trace_callback (zmbvu_trace_cb cb, void *udata);
+#endif
+
 /* this can be called after zmbvu_decode_frame() */
 extern const uint8_t *zmbvu_get_palette (zmbvu_unpacker_t zc);
 /* this can be called after zmbvu_decode_frame() */
+/* lines start at 64-byte aligned addresses, and so does every row of the internal frame buffers */
 extern const void *zmbvu_get_decoded_line (zmbvu_unpacker_t zc, int idx) ;
 /* this can be called after zmbvu_decode_frame() */
 extern zmbvu_format_t zmbvu_get_decoded_format (zmbvu_unpacker_t zc);
 
+#ifndef ZMBVU_STATIC
+/* decoder state snapshot: current frame, palette and inflater state */
+/* restoring it lets decoding continue right after the frame it was taken at */
+typedef struct zmbvu_decode_state_s *zmbvu_decode_state_t;
+
+/* this can be called after zmbvu_decode_frame(); returns NULL on error */
+extern zmbvu_decode_state_t zmbvu_decode_state_save (zmbvu_unpacker_t zc);
+/* codec should be set up for decoding with the same width and height; */
+/* a snapshot of another frame size is refused */
+/* return <0 on error; 0 on ok */
+extern int zmbvu_decode_state_restore (zmbvu_unpacker_t zc, zmbvu_decode_state_t st);
+extern void zmbvu_decode_state_free (zmbvu_decode_state_t st);
+/* approximate number of bytes the snapshot occupies; <0 on error */
+extern int zmbvu_decode_state_memory (zmbvu_decode_state_t st);
+#endif
+
 /* <0: error; 0: never */
 extern int zmbvu_get_width (zmbvu_unpacker_t zc);
 extern int zmbvu_get_height (zmbvu_unpacker_t zc);
@@ -113,7 +113,7 @@ static int do_encode_screens (zmbv_avi_t zavi) {
     int flags;
     zmbv_codec_t zcodec;
 
-    zcodec = zmbv_codec_new(iflg, complevel);
+    zcodec = zmbv_codec_new(iflg, complevel, NULL);
     if (zcodec == NULL) {
         printf("FATAL: can't create codec!\n");
         return -1;
@@ -189,7 +189,7 @@ quit:
 static void encode_screens_to_avi (char *outname) {
     zmbv_avi_t zavi;
 
-    zavi = zmbv_avi_start(outname, VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS, AUDIO_FREQ);
+    zavi = zmbv_avi_start(outname, VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FPS, AUDIO_FREQ, NULL);
     if (zavi == NULL) {
         printf("FATAL: can't create output file!\n");
         return;
@@ -104,7 +104,7 @@ static int do_encode_screens (int (*writer) (void *udata, const void *buf, uint3
   int32_t written;
   void *buf;
   zmbv_codec_t zc;
-  zc = zmbv_codec_new(iflg, complevel);
+  zc = zmbv_codec_new(iflg, complevel, NULL);
   if (zc == NULL) { printf("FATAL: can't create codec!\n"); return -1; }
   fmt = zmbv_bpp_to_format(8);
   buf_size = zmbv_work_buffer_size(VIDEO_WIDTH, VIDEO_HEIGHT, fmt);
@@ -151,7 +151,7 @@ static int writer_avi (void *udata, const void *buf, uint32_t size) {
 
 static void encode_screens_to_avi (void) {
   zmbv_avi_t zavi;
-  zavi = zmbv_avi_start(args.outname, VIDEO_WIDTH, VIDEO_HEIGHT, 18, 0);
+  zavi = zmbv_avi_start(args.outname, VIDEO_WIDTH, VIDEO_HEIGHT, 18, 0, NULL);
   if (zavi == NULL) { printf("FATAL: can't create output file!\n"); return; }
   do_encode_screens(writer_avi, zavi);
   zmbv_avi_stop(zavi);
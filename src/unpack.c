@@ -10,74 +10,39 @@
 
 #include "libzmbv/zmbv.h"
 #include "libzmbv/zmbv_avi.h"
+#include "libzmbv/zmbv_avi_reader.h"
+#include "libzmbv/zmbv_file.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
-typedef struct {
-  off_t scrofs;
-  off_t palofs;
-} scrinfo_t;
-
-
-static int zmbv_fd = -1;
+static zmbv_file_t zmbv_file = NULL;
 static int screen_count = 0;
 static uint8_t cur_pal[256*3];
 static uint8_t cur_screen[320*240];
 static int frameno;
-static uint8_t *packed = NULL;
-static int packed_size = 0;
 
 
 ////////////////////////////////////////////////////////////////////////////////
 static void zmbv_open (void) {
-  uint32_t scc;
-  zmbv_fd = open("stream.zmbv", O_RDONLY);
-  if (zmbv_fd < 0) { fprintf(stderr, "FATAL: can't open stream!\n"); exit(1); }
-  if (read(zmbv_fd, &scc, 4) != 4) { fprintf(stderr, "FATAL: can't read screen count!\n"); exit(1); }
-  if (scc == 0) { fprintf(stderr, "FATAL: no screens!\n"); exit(1); }
-  screen_count = scc;
-  // index count
-  if (read(zmbv_fd, &scc, 4) != 4) { fprintf(stderr, "FATAL: can't read index count!\n"); exit(1); }
-  // index table offset
-  if (read(zmbv_fd, &scc, 4) != 4) { fprintf(stderr, "FATAL: can't read index table offset!\n"); exit(1); }
-  printf("%d screens found\n", screen_count);
+  zmbv_file = zmbv_file_open("stream.zmbv", 320, 240, ZMBV_FILE_FLAG_NONE);
+  if (zmbv_file == NULL) { fprintf(stderr, "FATAL: can't open stream!\n"); exit(1); }
+  screen_count = zmbv_file_frame_count(zmbv_file);
+  printf("%d screens found (%d keyframes)\n", screen_count, zmbv_file_keyframe_count(zmbv_file));
   frameno = 0;
 }
 
 
 static void zmbv_close (void) {
-  if (zmbv_fd >= 0) close(zmbv_fd);
-  zmbv_fd = -1;
-  if (packed != NULL) free(packed);
-  packed = NULL;
-  packed_size = 0;
+  zmbv_file_close(zmbv_file);
+  zmbv_file = NULL;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-static int next_screen (zmbv_codec_t zc) {
+static int next_screen (void) {
   if (frameno < screen_count) {
-    uint32_t size;
-    if (read(zmbv_fd, &size, 4) != 4) {
-      printf("can't read packed frame size for frame #%d\n", frameno);
-      return 0;
-    }
-    if (packed_size < size) {
-      packed = realloc(packed, size);
-      packed_size = size;
-    }
-    if (read(zmbv_fd, packed, size) != size) {
-      printf("can't read packed frame data for frame #%d\n", frameno);
-      return 0;
-    }
-    /* HACK! zmbv_decode_frame() will check the necessary things!
-    if (size < 2 || packed[0] > 2) {
-      printf("invalid packed frame data for frame #%d\n", frameno);
-      return 0;
-    }
-    */
-    //printf("%d\n", size);
-    if (zmbv_decode_frame(zc, packed, size) < 0) {
+    zmbv_codec_t zc = zmbv_file_get_codec(zmbv_file);
+    if (zmbv_file_next_frame(zmbv_file) != 0) {
       printf("can't decode packed frame #%d\n", frameno);
       return 0;
     }
@@ -93,12 +58,8 @@ static int next_screen (zmbv_codec_t zc) {
 ////////////////////////////////////////////////////////////////////////////////
 static int do_decode_screens (int (*writer)(void *udata), void *udata) {
   int res = -1;
-  zmbv_codec_t zc;
-  zc = zmbv_codec_new(ZMBV_INIT_FLAG_NONE, -1);
-  if (zc == NULL) { printf("FATAL: can't create codec!\n"); return -1; }
-  if (zmbv_decode_setup(zc, 320, 240) < 0) { printf("FATAL: can't init decoder!\n"); goto quit; }
   frameno = 0;
-  while (next_screen(zc)) {
+  while (next_screen()) {
     if (writer != NULL && writer(udata) < 0) {
       printf("\rFATAL: can't write uncompressed frame for screen #%d\n", frameno);
       break;
@@ -109,8 +70,6 @@ static int do_decode_screens (int (*writer)(void *udata), void *udata) {
   } else {
     printf("\rFATAL: invalid number of frames read; got %d, expected %d\n", frameno, screen_count);
   }
-quit:
-  zmbv_codec_free(zc);
   return res;
 }
 
@@ -135,7 +94,46 @@ static void decode_screens (void) {
 
 
 ////////////////////////////////////////////////////////////////////////////////
-int main (void) {
+// decode all video frames of an AVI file, straight from the mapped chunks
+static int decode_avi (const char *fname) {
+  zmbv_avi_reader_t zr = zmbv_avi_reader_open(fname);
+  zmbv_avi_info_t info;
+  zmbv_codec_t zc = NULL;
+  int count, keys = 0, res = -1;
+  uint64_t audiobytes = 0;
+  if (zr == NULL) { fprintf(stderr, "FATAL: can't open AVI '%s'!\n", fname); return -1; }
+  zmbv_avi_reader_get_info(zr, &info);
+  count = zmbv_avi_reader_chunk_count(zr, ZMBV_AVI_VIDEO);
+  printf("%dx%d, %g fps, codec %s, %d frames\n", info.width, info.height, info.fps, info.codec, count);
+  if (strcmp(info.codec, "ZMBV") != 0) { fprintf(stderr, "FATAL: not a ZMBV video!\n"); goto quit; }
+  zc = zmbv_codec_new(ZMBV_INIT_FLAG_NONE, 0, NULL);
+  if (zc == NULL || zmbv_decode_setup(zc, info.width, info.height) < 0) { fprintf(stderr, "FATAL: can't init decoder!\n"); goto quit; }
+  for (frameno = 0; frameno < count; ++frameno) {
+    zmbv_avi_chunk_t chunk;
+    if (zmbv_avi_reader_get_chunk(zr, ZMBV_AVI_VIDEO, frameno, &chunk) < 0 || zmbv_decode_frame(zc, chunk.data, chunk.size) < 0) {
+      printf("can't decode packed frame #%d\n", frameno);
+      break;
+    }
+    keys += chunk.keyframe;
+  }
+  if (frameno == count) {
+    for (int f = zmbv_avi_reader_chunk_count(zr, ZMBV_AVI_AUDIO)-1; f >= 0; --f) {
+      zmbv_avi_chunk_t chunk;
+      if (zmbv_avi_reader_get_chunk(zr, ZMBV_AVI_AUDIO, f, &chunk) == 0) audiobytes += chunk.size;
+    }
+    printf("%d frames decoded (%d keyframes), %llu bytes of audio\n", count, keys, (unsigned long long)audiobytes);
+    res = 0;
+  }
+quit:
+  zmbv_codec_free(zc);
+  zmbv_avi_reader_close(zr);
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+int main (int argc, char *argv[]) {
+  if (argc > 1) return (decode_avi(argv[1]) < 0 ? 1 : 0);
   zmbv_open();
   decode_screens();
   zmbv_close();
@@ -93,7 +93,13 @@ static int next_screen (zmbvu_unpacker_t zc) {
 static int do_decode_screens (int (*writer)(void *udata), void *udata) {
   int res = -1;
   zmbvu_unpacker_t zc;
-  zc = zmbvu_unpacker_new();
+#ifdef ZMBVU_STATIC
+  static uint8_t zcmem[512*1024];
+  if (zmbvu_memory_size(320, 240, ZMBVU_FORMAT_8BPP, 0, 0) > sizeof(zcmem)) { printf("FATAL: decoder memory is too small!\n"); return -1; }
+  zc = zmbvu_unpacker_init(zcmem, sizeof(zcmem));
+#else
+  zc = zmbvu_unpacker_new(NULL);
+#endif
   if (zc == NULL) { printf("FATAL: can't create decoder!\n"); return -1; }
   if (zmbvu_decode_setup(zc, 320, 240) < 0) { printf("FATAL: can't init decoder!\n"); goto quit; }
   frameno = 0;